@@ -0,0 +1,269 @@
+// ----------------------------------------------------------------------
+//
+//   Accelerometer abstraction for ESP32 devices
+//
+//   Copyright (C) 2022  Shoestring and University of Cambridge
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, version 3 of the License.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see https://www.gnu.org/licenses/.
+//
+// ----------------------------------------------------------------------
+
+#include "accel_sensor.h"
+#include "logger.h"
+
+// ADXL345 registers
+#define ADXL345_REG_DEVID 0x00
+#define ADXL345_REG_BW_RATE 0x2C
+#define ADXL345_REG_POWER_CTL 0x2D
+#define ADXL345_REG_DATA_FORMAT 0x31
+#define ADXL345_REG_DATAX0 0x32
+#define ADXL345_DEVICE_ID 0xE5
+#define ADXL345_SPI_READ 0x80
+#define ADXL345_SPI_MULTIBYTE 0x40
+
+#define ACCEL_SCALE (ADXL345_MG2G_MULTIPLIER * SENSORS_GRAVITY_STANDARD)
+
+static SPIClass accel_spi(HSPI);
+static bool accel_spi_started = false;
+
+// The ADXL345 rate codes run from 6 (6.25Hz) to 15 (3200Hz), doubling each step
+static uint8_t adxl345_rate_code(float min_hz, float &rate_hz) {
+  for (uint8_t code = 6; code <= 15; code++) {
+    rate_hz = 3200.0 / (1 << (15 - code));
+    if (rate_hz >= min_hz) {
+      return code;
+    }
+  }
+  return 15;
+}
+
+/****** ADXL345 over I2C ******/
+
+bool ADXL345I2C::begin() {
+  return bus.transaction(I2CPriority::sample, [&]() { return accel.begin(address); });
+}
+
+bool ADXL345I2C::read(float &x, float &y, float &z) {
+  // the data registers are read here rather than with getEvent(), which ignores the bus status and
+  // hands back 0g or stale data as a good sample when the sensor does not answer
+  uint8_t buffer[6];
+  bool ok = bus.transaction(I2CPriority::sample, [&]() {
+    TwoWire &wire = *bus.wire();
+    wire.beginTransmission(address);
+    wire.write(ADXL345_REG_DATAX0);
+    if (wire.endTransmission(false) != 0) {
+      return false;  // address or register not acknowledged
+    }
+    if (wire.requestFrom(address, (uint8_t)sizeof(buffer)) != sizeof(buffer)) {
+      return false;
+    }
+    for (uint8_t i = 0; i < sizeof(buffer); i++) {
+      buffer[i] = wire.read();
+    }
+    return true;
+  });
+  if (!ok) {
+    return false;
+  }
+  // full resolution, so the same 4mg/LSB scale as getEvent() on every range
+  x = (int16_t)(buffer[0] | (buffer[1] << 8)) * ACCEL_SCALE;
+  y = (int16_t)(buffer[2] | (buffer[3] << 8)) * ACCEL_SCALE;
+  z = (int16_t)(buffer[4] | (buffer[5] << 8)) * ACCEL_SCALE;
+  return true;
+}
+
+void ADXL345I2C::set_range(range_t range) {
+  bus.transaction(I2CPriority::sample, [&]() {
+    accel.setRange(range);
+    return true;
+  });
+}
+
+float ADXL345I2C::set_data_rate(float min_hz) {
+  float rate_hz;
+  uint8_t code = adxl345_rate_code(min_hz, rate_hz);
+  bus.transaction(I2CPriority::sample, [&]() {
+    accel.setDataRate((dataRate_t)code);
+    return true;
+  });
+  return rate_hz;
+}
+
+String ADXL345I2C::describe() {
+  return "adxl345@" + String(bus.get_name()) + ":0x" + String(address, HEX);
+}
+
+/****** ADXL345 over SPI ******/
+
+bool ADXL345SPI::begin() {
+  if (!accel_spi_started) {
+    accel_spi.begin(ACCEL_SPI_SCK_PIN, ACCEL_SPI_MISO_PIN, ACCEL_SPI_MOSI_PIN);
+    accel_spi_started = true;
+  }
+  pinMode(cs, OUTPUT);
+  digitalWrite(cs, HIGH);
+  if (read_register(ADXL345_REG_DEVID) != ADXL345_DEVICE_ID) {
+    return false;
+  }
+  write_register(ADXL345_REG_POWER_CTL, 0x08);  // measure
+  return true;
+}
+
+bool ADXL345SPI::read(float &x, float &y, float &z) {
+  // one burst for all six data registers so x, y and z come from the same conversion
+  uint8_t buffer[7] = { ADXL345_SPI_READ | ADXL345_SPI_MULTIBYTE | ADXL345_REG_DATAX0 };
+  spi.beginTransaction(settings);
+  digitalWrite(cs, LOW);
+  spi.transfer(buffer, sizeof(buffer));
+  digitalWrite(cs, HIGH);
+  spi.endTransaction();
+
+  // nothing drives MISO when the sensor is unplugged, so it reads all 0s or all 1s -
+  // never a real reading, gravity alone puts ~256 counts (1g) on some axis
+  bool all_low = true;
+  bool all_high = true;
+  for (uint8_t i = 1; i < sizeof(buffer); i++) {
+    all_low &= buffer[i] == 0x00;
+    all_high &= buffer[i] == 0xFF;
+  }
+  if (all_low || all_high) {
+    return false;
+  }
+
+  x = (int16_t)(buffer[1] | (buffer[2] << 8)) * ACCEL_SCALE;
+  y = (int16_t)(buffer[3] | (buffer[4] << 8)) * ACCEL_SCALE;
+  z = (int16_t)(buffer[5] | (buffer[6] << 8)) * ACCEL_SCALE;
+  return true;
+}
+
+void ADXL345SPI::set_range(range_t range) {
+  // full resolution keeps the 4mg/LSB scale for every range, as the Adafruit driver does
+  uint8_t format = read_register(ADXL345_REG_DATA_FORMAT);
+  format &= ~0x0F;
+  format |= range | 0x08;
+  write_register(ADXL345_REG_DATA_FORMAT, format);
+}
+
+float ADXL345SPI::set_data_rate(float min_hz) {
+  float rate_hz;
+  write_register(ADXL345_REG_BW_RATE, adxl345_rate_code(min_hz, rate_hz));
+  return rate_hz;
+}
+
+String ADXL345SPI::describe() {
+  return "adxl345@spi:" + String(cs);
+}
+
+uint8_t ADXL345SPI::read_register(uint8_t reg) {
+  spi.beginTransaction(settings);
+  digitalWrite(cs, LOW);
+  spi.transfer(ADXL345_SPI_READ | reg);
+  uint8_t value = spi.transfer(0);
+  digitalWrite(cs, HIGH);
+  spi.endTransaction();
+  return value;
+}
+
+void ADXL345SPI::write_register(uint8_t reg, uint8_t value) {
+  spi.beginTransaction(settings);
+  digitalWrite(cs, LOW);
+  spi.transfer(reg);
+  spi.transfer(value);
+  digitalWrite(cs, HIGH);
+  spi.endTransaction();
+}
+
+/****** Simulated ******/
+
+bool SimulatedAccel::begin() {
+  last_us = micros();
+  return true;
+}
+
+// tone plus second harmonic on x, gravity on z, noise on all axes
+bool SimulatedAccel::read(float &x, float &y, float &z) {
+  uint32_t now = micros();
+  phase += 2 * PI * tone_hz * (now - last_us) * 1e-6f;
+  phase = fmodf(phase, 2 * PI);
+  last_us = now;
+
+  x = sin(phase) + 0.3 * sin(2 * phase) + noise();
+  y = noise();
+  z = SENSORS_GRAVITY_STANDARD + noise();
+  return true;
+}
+
+String SimulatedAccel::describe() {
+  return "sim@" + String(tone_hz, 1);
+}
+
+// roughly gaussian, sd ~0.05 m/s^2 (sum of two uniforms from an LCG)
+float SimulatedAccel::noise() {
+  float sum = 0;
+  for (uint8_t i = 0; i < 2; i++) {
+    seed = seed * 1664525 + 1013904223;
+    sum += (seed >> 8) * (1.0f / 16777216.0f) - 0.5f;
+  }
+  return sum * 0.12f;
+}
+
+/****** Channel list ******/
+
+static AccelSensor *create_accel_sensor(String item) {
+  item.trim();
+  int at = item.indexOf('@');
+  String type = at < 0 ? item : item.substring(0, at);
+  String arg = at < 0 ? "" : item.substring(at + 1);
+
+  if (type == "i2c") {
+    uint8_t address = arg.length() ? strtol(arg.c_str(), NULL, 0) : ADXL345_DEFAULT_ADDRESS;
+    return new ADXL345I2C(i2c_bus0, address);
+  }
+  if (type == "spi" && arg.length()) {
+    return new ADXL345SPI(accel_spi, arg.toInt());
+  }
+  if (type == "sim") {
+    return new SimulatedAccel(arg.length() ? arg.toFloat() : 50.0);
+  }
+  return NULL;
+}
+
+uint8_t create_accel_sensors(const String &spec, AccelSensor **channels, uint8_t max_channels) {
+  uint8_t n_channels = 0;
+  int start = 0;
+  while (start <= (int)spec.length() && n_channels < max_channels) {
+    int end = spec.indexOf(',', start);
+    if (end < 0) {
+      end = spec.length();
+    }
+    String item = spec.substring(start, end);
+    start = end + 1;
+    if (item.length() == 0) {
+      continue;
+    }
+
+    AccelSensor *sensor = create_accel_sensor(item);
+    if (sensor == NULL) {
+      LOG_ERROR("Unknown accelerometer \"%s\"", item.c_str());
+      continue;
+    }
+    if (!sensor->begin()) {
+      LOG_ERROR("No accelerometer at %s ... Check your wiring!", sensor->describe().c_str());
+      delete sensor;
+      continue;
+    }
+    LOG_INFO("Channel %u: %s", n_channels, sensor->describe().c_str());
+    channels[n_channels++] = sensor;
+  }
+  return n_channels;
+}
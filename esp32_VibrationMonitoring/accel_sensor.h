@@ -0,0 +1,126 @@
+// ----------------------------------------------------------------------
+//
+//   Accelerometer abstraction for ESP32 devices
+//
+//   Copyright (C) 2022  Shoestring and University of Cambridge
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, version 3 of the License.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see https://www.gnu.org/licenses/.
+//
+// ----------------------------------------------------------------------
+
+#ifndef ACCEL_SENSOR_H
+#define ACCEL_SENSOR_H
+
+#include <Arduino.h>
+#include <SPI.h>
+#include <Adafruit_ADXL345_U.h>
+#include "i2c_bus.h"
+
+/**********************************************************
+ * One interface for every accelerometer the sampler can
+ * read, so a node can monitor several points of a machine.
+ *
+ * The sensors are listed in the "accels" config item,
+ * comma separated, one channel each:
+ *
+ *   i2c[@addr]  ADXL345 on Wire (0x53, or 0x1D with SDO high)
+ *   spi@<cs>    ADXL345 on its own SPI bus, chip select pin
+ *   sim@<hz>    simulated sensor, tone at <hz> plus noise
+ *
+ * e.g. "i2c,spi@10" for motor and pump end. SPI reads take
+ * a fraction of the time of an I2C read, so use SPI sensors
+ * when several channels or high sample rates are needed.
+ *
+ * read() returns m/s^2, or false when the sensor did not
+ * answer, and must be callable from the sampling task only.
+ **/
+
+#define ACCEL_MAX_CHANNELS 4
+#define ACCEL_DEFAULT_SPEC "i2c"
+
+// second SPI bus for the accelerometers, the display owns the default one. Keep clear of
+// GPIO13, the status LED driven by WifiManager, and of the I2C2 pins
+#define ACCEL_SPI_SCK_PIN 12
+#define ACCEL_SPI_MISO_PIN 9
+#define ACCEL_SPI_MOSI_PIN 11
+#define ACCEL_SPI_CLOCK 5000000  // ADXL345 maximum
+
+class AccelSensor {
+public:
+  virtual ~AccelSensor() {}
+  virtual bool begin() = 0;
+  virtual bool read(float &x, float &y, float &z) = 0;
+  virtual void set_range(range_t range) = 0;
+  // slowest output data rate at or above min_hz, returns the rate chosen
+  virtual float set_data_rate(float min_hz) = 0;
+  virtual String describe() = 0;
+};
+
+class ADXL345I2C : public AccelSensor {
+public:
+  ADXL345I2C(I2CBus &bus, uint8_t address)
+    : bus(bus), address(address) {}
+  bool begin() override;
+  bool read(float &x, float &y, float &z) override;
+  void set_range(range_t range) override;
+  float set_data_rate(float min_hz) override;
+  String describe() override;
+
+private:
+  I2CBus &bus;
+  uint8_t address;
+  Adafruit_ADXL345_Unified accel;
+};
+
+class ADXL345SPI : public AccelSensor {
+public:
+  ADXL345SPI(SPIClass &spi, uint8_t cs)
+    : spi(spi), cs(cs), settings(ACCEL_SPI_CLOCK, MSBFIRST, SPI_MODE3) {}
+  bool begin() override;
+  bool read(float &x, float &y, float &z) override;
+  void set_range(range_t range) override;
+  float set_data_rate(float min_hz) override;
+  String describe() override;
+
+private:
+  SPIClass &spi;
+  uint8_t cs;
+  SPISettings settings;
+
+  uint8_t read_register(uint8_t reg);
+  void write_register(uint8_t reg, uint8_t value);
+};
+
+class SimulatedAccel : public AccelSensor {
+public:
+  SimulatedAccel(float tone_hz)
+    : tone_hz(tone_hz) {}
+  bool begin() override;
+  bool read(float &x, float &y, float &z) override;
+  void set_range(range_t range) override {}
+  float set_data_rate(float min_hz) override { return min_hz; }
+  String describe() override;
+
+private:
+  float tone_hz;
+  float phase = 0;
+  uint32_t last_us = 0;
+  uint32_t seed = 12345;
+
+  float noise();
+};
+
+// builds and starts the sensors listed in spec, returns the channel count
+uint8_t create_accel_sensors(const String &spec, AccelSensor **channels, uint8_t max_channels);
+
+#endif
@@ -0,0 +1,148 @@
+// ----------------------------------------------------------------------
+//
+//   Auxiliary sensor scheduler for ESP32 devices
+//
+//   Copyright (C) 2022  Shoestring and University of Cambridge
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, version 3 of the License.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see https://www.gnu.org/licenses/.
+//
+// ----------------------------------------------------------------------
+
+#include "aux_sensors.h"
+#include "logger.h"
+#include "memory_budget.h"
+
+AuxSensorScheduler aux_sensors;
+
+// register before begin()
+bool AuxSensorScheduler::add_sensor(const char *name, uint32_t period_ms, AuxReader reader) {
+  if (n_sensors >= AUX_MAX_SENSORS || task != NULL) {
+    LOG_ERROR("Aux sensor %s not added", name);
+    return false;
+  }
+  Entry &entry = sensors[n_sensors++];
+  entry.name = name;
+  entry.period_ms = max(period_ms, (uint32_t)10);
+  entry.reader = reader;
+  entry.next_due_ms = millis();
+  entry.valid = false;
+  entry.value = 0;
+  entry.read_at_ms = 0;
+  entry.reads = 0;
+  entry.failures = 0;
+  entry.max_read_us = 0;
+  LOG_INFO("Aux sensor %s every %lu ms", name, (unsigned long)entry.period_ms);
+  return true;
+}
+
+void AuxSensorScheduler::begin() {
+  if (n_sensors == 0 || task != NULL) {
+    return;
+  }
+  xTaskCreatePinnedToCore(
+    aux_task,              /* Task function. */
+    "AuxSensors",          /* name of task. */
+    AUX_TASK_STACK,        /* Stack size of task */
+    this,                  /* parameter of the task */
+    tskIDLE_PRIORITY + 1,  /* priority of the task */
+    &task,                 /* Task handle to keep track of created task */
+    1);                    /* pin task to core 1 */
+  memory_budget.watch_stack("AuxSensors", task, AUX_TASK_STACK);
+}
+
+void AuxSensorScheduler::aux_task(void *pvParameters) {
+  AuxSensorScheduler *self = (AuxSensorScheduler *)pvParameters;
+  for (;;) {
+    uint32_t sleep_ms = self->poll_due();
+    vTaskDelay(max(pdMS_TO_TICKS(sleep_ms), (TickType_t)1));
+  }
+}
+
+// reads every sensor that is due and returns the time until the next one
+uint32_t AuxSensorScheduler::poll_due() {
+  uint32_t now = (uint32_t)millis();
+  uint32_t sleep_ms = UINT32_MAX;
+  for (uint8_t i = 0; i < n_sensors; i++) {
+    Entry &entry = sensors[i];
+    if ((int32_t)(now - entry.next_due_ms) >= 0) {
+      float value;
+      uint32_t start = micros();
+      bool ok = entry.reader(value) && !isnan(value);
+      uint32_t read_us = micros() - start;
+
+      portENTER_CRITICAL(&mux);
+      entry.reads++;
+      entry.max_read_us = max(entry.max_read_us, read_us);
+      if (ok) {
+        entry.value = value;
+        entry.read_at_ms = millis();
+        entry.valid = true;
+      } else {
+        entry.failures++;
+      }
+      portEXIT_CRITICAL(&mux);
+      if (!ok) {
+        LOG_EVERY_MS(10000, LOG_WARN, "Aux sensor %s read failed", entry.name);
+      }
+
+      // stay on the original grid unless we fell more than a period behind
+      entry.next_due_ms += entry.period_ms;
+      if ((int32_t)((uint32_t)millis() - entry.next_due_ms) > 0) {
+        entry.next_due_ms = (uint32_t)millis() + entry.period_ms;
+      }
+    }
+    int32_t until = (int32_t)(entry.next_due_ms - (uint32_t)millis());
+    sleep_ms = min(sleep_ms, (uint32_t)max(until, (int32_t)0));
+  }
+  return sleep_ms;
+}
+
+bool AuxSensorScheduler::latest(const char *name, float &value, uint32_t &age_ms) {
+  for (uint8_t i = 0; i < n_sensors; i++) {
+    if (strcmp(sensors[i].name, name) == 0) {
+      portENTER_CRITICAL(&mux);
+      bool valid = sensors[i].valid;
+      value = sensors[i].value;
+      age_ms = millis() - sensors[i].read_at_ms;
+      portEXIT_CRITICAL(&mux);
+      return valid;
+    }
+  }
+  return false;
+}
+
+void AuxSensorScheduler::attach(JsonDocument &frame) {
+  for (uint8_t i = 0; i < n_sensors; i++) {
+    float value;
+    uint32_t age_ms;
+    if (latest(sensors[i].name, value, age_ms)) {
+      frame[sensors[i].name] = value;
+      frame["aux_age_ms"][sensors[i].name] = age_ms;
+    }
+  }
+}
+
+void AuxSensorScheduler::report(JsonObject out) {
+  for (uint8_t i = 0; i < n_sensors; i++) {
+    JsonObject section = out.createNestedObject(sensors[i].name);
+    portENTER_CRITICAL(&mux);
+    uint32_t reads = sensors[i].reads;
+    uint32_t failures = sensors[i].failures;
+    uint32_t max_read_us = sensors[i].max_read_us;
+    portEXIT_CRITICAL(&mux);
+    section["period_ms"] = sensors[i].period_ms;
+    section["reads"] = reads;
+    section["failures"] = failures;
+    section["read_max_us"] = max_read_us;
+  }
+}
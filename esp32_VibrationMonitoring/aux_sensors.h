@@ -0,0 +1,82 @@
+// ----------------------------------------------------------------------
+//
+//   Auxiliary sensor scheduler for ESP32 devices
+//
+//   Copyright (C) 2022  Shoestring and University of Cambridge
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, version 3 of the License.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see https://www.gnu.org/licenses/.
+//
+// ----------------------------------------------------------------------
+
+#ifndef AUX_SENSORS_H
+#define AUX_SENSORS_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <functional>
+
+/**********************************************************
+ * Polls slow sensors (temperature etc.) in the background,
+ * each at its own period, and caches the latest value.
+ *
+ * A sensor is added by registering a reader that fills in
+ * a float and returns false on failure. Frames pick up the
+ * cached values with attach(), which never touches a bus:
+ *
+ *   "temperature": 23.4,
+ *   "aux_age_ms": {"temperature": 812}
+ *
+ * Sensors with no good reading yet are left out.
+ **/
+
+#define AUX_MAX_SENSORS 8
+#define AUX_TASK_STACK 3072
+
+typedef std::function<bool(float &value)> AuxReader;
+
+class AuxSensorScheduler {
+public:
+  bool add_sensor(const char *name, uint32_t period_ms, AuxReader reader);
+  void begin();
+  bool latest(const char *name, float &value, uint32_t &age_ms);
+  void attach(JsonDocument &frame);
+  void report(JsonObject out);
+  // reads the sensors that are due, returns ms until the next one (run by the task, or the host simulator)
+  uint32_t poll_due();
+
+private:
+  struct Entry {
+    const char *name;
+    uint32_t period_ms;
+    AuxReader reader;
+    uint32_t next_due_ms;
+    // guarded by mux
+    bool valid;
+    float value;
+    uint32_t read_at_ms;
+    uint32_t reads;
+    uint32_t failures;
+    uint32_t max_read_us;
+  };
+
+  Entry sensors[AUX_MAX_SENSORS];
+  uint8_t n_sensors = 0;
+  TaskHandle_t task = NULL;
+  portMUX_TYPE mux = portMUX_INITIALIZER_UNLOCKED;
+
+  static void aux_task(void *pvParameters);
+};
+
+extern AuxSensorScheduler aux_sensors;
+
+#endif
@@ -0,0 +1,162 @@
+// ----------------------------------------------------------------------
+//
+//   Start-up benchmarks for ESP32 devices
+//
+//   Copyright (C) 2022  Shoestring and University of Cambridge
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, version 3 of the License.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see https://www.gnu.org/licenses/.
+//
+// ----------------------------------------------------------------------
+
+#include "benchmarks.h"
+#include "logger.h"
+#include "arduinoFFT.h"
+
+#ifdef RUN_BENCHMARKS
+
+static float bench_input[BENCH_BLOCK];
+static float bench_output[BENCH_BLOCK];
+static Decimator bench_decimator;
+static uint16_t bench_codes[BENCH_BLOCK / 2];
+static uint8_t bench_packed[spectrum_packed_bytes(BENCH_BLOCK / 2, SPECTRUM_MAX_BITS)];
+static char bench_text[spectrum_text_bytes(BENCH_BLOCK / 2, SPECTRUM_MAX_BITS)];
+static LineTracker bench_tracker;
+
+static void fill_bench_input() {
+  uint32_t seed = 1;
+  for (uint16_t i = 0; i < BENCH_BLOCK; i++) {
+    seed = seed * 1664525 + 1013904223;
+    bench_input[i] = (seed >> 8) * (1.0f / 16777216.0f) - 0.5f;
+  }
+}
+
+void benchmark_sampling(AccelSensor **channels, uint8_t n_channels, float sample_rate) {
+  float x, y, z;
+  for (uint8_t c = 0; c < n_channels; c++) {
+    uint32_t start = bench_cycles();
+    for (uint16_t i = 0; i < BENCH_SAMPLING_TICKS; i++) {
+      channels[c]->read(x, y, z);
+    }
+    uint32_t cycles = (bench_cycles() - start) / BENCH_SAMPLING_TICKS;
+    LOG_INFO("[bench] read %s: %lu cycles, %.1f us", channels[c]->describe().c_str(),
+             (unsigned long)cycles, bench_cycles_to_us(cycles));
+  }
+
+  for (uint8_t n = 1; n <= n_channels; n++) {
+    uint32_t start = bench_cycles();
+    for (uint16_t i = 0; i < BENCH_SAMPLING_TICKS; i++) {
+      for (uint8_t c = 0; c < n; c++) {
+        channels[c]->read(x, y, z);
+      }
+    }
+    uint32_t cycles = (bench_cycles() - start) / BENCH_SAMPLING_TICKS;
+    float tick_us = bench_cycles_to_us(cycles);
+    LOG_INFO("[bench] sampling %u ch: %lu cycles, %.1f us/tick, max %.0f Hz (running %.0f Hz)%s", n,
+             (unsigned long)cycles, tick_us, 1e6 / tick_us, sample_rate,
+             tick_us * sample_rate > 1e6 ? " TOO SLOW" : "");
+    delay(LOG_DRAIN_PERIOD_MS);  // let the log drain so lines are not dropped
+  }
+}
+
+void benchmark_decimator() {
+#ifdef DECIMATOR_ESP_DSP
+  const char *kernel = "esp-dsp";
+#else
+  const char *kernel = "unrolled";
+#endif
+  fill_bench_input();
+  bench_decimator.begin(DECIMATOR_MAX_FACTOR);  // takes the largest filter from the arena, the loop reuses it
+  for (uint8_t factor = 2; factor <= DECIMATOR_MAX_FACTOR; factor *= 2) {
+    bench_decimator.begin(factor);
+    bench_decimator.process(bench_input, BENCH_BLOCK, bench_output);  // fill the delay line
+    uint32_t start = bench_cycles();
+    bench_decimator.process(bench_input, BENCH_BLOCK, bench_output);
+    uint32_t cycles = bench_cycles() - start;
+    // the sampler pushes one sample a tick
+    start = bench_cycles();
+    for (uint16_t i = 0; i < BENCH_BLOCK; i++) {
+      bench_decimator.push(bench_input[i], bench_output[0]);
+    }
+    uint32_t push_cycles = bench_cycles() - start;
+    LOG_INFO("[bench] decimate by %u (%u taps, %s): %.1f cycles/input sample, %.1f pushed", factor,
+             bench_decimator.get_taps(), kernel, cycles / (float)BENCH_BLOCK, push_cycles / (float)BENCH_BLOCK);
+  }
+}
+
+// a magnitude spectrum of BENCH_BLOCK / 2 bins: noise with a few harmonics on top
+static void fill_bench_spectrum() {
+  fill_bench_input();
+  for (uint16_t i = 0; i < BENCH_BLOCK / 2; i++) {
+    bench_input[i] = 2 + fabsf(bench_input[i]);
+  }
+  for (uint16_t h = 1; h <= 4; h++) {
+    bench_input[h * 85] = 500.0f / h;
+    bench_input[h * 85 - 1] = bench_input[h * 85 + 1] = 150.0f / h;
+  }
+}
+
+void benchmark_spectrum_codec() {
+  const uint16_t bins = BENCH_BLOCK / 2;
+  fill_bench_spectrum();
+  for (uint8_t bits = 8; bits <= SPECTRUM_MAX_BITS; bits += 4) {
+    for (float floor_db : { (float)NAN, 6.0f }) {
+      SpectrumHeader header;
+      uint32_t start = bench_cycles();
+      spectrum_quantise(bench_input, bins, bits, floor_db, bench_output, bench_codes, header);
+      uint32_t quantised = bench_cycles();
+      size_t length = spectrum_pack(bench_codes, header, bench_packed);
+      uint32_t packed = bench_cycles();
+      size_t text = base64_encode(bench_packed, length, bench_text);
+      uint32_t end = bench_cycles();
+      LOG_INFO("[bench] spectrum %u bits%s: quantise %.0f us, pack %.0f us, base64 %.0f us, %u bytes (%.2f bits/bin)",
+               bits, isnan(floor_db) ? "" : ", floor 6 dB", bench_cycles_to_us(quantised - start),
+               bench_cycles_to_us(packed - quantised), bench_cycles_to_us(end - packed), (unsigned)text,
+               length * 8.0f / bins);
+    }
+    delay(LOG_DRAIN_PERIOD_MS);  // let the log drain so lines are not dropped
+  }
+}
+
+void benchmark_line_tracker(float sample_rate) {
+  // what loop_callback does to a buffer before it can look at a line
+  fill_bench_input();
+  ArduinoFFT<float> fft(bench_input, bench_output, BENCH_BLOCK, sample_rate, true);
+  memset(bench_output, 0, sizeof(bench_output));
+  uint32_t start = bench_cycles();
+  fft.windowing(FFTWindow::Hamming, FFTDirection::Forward);
+  fft.compute(FFTDirection::Forward);
+  fft.complexToMagnitude();
+  uint32_t fft_cycles = bench_cycles() - start;
+  LOG_INFO("[bench] FFT %u points (window, FFT, magnitude): %.0f us, %.1f cycles/sample", BENCH_BLOCK,
+           bench_cycles_to_us(fft_cycles), fft_cycles / (float)BENCH_BLOCK);
+
+  fill_bench_input();
+  String freqs;
+  for (uint8_t lines = 1; lines <= TRACK_MAX_LINES; lines++) {
+    freqs += String(freqs.length() ? "," : "") + String(sample_rate * (lines + 2) / (2 * TRACK_MAX_LINES + 8), 2);
+    if ((lines & (lines - 1)) != 0) {
+      continue;  // powers of two only
+    }
+    bench_tracker.begin(sample_rate, freqs, BENCH_BLOCK);
+    start = bench_cycles();
+    for (uint16_t i = 0; i < BENCH_BLOCK; i++) {
+      bench_tracker.push(bench_input[i]);
+    }
+    uint32_t cycles = bench_cycles() - start;
+    LOG_INFO("[bench] goertzel %u lines: %.0f us per %u samples, %.1f cycles/sample (%.1f%% of the FFT)", lines,
+             bench_cycles_to_us(cycles), BENCH_BLOCK, cycles / (float)BENCH_BLOCK, 100.0f * cycles / fft_cycles);
+    delay(LOG_DRAIN_PERIOD_MS);  // let the log drain so lines are not dropped
+  }
+}
+
+#endif
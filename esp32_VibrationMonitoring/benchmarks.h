@@ -0,0 +1,66 @@
+// ----------------------------------------------------------------------
+//
+//   Start-up benchmarks for ESP32 devices
+//
+//   Copyright (C) 2022  Shoestring and University of Cambridge
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, version 3 of the License.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see https://www.gnu.org/licenses/.
+//
+// ----------------------------------------------------------------------
+
+#ifndef BENCHMARKS_H
+#define BENCHMARKS_H
+
+#include <Arduino.h>
+#include "accel_sensor.h"
+#include "decimator.h"
+#include "spectrum_codec.h"
+#include "line_tracker.h"
+
+/**********************************************************
+ * Timing of the hot paths on the real hardware, measured
+ * with the CPU cycle counter once at start-up (before the
+ * sampling task starts) and written to the log as
+ *
+ *   [bench] <what>: <cycles> cycles, <us> us ...
+ *
+ * Only built when RUN_BENCHMARKS is defined.
+ **/
+
+// #define RUN_BENCHMARKS
+
+#define BENCH_SAMPLING_TICKS 200
+#define BENCH_BLOCK 1024
+
+#ifdef RUN_BENCHMARKS
+#define BENCH_ARENA_BYTES DECIMATOR_ARENA_BYTES(DECIMATOR_MAX_FACTOR)
+#else
+#define BENCH_ARENA_BYTES 0
+#endif
+
+#ifdef RUN_BENCHMARKS
+
+inline uint32_t bench_cycles() { return ESP.getCycleCount(); }
+inline float bench_cycles_to_us(uint32_t cycles) { return cycles / (float)ESP.getCpuFreqMHz(); }
+
+// one sampler tick for the first 1..n_channels channels
+void benchmark_sampling(AccelSensor **channels, uint8_t n_channels, float sample_rate);
+// decimator cycles per input sample for factors 2, 4 and 8
+void benchmark_decimator();
+void benchmark_spectrum_codec();
+// the Goertzel bank for 1..TRACK_MAX_LINES lines against one BENCH_BLOCK point FFT over the same samples
+void benchmark_line_tracker(float sample_rate);
+
+#endif
+
+#endif
@@ -0,0 +1,88 @@
+// ----------------------------------------------------------------------
+//
+//   Boot phase profiler for ESP32 devices
+//
+//   Copyright (C) 2022  Shoestring and University of Cambridge
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, version 3 of the License.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see https://www.gnu.org/licenses/.
+//
+// ----------------------------------------------------------------------
+
+#include "boot_profiler.h"
+#include "logger.h"
+
+BootProfiler boot_profiler;
+
+void BootProfiler::phase_done(const char *name) {
+  uint32_t now = micros();
+  portENTER_CRITICAL(&mux);
+  if (n_phases < BOOT_MAX_PHASES) {
+    phases[n_phases++] = { name, now };
+  }
+  portEXIT_CRITICAL(&mux);
+}
+
+void BootProfiler::milestone(const char *name) {
+  uint32_t now = micros();
+  bool added = false;
+  portENTER_CRITICAL(&mux);
+  bool seen = false;
+  for (uint8_t i = 0; i < n_milestones; i++) {
+    if (strcmp(milestones[i].name, name) == 0) {
+      seen = true;
+      break;
+    }
+  }
+  if (!seen && n_milestones < BOOT_MAX_MILESTONES) {
+    milestones[n_milestones++] = { name, now };
+    added = true;
+  }
+  portEXIT_CRITICAL(&mux);
+
+  if (added) {
+    LOG_INFO("[boot] %s at %lu ms", name, (unsigned long)(now / 1000));
+  }
+}
+
+bool BootProfiler::reached(const char *name) {
+  for (uint8_t i = 0; i < n_milestones; i++) {
+    if (strcmp(milestones[i].name, name) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void BootProfiler::report(JsonObject out) {
+  JsonObject phase_ms = out.createNestedObject("phase_ms");
+  uint32_t previous = 0;
+  for (uint8_t i = 0; i < n_phases; i++) {
+    phase_ms[phases[i].name] = (phases[i].at_us - previous) / 1000;
+    previous = phases[i].at_us;
+  }
+  JsonObject at_ms = out.createNestedObject("at_ms");
+  for (uint8_t i = 0; i < n_milestones; i++) {
+    at_ms[milestones[i].name] = milestones[i].at_us / 1000;
+  }
+}
+
+void BootProfiler::log_summary() {
+  uint32_t previous = 0;
+  for (uint8_t i = 0; i < n_phases; i++) {
+    LOG_INFO("[boot] phase %-10s %5lu ms", phases[i].name, (unsigned long)((phases[i].at_us - previous) / 1000));
+    previous = phases[i].at_us;
+  }
+  for (uint8_t i = 0; i < n_milestones; i++) {
+    LOG_INFO("[boot] %-14s at %5lu ms", milestones[i].name, (unsigned long)(milestones[i].at_us / 1000));
+  }
+}
@@ -0,0 +1,65 @@
+// ----------------------------------------------------------------------
+//
+//   Boot phase profiler for ESP32 devices
+//
+//   Copyright (C) 2022  Shoestring and University of Cambridge
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, version 3 of the License.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see https://www.gnu.org/licenses/.
+//
+// ----------------------------------------------------------------------
+
+#ifndef BOOT_PROFILER_H
+#define BOOT_PROFILER_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+/**********************************************************
+ * Records how long each part of a cold start takes.
+ *
+ * phase_done(name) closes a sequential setup phase: its
+ * duration is the time since the previous phase ended.
+ * milestone(name) stamps an asynchronous event (WiFi up,
+ * clock synced, first frame published...) with its time
+ * since power-on; only the first occurrence is kept, so it
+ * is safe to call from a path that repeats.
+ *
+ * All times are from micros(), which starts at reset.
+ **/
+
+#define BOOT_MAX_PHASES 12
+#define BOOT_MAX_MILESTONES 8
+
+class BootProfiler {
+public:
+  void phase_done(const char *name);
+  void milestone(const char *name);
+  bool reached(const char *name);
+  void report(JsonObject out);
+  void log_summary();
+
+private:
+  struct Entry {
+    const char *name;
+    uint32_t at_us;
+  };
+  Entry phases[BOOT_MAX_PHASES];
+  Entry milestones[BOOT_MAX_MILESTONES];
+  uint8_t n_phases = 0;
+  uint8_t n_milestones = 0;
+  portMUX_TYPE mux = portMUX_INITIALIZER_UNLOCKED;
+};
+
+extern BootProfiler boot_profiler;
+
+#endif
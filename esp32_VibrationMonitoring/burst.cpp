@@ -0,0 +1,165 @@
+// ----------------------------------------------------------------------
+//
+//   Burst measurement scheduler for ESP32 devices
+//
+//   Copyright (C) 2022  Shoestring and University of Cambridge
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, version 3 of the License.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see https://www.gnu.org/licenses/.
+//
+// ----------------------------------------------------------------------
+
+#include "burst.h"
+#include "logger.h"
+#include <esp_wifi.h>
+#ifdef CONFIG_PM_ENABLE
+#include <esp_pm.h>
+#include <esp_idf_version.h>
+#endif
+
+BurstScheduler burst;
+
+void BurstScheduler::begin(uint32_t period_s, int frames) {
+  if (period_s == 0) {
+    phase = BurstPhase::continuous;
+    return;
+  }
+  period_ms = period_s * 1000;
+  this->frames = constrain(frames, 1, BURST_MAX_FRAMES);
+  armed = xSemaphoreCreateBinary();
+  begin_ms = millis();
+  idle_start_ms = begin_ms;
+  next_slot_ms = begin_ms;  // first burst straight away
+  phase = BurstPhase::idle;
+
+#ifdef CONFIG_PM_ENABLE
+  // light sleep whenever every task is blocked, the radio wakes for its beacons
+#if ESP_IDF_VERSION_MAJOR >= 5
+  esp_pm_config_t pm = {};
+#elif defined(CONFIG_IDF_TARGET_ESP32S3)
+  esp_pm_config_esp32s3_t pm = {};
+#elif defined(CONFIG_IDF_TARGET_ESP32S2)
+  esp_pm_config_esp32s2_t pm = {};
+#elif defined(CONFIG_IDF_TARGET_ESP32C3)
+  esp_pm_config_esp32c3_t pm = {};
+#else
+  esp_pm_config_esp32_t pm = {};
+#endif
+  pm.max_freq_mhz = 240;
+  pm.min_freq_mhz = 80;
+  pm.light_sleep_enable = true;
+  if (esp_pm_configure(&pm) != ESP_OK) {
+    LOG_WARN("Burst: light sleep not available");
+  }
+#endif
+  LOG_INFO("Burst: %u frame(s) every %lu s", this->frames, (unsigned long)period_s);
+}
+
+void BurstScheduler::wait_for_arm() {
+  while (!is_sampling()) {
+    xSemaphoreTake(armed, portMAX_DELAY);
+  }
+}
+
+// true once after every arm - the filters still hold the end of the last burst
+bool BurstScheduler::take_restart() {
+  if (!restart) {
+    return false;
+  }
+  restart = false;
+  return true;
+}
+
+// called when a buffer of every channel is ready, more_needed while some other
+// analysis (the zoom) still needs samples
+void BurstScheduler::buffer_filled(bool more_needed) {
+  if (phase != BurstPhase::acquire) {
+    return;
+  }
+  if (frames_acquired < frames) {
+    frames_acquired++;
+  }
+  if (frames_acquired >= frames && !more_needed) {
+    stop_ms = millis();
+    phase = BurstPhase::process;
+  }
+}
+
+void BurstScheduler::arm(uint32_t now) {
+  idle_ms = now - idle_start_ms;
+  arm_ms = now;
+  frames_acquired = 0;
+  bursts++;
+  set_power_save(false);
+  restart = true;
+  phase = BurstPhase::acquire;
+  xSemaphoreGive(armed);
+  LOG_DEBUG("Burst %lu started", (unsigned long)bursts);
+}
+
+void BurstScheduler::poll() {
+  if (phase == BurstPhase::continuous) {
+    triggered = false;
+    return;
+  }
+  uint32_t now = millis();
+  bool slot = (int32_t)(now - next_slot_ms) >= 0;
+  if (slot) {
+    // stay on the grid, skipping slots that were missed altogether
+    while ((int32_t)(now - next_slot_ms) >= 0) {
+      next_slot_ms += period_ms;
+    }
+  }
+  bool trigger = triggered;
+  triggered = false;
+  if (trigger) {
+    triggers++;
+  }
+
+  if (phase == BurstPhase::process) {
+    // every frame of the burst has been analysed and handed to MQTT
+    idle_start_ms = now;
+    acquire_ms = stop_ms - arm_ms;
+    process_ms = now - stop_ms;
+    awake_total_ms += now - arm_ms;
+    phase = BurstPhase::idle;
+    set_power_save(true);
+    LOG_DEBUG("Burst done: acquire %lu ms, process %lu ms", (unsigned long)acquire_ms, (unsigned long)process_ms);
+  }
+
+  if (slot || trigger) {
+    if (phase == BurstPhase::idle) {
+      arm(now);
+    } else {
+      busy++;
+    }
+  }
+}
+
+void BurstScheduler::set_power_save(bool on) {
+  // modem sleep skips beacons while idle, back to the Arduino default for the burst
+  esp_wifi_set_ps(on ? WIFI_PS_MAX_MODEM : WIFI_PS_MIN_MODEM);
+}
+
+void BurstScheduler::report(JsonObject out) {
+  out["period_s"] = period_ms / 1000;
+  out["frames"] = frames;
+  out["bursts"] = bursts;
+  out["triggers"] = triggers;
+  out["busy"] = busy;
+  out["acquire_ms"] = acquire_ms;
+  out["process_ms"] = process_ms;
+  out["awake_ms"] = acquire_ms + process_ms;
+  out["idle_ms"] = idle_ms;
+  uint32_t elapsed = millis() - begin_ms;
+  out["duty"] = elapsed ? (float)awake_total_ms / elapsed : 0;
+}
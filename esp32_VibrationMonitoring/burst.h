@@ -0,0 +1,119 @@
+// ----------------------------------------------------------------------
+//
+//   Burst measurement scheduler for ESP32 devices
+//
+//   Copyright (C) 2022  Shoestring and University of Cambridge
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, version 3 of the License.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see https://www.gnu.org/licenses/.
+//
+// ----------------------------------------------------------------------
+
+#ifndef BURST_H
+#define BURST_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+/**********************************************************
+ * Duty-cycled measurement.
+ *
+ * With "burst_period_s" at 0 (the default) the sampler runs
+ * all the time as before. Otherwise the node wakes every
+ * burst_period_s, acquires "burst_frames" buffers of every
+ * channel, analyses and publishes them and then stops the
+ * sampler until the next slot:
+ *
+ *   idle -> acquire -> process -> idle ...
+ *
+ * While idle the sampling task blocks instead of spinning
+ * core 0, the analysis loop only polls MQTT every
+ * BURST_IDLE_POLL_MS, the wifi task every
+ * BURST_IDLE_WIFI_TICK_MS instead of WIFI_TICK_MS, and the
+ * radio is in maximum modem sleep. When the core is built
+ * with power management (CONFIG_PM_ENABLE, plus tickless
+ * idle) the CPU also drops into light sleep whenever every
+ * task is blocked.
+ *
+ * With the zoom on, acquisition carries on (publishing more
+ * frames) until the zoom spectrum is complete as well.
+ *
+ * A message on cmd/<identifier>/measure starts a burst now;
+ * it does not move the slot grid. A trigger or slot that
+ * arrives during a burst is counted and dropped.
+ *
+ * The sampler side (is_sampling, wait_for_arm, take_restart,
+ * buffer_filled) is called from Task1, everything else from
+ * Task2.
+ *
+ *   "burst": {"period_s": 300, "frames": 1, "bursts": 12, "triggers": 1,
+ *             "busy": 0, "acquire_ms": 3420, "process_ms": 41,
+ *             "awake_ms": 3461, "idle_ms": 296539, "duty": 0.0118}
+ **/
+
+#define BURST_IDLE_POLL_MS 50
+#define BURST_IDLE_WIFI_TICK_MS 250  // web pages answer this much slower between bursts
+#define BURST_MAX_FRAMES 16
+
+enum class BurstPhase : uint8_t {
+  continuous,  // burst mode off
+  idle,
+  acquire,
+  process  // sampler stopped, frames still being analysed and published
+};
+
+class BurstScheduler {
+public:
+  void begin(uint32_t period_s, int frames);
+  bool is_continuous() { return phase == BurstPhase::continuous; }
+  bool is_idle() { return phase == BurstPhase::idle; }
+
+  // sampling task
+  bool is_sampling() { return phase == BurstPhase::continuous || phase == BurstPhase::acquire; }
+  void wait_for_arm();
+  bool take_restart();
+  void buffer_filled(bool more_needed);
+
+  // analysis task
+  void trigger() { triggered = true; }
+  void poll();
+  void report(JsonObject out);
+
+private:
+  volatile BurstPhase phase = BurstPhase::continuous;
+  volatile bool restart = false;
+  volatile bool triggered = false;
+  SemaphoreHandle_t armed = NULL;
+  uint32_t period_ms = 0;
+  uint8_t frames = 1;
+  uint8_t frames_acquired = 0;
+  uint32_t next_slot_ms = 0;
+
+  uint32_t bursts = 0;
+  uint32_t triggers = 0;
+  uint32_t busy = 0;
+  uint32_t begin_ms = 0;
+  uint32_t arm_ms = 0;
+  volatile uint32_t stop_ms = 0;
+  uint32_t idle_start_ms = 0;
+  uint32_t acquire_ms = 0;
+  uint32_t process_ms = 0;
+  uint32_t idle_ms = 0;
+  uint64_t awake_total_ms = 0;
+
+  void arm(uint32_t now);
+  void set_power_save(bool on);
+};
+
+extern BurstScheduler burst;
+
+#endif
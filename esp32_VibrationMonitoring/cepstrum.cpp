@@ -0,0 +1,111 @@
+// ----------------------------------------------------------------------
+//
+//   Cepstrum analysis for ESP32 devices
+//
+//   Copyright (C) 2022  Shoestring and University of Cambridge
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, version 3 of the License.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see https://www.gnu.org/licenses/.
+//
+// ----------------------------------------------------------------------
+
+#include "cepstrum.h"
+
+void cepstrum_compute(ArduinoFFT<float> &fft, float *re, float *im, uint16_t n) {
+  float largest = 0;
+  for (uint16_t i = 0; i <= n / 2; i++) {
+    largest = max(largest, re[i]);
+  }
+  float floor = max(largest * (float)CEPSTRUM_FLOOR, 1e-30f);
+  // the log spectrum of a real signal is real and even, so its inverse FFT is real too
+  for (uint16_t i = 0; i <= n / 2; i++) {
+    re[i] = logf(max(re[i], floor));
+  }
+  for (uint16_t i = 1; i < n / 2; i++) {
+    re[n - i] = re[i];
+  }
+  for (uint16_t i = 0; i < n; i++) {
+    im[i] = 0;
+  }
+  fft.compute(FFTDirection::Reverse);
+}
+
+// largest value within a bin of position, the rahmonics drift off the grid
+static float near_peak(const float *c, uint16_t end, float position) {
+  uint16_t i = (uint16_t)(position + 0.5f);
+  float best = c[i];
+  if (i > 0) {
+    best = max(best, c[i - 1]);
+  }
+  if (i + 1 < end) {
+    best = max(best, c[i + 1]);
+  }
+  return best;
+}
+
+// true if q is a side lobe (within CEPSTRUM_SIDE_LOBE) or within a bin and a half
+// of a rahmonic of an earlier, stronger peak
+static bool same_family(float q, const CepstrumPeak *peaks, uint8_t n_peaks) {
+  for (uint8_t p = 0; p < n_peaks; p++) {
+    float k = max(roundf(q / peaks[p].quefrency), 1.0f);
+    float tolerance = k == 1 ? CEPSTRUM_SIDE_LOBE * peaks[p].quefrency : 1.5f;
+    if (fabsf(q - k * peaks[p].quefrency) <= tolerance) {
+      return true;
+    }
+  }
+  return false;
+}
+
+uint8_t cepstrum_peaks(const float *c, uint16_t n, CepstrumPeak *peaks, uint8_t max_peaks) {
+  uint16_t end = n / 2;
+  float total = 0;
+  for (uint16_t i = CEPSTRUM_MIN_BIN; i < end; i++) {
+    total += c[i] * c[i];
+  }
+  if (total == 0) {
+    return 0;
+  }
+
+  uint8_t n_peaks = 0;
+  float below = INFINITY;  // amplitude of the last peak taken
+  while (n_peaks < max_peaks) {
+    // strongest local maximum weaker than the last one and not part of its family
+    uint16_t best = 0;
+    for (uint16_t i = CEPSTRUM_MIN_BIN; i + 1 < end; i++) {
+      if (c[i] > 0 && c[i] > c[i - 1] && c[i] >= c[i + 1] && c[i] < below && (best == 0 || c[i] > c[best])
+          && !same_family(i, peaks, n_peaks)) {
+        best = i;
+      }
+    }
+    if (best == 0) {
+      break;
+    }
+    below = c[best];
+
+    CepstrumPeak &peak = peaks[n_peaks++];
+    float denominator = c[best - 1] - 2 * c[best] + c[best + 1];
+    float offset = denominator == 0 ? 0 : 0.5f * (c[best - 1] - c[best + 1]) / denominator;
+    peak.quefrency = best + offset;
+    peak.amplitude = c[best];
+    peak.rahmonics = 0;
+    float energy = 0;
+    for (uint8_t k = 1; k <= CEPSTRUM_RAHMONICS && k * peak.quefrency + 0.5f < end; k++) {
+      float value = near_peak(c, end, k * peak.quefrency);
+      if (value >= CEPSTRUM_RAHMONIC_RATIO * peak.amplitude) {
+        peak.rahmonics++;
+        energy += value * value;
+      }
+    }
+    peak.energy = energy / total;
+  }
+  return n_peaks;
+}
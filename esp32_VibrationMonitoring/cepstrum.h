@@ -0,0 +1,75 @@
+// ----------------------------------------------------------------------
+//
+//   Cepstrum analysis for ESP32 devices
+//
+//   Copyright (C) 2022  Shoestring and University of Cambridge
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, version 3 of the License.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see https://www.gnu.org/licenses/.
+//
+// ----------------------------------------------------------------------
+
+#ifndef CEPSTRUM_H
+#define CEPSTRUM_H
+
+#include <Arduino.h>
+#include "arduinoFFT.h"
+
+/**********************************************************
+ * Families of evenly spaced lines, e.g. the sidebands a
+ * worn gear puts around its mesh frequency, found from the
+ * real cepstrum of the magnitude spectrum:
+ *
+ *   cepstrum = inverse FFT of ln |X|
+ *
+ * Lines spaced s Hz apart make the log spectrum ripple
+ * with period s, which the inverse FFT turns into one peak
+ * at quefrency 1 / s seconds (bin q = sample rate / s) and
+ * smaller "rahmonics" at its multiples. A whole family is
+ * then one number, where majorPeak() and the band maxima
+ * only see its strongest line.
+ *
+ * cepstrum_compute() works in place on the FFT buffers, so
+ * it has to come after everything else that reads the
+ * magnitudes, and costs no memory beyond them. The frame
+ * gets the strongest families, rahmonics and side lobes of
+ * a stronger one left out:
+ *
+ *   "cepstrum": [{"spacing_hz": 5.01, "quefrency_ms": 199.7,
+ *                 "amplitude": 0.21, "rahmonics": 4, "energy": 0.18}, ...]
+ *
+ * amplitude is in the natural-log units of the cepstrum,
+ * energy the share of the cepstrum's energy above
+ * CEPSTRUM_MIN_BIN that lies on the family's rahmonics.
+ **/
+
+#define CEPSTRUM_MAX_PEAKS 5
+#define CEPSTRUM_MIN_BIN 6  // shorter quefrencies are the shape of the spectrum, not line spacing
+#define CEPSTRUM_RAHMONICS 8  // multiples looked at per family
+#define CEPSTRUM_RAHMONIC_RATIO 0.3  // a rahmonic counts from this fraction of the family's first peak
+#define CEPSTRUM_SIDE_LOBE 0.1  // peaks this close (relative) to a stronger one are its side lobes
+#define CEPSTRUM_FLOOR 1e-2  // magnitudes are clipped 40dB below the largest, so the noise floor does not swamp the lines
+
+struct CepstrumPeak {
+  float quefrency;  // bins, interpolated: seconds * sample rate
+  float amplitude;
+  float energy;
+  uint8_t rahmonics;  // counting the first peak
+};
+
+// re holds the magnitude spectrum in re[0..n/2] as left by complexToMagnitude() and
+// is replaced by the cepstrum, im is overwritten. fft must be set up on re, im and n.
+void cepstrum_compute(ArduinoFFT<float> &fft, float *re, float *im, uint16_t n);
+// the strongest families of the cepstrum c of an n point spectrum, strongest first
+uint8_t cepstrum_peaks(const float *c, uint16_t n, CepstrumPeak *peaks, uint8_t max_peaks);
+
+#endif
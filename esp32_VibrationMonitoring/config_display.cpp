@@ -0,0 +1,164 @@
+#include "config_display.h"
+#include "memory_budget.h"
+
+static const char *field_labels[] = { "WIFI: ", "SSID: ", "IP:   ", "RMS:  ", "MQTT: ", "@" };
+
+// Powers the panel and the STEMMA I2C port, then hands the slow panel
+// init to the display task so boot carries on with the sensors.
+void ConfigDisplay::initialise() {
+  pinMode(TFT_BACKLITE, OUTPUT);
+  digitalWrite(TFT_BACKLITE, HIGH);
+  pinMode(TFT_I2C_POWER, OUTPUT);
+  digitalWrite(TFT_I2C_POWER, HIGH);
+  delay(10);
+
+  lock = xSemaphoreCreateMutex();
+  xSemaphoreTake(lock, portMAX_DELAY);
+  dirty |= (1 << N_FIELDS) - 1;  // paint every line once
+  xSemaphoreGive(lock);
+
+  xTaskCreatePinnedToCore(
+    display_task,          /* Task function. */
+    "Display",             /* name of task. */
+    DISPLAY_TASK_STACK,    /* Stack size of task */
+    this,                  /* parameter of the task */
+    tskIDLE_PRIORITY + 1,  /* priority of the task */
+    &task,                 /* Task handle to keep track of created task */
+    1);                    /* pin task to core 1 */
+  memory_budget.watch_stack("Display", task, DISPLAY_TASK_STACK);
+}
+
+void ConfigDisplay::set_field(Field field, const String &value) {
+  if (lock == NULL) {  // not initialised yet - the first repaint will pick it up
+    fields[field] = value;
+    dirty |= 1 << field;
+    return;
+  }
+  xSemaphoreTake(lock, portMAX_DELAY);
+  if (fields[field] != value) {
+    fields[field] = value;
+    dirty |= 1 << field;
+  }
+  xSemaphoreGive(lock);
+  xTaskNotifyGive(task);
+}
+
+void ConfigDisplay::setSpectrum(const float *band_magnitudes, uint8_t count, float rms) {
+  if (count > DISPLAY_MAX_BANDS) {
+    count = DISPLAY_MAX_BANDS;
+  }
+  String rms_text = String(rms, 3) + " m/s2";
+  if (lock == NULL) {
+    return;
+  }
+  xSemaphoreTake(lock, portMAX_DELAY);
+  memcpy(bands, band_magnitudes, count * sizeof(float));
+  n_bands = count;
+  fields[FIELD_RMS] = rms_text;
+  dirty |= DIRTY_BARS | (1 << FIELD_RMS);
+  xSemaphoreGive(lock);
+  xTaskNotifyGive(task);
+}
+
+void ConfigDisplay::start_panel() {
+#ifdef S_DISPLAY
+  oled_display.init(135, 240);  // Init ST7789 240x135
+  oled_display.setRotation(3);
+  oled_display.setTextWrap(false);
+  oled_display.fillScreen(ST77XX_BLACK);
+
+  line_canvas.setTextWrap(false);
+  line_canvas.setTextColor(ST77XX_RED);
+  line_canvas.setTextSize(2);
+#endif
+}
+
+void ConfigDisplay::display_task(void *pvParameters) {
+  ConfigDisplay *self = (ConfigDisplay *)pvParameters;
+  self->start_panel();
+  self->refresh();
+  for (;;) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    self->refresh();
+    vTaskDelay(pdMS_TO_TICKS(DISPLAY_PERIOD_MS));  // coalesce bursts of updates
+  }
+}
+
+void ConfigDisplay::refresh() {
+  // snapshot the dirty state so the lock is never held across SPI transfers
+  String changed[N_FIELDS];
+  float magnitudes[DISPLAY_MAX_BANDS];
+  uint8_t count = 0;
+
+  xSemaphoreTake(lock, portMAX_DELAY);
+  uint32_t to_draw = dirty;
+  dirty = 0;
+  for (int i = 0; i < N_FIELDS; i++) {
+    if (to_draw & (1 << i)) {
+      changed[i] = fields[i];
+    }
+  }
+  if (to_draw & DIRTY_BARS) {
+    count = n_bands;
+    memcpy(magnitudes, bands, count * sizeof(float));
+  }
+  xSemaphoreGive(lock);
+
+  for (int i = 0; i < N_FIELDS; i++) {
+    if (to_draw & (1 << i)) {
+      draw_line((Field)i, changed[i]);
+    }
+  }
+  if (to_draw & DIRTY_BARS) {
+    draw_bars(magnitudes, count);
+  }
+}
+
+void ConfigDisplay::draw_line(Field field, const String &value) {
+#ifdef S_DISPLAY
+  line_canvas.fillScreen(ST77XX_BLACK);
+  line_canvas.setCursor(0, 0);
+  line_canvas.print(field_labels[field]);
+  line_canvas.print(value);
+  oled_display.drawRGBBitmap(0, field * LINE_HEIGHT, line_canvas.getBuffer(), TFT_WIDTH, LINE_HEIGHT);
+#endif
+}
+
+void ConfigDisplay::draw_bars(const float *magnitudes, uint8_t count) {
+#ifdef S_DISPLAY
+  if (count == 0) {
+    return;
+  }
+  if (count != drawn_bands) {  // layout changed, start from a blank graph
+    oled_display.fillRect(0, BAR_TOP, TFT_WIDTH, BAR_HEIGHT, ST77XX_BLACK);
+    memset(drawn_height, 0, sizeof(drawn_height));
+    drawn_bands = count;
+  }
+
+  // auto scale to the largest band, decaying slowly so the graph does not jump
+  float frame_max = 0;
+  for (uint8_t i = 0; i < count; i++) {
+    frame_max = max(frame_max, magnitudes[i]);
+  }
+  bar_scale = max(frame_max, bar_scale * 0.9f);
+  if (bar_scale <= 0) {
+    return;
+  }
+
+  int bar_width = TFT_WIDTH / count;
+  oled_display.startWrite();
+  for (uint8_t i = 0; i < count; i++) {
+    uint8_t height = constrain((int)(magnitudes[i] / bar_scale * BAR_HEIGHT), 0, BAR_HEIGHT);
+    uint8_t old_height = drawn_height[i];
+    int x = i * bar_width;
+    // only the strip between the old and new bar tops is sent to the panel
+    if (height > old_height) {
+      oled_display.writeFillRect(x, TFT_HEIGHT - height, bar_width - 1, height - old_height, ST77XX_CYAN);
+    } else if (height < old_height) {
+      oled_display.writeFillRect(x, TFT_HEIGHT - old_height, bar_width - 1, old_height - height, ST77XX_BLACK);
+    }
+    drawn_height[i] = height;
+  }
+  oled_display.endWrite();
+#endif
+}
@@ -18,98 +18,86 @@
 #define TFT_BACKLITE  45
 #define TFT_I2C_POWER  21
 
+#define TFT_WIDTH 240
+#define TFT_HEIGHT 135
+#define LINE_HEIGHT (TEXT_SIZE * 16)
+
+#define DISPLAY_MAX_BANDS 32
+#define DISPLAY_PERIOD_MS 100  // minimum time between repaints
+#define DISPLAY_TASK_STACK 4096
+
+/**********************************************************
+ * Status and live spectrum display.
+ *
+ * Setters only store the new value and mark its field dirty,
+ * so they are cheap to call from any task. A low priority
+ * display task repaints just the dirty fields: text lines
+ * are rendered into a one-line offscreen canvas and blitted
+ * in a single address window, and spectrum bars are grown or
+ * shrunk by the changed pixels only.
+ *
+ *  line 0  WIFI: <state>
+ *  line 1  SSID: <ssid>
+ *  line 2  IP:   <ip>
+ *  line 3  RMS:  <acceleration rms>
+ *  line 4  MQTT: <state>
+ *  line 5  @<broker>
+ *  below   band magnitude bar graph
+ **/
+
 class ConfigDisplay {
 public:
   ConfigDisplay()
 #ifdef S_DISPLAY
-    : oled_display(Adafruit_ST7789(TFT_CS, TFT_DC, TFT_RST))
+    : oled_display(Adafruit_ST7789(TFT_CS, TFT_DC, TFT_RST)), line_canvas(TFT_WIDTH, LINE_HEIGHT)
 #endif
   {
   }
-  void initialise() {
-    delay(1000);
-    pinMode(TFT_BACKLITE, OUTPUT);
-    digitalWrite(TFT_BACKLITE, HIGH);
-    pinMode(TFT_I2C_POWER, OUTPUT);
-    digitalWrite(TFT_I2C_POWER, HIGH);
-    delay(10);
-#ifdef S_DISPLAY
-    oled_display.init(135, 240);  // Init ST7789 240x135
-    oled_display.setRotation(3);
-    oled_display.fillScreen(ST77XX_BLACK);
-    oled_display.setTextWrap(false);
-    oled_display.fillScreen(ST77XX_BLACK);
-    oled_display.setCursor(0, 30);
-    oled_display.setTextColor(ST77XX_RED);
-    oled_display.setTextSize(2);
-    oled_display.print("Starting...");
-    delay(1000);
-#endif
-  }
-  void setWiFiStatus(String state) {
-    // Serial.println("setwifi");
-    this->wifi_state = state;
-    refresh();
-  };
-  void setWiFiSSID(String ssid) {
-    // Serial.println("setwifi");
-    this->wifi_ssid = ssid;
-    refresh();
-  };
-  void setIP(String ip) {
-    // Serial.println("setip");
-    this->ip = ip;
-    refresh();
-  }
-  void setMQTTStatus(String mqtt_status) {
-    // Serial.println("setmqtt");
-    this->mqtt_state = mqtt_status;
-    refresh();
-  }
-  void setMQTTIP(String ip) {
-    // Serial.println("setip");
-    this->mqtt_ip = ip;
-    refresh();
-  }
+  void initialise();
 
+  void setWiFiStatus(String state) { set_field(FIELD_WIFI, state); };
+  void setWiFiSSID(String ssid) { set_field(FIELD_SSID, ssid); };
+  void setIP(String ip) { set_field(FIELD_IP, ip); }
+  void setMQTTStatus(String mqtt_status) { set_field(FIELD_MQTT, mqtt_status); }
+  void setMQTTIP(String ip) { set_field(FIELD_MQTT_IP, ip); }
+  void setSpectrum(const float *band_magnitudes, uint8_t n_bands, float rms);
 
 private:
+  enum Field { FIELD_WIFI,
+               FIELD_SSID,
+               FIELD_IP,
+               FIELD_RMS,
+               FIELD_MQTT,
+               FIELD_MQTT_IP,
+               N_FIELDS };
+  static const uint32_t DIRTY_BARS = 1 << N_FIELDS;
+  static const int BAR_TOP = 6 * LINE_HEIGHT;
+  static const int BAR_HEIGHT = TFT_HEIGHT - BAR_TOP;
+
 #ifdef S_DISPLAY
   Adafruit_ST7789 oled_display;
+  GFXcanvas16 line_canvas;
 #endif
-  String wifi_state = "";
-  String wifi_ssid = "";
-  String ip = "";
-  String mqtt_state = "";
-  String mqtt_ip = "";
+  SemaphoreHandle_t lock = NULL;
+  TaskHandle_t task = NULL;
 
-  void refresh() {
-    // Serial.println("refresh");
-#ifdef S_DISPLAY
-    oled_display.fillScreen(ST77XX_BLACK);
-    gotoline(0);
-    oled_display.print("WIFI: ");
-    oled_display.println(wifi_state);
-    gotoline(1);
-    oled_display.print("SSID: ");
-    oled_display.println(wifi_ssid);
-    gotoline(2);
-    oled_display.print("IP:   ");
-    oled_display.println(ip);
-    gotoline(4);
-    oled_display.print("MQTT: ");
-    oled_display.println(mqtt_state);
-    gotoline(5);
-    oled_display.print("@");
-    oled_display.println(mqtt_ip);
-#endif
-  }
+  // shared with setters, guarded by lock
+  String fields[N_FIELDS];
+  uint32_t dirty = 0;
+  float bands[DISPLAY_MAX_BANDS];
+  uint8_t n_bands = 0;
 
-  void gotoline(int y) {
-#ifdef S_DISPLAY
-    oled_display.setCursor(0, y * TEXT_SIZE * 16);
-#endif
-  }
+  // owned by the display task
+  uint8_t drawn_height[DISPLAY_MAX_BANDS] = {};
+  uint8_t drawn_bands = 0;
+  float bar_scale = 0;
+
+  void set_field(Field field, const String &value);
+  static void display_task(void *pvParameters);
+  void start_panel();
+  void refresh();
+  void draw_line(Field field, const String &value);
+  void draw_bars(const float *magnitudes, uint8_t count);
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -22,9 +22,11 @@
 #define CONFIG_MANAGER_H
 
 #include <vector>
+#include <memory>
 #include <WebServer.h>
 #include <Preferences.h>
 #include <WiFi.h>
+#include <nvs.h>
 
 enum class WIFI_CREDS_STATE { idle_invalid,
                               entering_new,
@@ -43,44 +45,31 @@ static Preferences preferences;
 */
 class ConfigItem {
 public:
-  ConfigItem(String name, String default_value = "") {
-    this->name = name;
-    preferences.begin("app_config", RO_MODE);
-    this->string_value = preferences.getString(name.c_str(), default_value);
-    this->is_string = true;
-    preferences.end();
-  }
-  ConfigItem(String name, int default_value = 0) {
-    this->name = name;
-    preferences.begin("app_config", RO_MODE);
-    this->int_value = preferences.getInt(name.c_str(), default_value);
-    this->is_string = false;
-    preferences.end();
-  }
+  ConfigItem(String name, String default_value = "")
+    : name(name), is_string(true), int_value(0), string_value(default_value) {}
+  ConfigItem(String name, int default_value = 0)
+    : name(name), is_string(false), int_value(default_value) {}
   String name;
-  String getString() {
+  String getString() const {
     return string_value;
   }
-  int getInt() {
+  int getInt() const {
     return int_value;
   }
-  bool isString() {
+  bool isString() const {
     return is_string;
   }
-  size_t setString(String value) {
+  void setString(String value) {
     this->string_value = value;
-    preferences.begin("app_config", RW_MODE);
-    size_t written = preferences.putString(this->name.c_str(), value);
-    preferences.end();
-    return written;
   }
-
-  size_t setInt(int value) {
+  void setInt(int value) {
     this->int_value = value;
-    preferences.begin("app_config", RW_MODE);
-    size_t written = preferences.putInt(this->name.c_str(), value);
-    preferences.end();
-    return written;
+  }
+  String valueAsString() const {
+    return is_string ? string_value : String(int_value);
+  }
+  bool sameValue(const ConfigItem &other) const {
+    return is_string ? string_value == other.string_value : int_value == other.int_value;
   }
 private:
   bool is_string;
@@ -88,6 +77,253 @@ private:
   String string_value;
 };
 
+/**********************************************************
+ * Bulk, transactional storage of the app config in NVS.
+ *
+ * load() reads every item in a single NVS session. commit()
+ * writes only the changed keys, in one session:
+ *
+ *  1. the changes are written as one journal blob
+ *  2. each changed key is written
+ *  3. a commit record {version, crc of all values} is written
+ *  4. the journal is erased
+ *
+ * NVS writes each entry atomically, so a power cut leaves
+ * either no journal (old or new config, both complete) or a
+ * complete journal that load() replays before reading - a
+ * half-applied config is never used.
+ **/
+
+#define CONFIG_NAMESPACE "app_config"
+#define CONFIG_COMMIT_KEY "cfg_commit"
+#define CONFIG_JOURNAL_KEY "cfg_journal"
+#define CONFIG_MAGIC 0x53434647  // "SCFG"
+
+struct ConfigRecord {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t crc;
+};
+
+class ConfigStore {
+public:
+  uint32_t version = 0;
+  bool crc_ok = true;
+  uint32_t commits = 0;
+  uint32_t last_changed = 0;
+
+  bool load(std::vector<ConfigItem> &items) {
+    nvs_handle_t handle;
+    bool has_journal = false;
+    if (nvs_open(CONFIG_NAMESPACE, NVS_READONLY, &handle) != ESP_OK) {
+      return false;  // nothing stored yet - defaults
+    }
+    size_t journal_length = 0;
+    has_journal = nvs_get_blob(handle, CONFIG_JOURNAL_KEY, NULL, &journal_length) == ESP_OK;
+    if (has_journal) {  // interrupted commit - reopen writable to finish it
+      nvs_close(handle);
+      if (nvs_open(CONFIG_NAMESPACE, NVS_READWRITE, &handle) != ESP_OK) {
+        return false;
+      }
+      replay_journal(handle, items);
+    }
+
+    for (ConfigItem &item : items) {
+      read_item(handle, item);
+    }
+
+    ConfigRecord record;
+    size_t length = sizeof(record);
+    if (nvs_get_blob(handle, CONFIG_COMMIT_KEY, &record, &length) == ESP_OK && length == sizeof(record) && record.magic == CONFIG_MAGIC) {
+      version = record.version;
+      crc_ok = record.crc == items_crc(handle, items);
+    }
+    nvs_close(handle);
+    return true;
+  }
+
+  bool load_one(ConfigItem &item) {
+    nvs_handle_t handle;
+    if (nvs_open(CONFIG_NAMESPACE, NVS_READONLY, &handle) != ESP_OK) {
+      return false;
+    }
+    read_item(handle, item);
+    nvs_close(handle);
+    return true;
+  }
+
+  bool commit(const std::vector<ConfigItem> &items, const std::vector<size_t> &changed) {
+    if (changed.empty()) {
+      return true;
+    }
+    nvs_handle_t handle;
+    if (nvs_open(CONFIG_NAMESPACE, NVS_READWRITE, &handle) != ESP_OK) {
+      return false;
+    }
+
+    std::vector<uint8_t> journal = encode_journal(items, changed, version + 1);
+    bool ok = nvs_set_blob(handle, CONFIG_JOURNAL_KEY, journal.data(), journal.size()) == ESP_OK;
+    for (size_t i = 0; ok && i < changed.size(); i++) {
+      ok = write_item(handle, items.at(changed[i]));
+    }
+    if (ok) {
+      ok = write_record(handle, version + 1, items_crc(handle, items));
+    }
+    if (ok) {
+      nvs_erase_key(handle, CONFIG_JOURNAL_KEY);
+      ok = nvs_commit(handle) == ESP_OK;
+    }
+    nvs_close(handle);
+
+    if (ok) {
+      version++;
+      crc_ok = true;
+      commits++;
+      last_changed = changed.size();
+    }
+    return ok;
+  }
+
+private:
+  static String journal_string(const uint8_t *data, size_t length) {
+    std::vector<char> text(data, data + length);
+    text.push_back('\0');
+    return String(text.data());
+  }
+
+  static uint32_t crc32(uint32_t crc, const uint8_t *data, size_t length) {
+    crc = ~crc;
+    while (length--) {
+      crc ^= *data++;
+      for (int bit = 0; bit < 8; bit++) {
+        crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+      }
+    }
+    return ~crc;
+  }
+
+  // covers only the items actually stored, so items still on their defaults
+  // (e.g. added by a firmware update) do not read as a mismatch
+  static uint32_t items_crc(nvs_handle_t handle, const std::vector<ConfigItem> &items) {
+    uint32_t crc = 0;
+    for (const ConfigItem &item : items) {
+      if (!is_stored(handle, item)) {
+        continue;
+      }
+      String entry = item.name + "=" + item.valueAsString() + ";";
+      crc = crc32(crc, (const uint8_t *)entry.c_str(), entry.length());
+    }
+    return crc;
+  }
+
+  static bool is_stored(nvs_handle_t handle, const ConfigItem &item) {
+    if (item.isString()) {
+      size_t length = 0;
+      return nvs_get_str(handle, item.name.c_str(), NULL, &length) == ESP_OK;
+    }
+    int32_t value;
+    return nvs_get_i32(handle, item.name.c_str(), &value) == ESP_OK;
+  }
+
+  static bool read_item(nvs_handle_t handle, ConfigItem &item) {
+    if (item.isString()) {
+      size_t length = 0;
+      if (nvs_get_str(handle, item.name.c_str(), NULL, &length) != ESP_OK || length == 0) {
+        return false;
+      }
+      std::unique_ptr<char[]> value(new char[length]);
+      if (nvs_get_str(handle, item.name.c_str(), value.get(), &length) != ESP_OK) {
+        return false;
+      }
+      item.setString(String(value.get()));
+    } else {
+      int32_t value;
+      if (nvs_get_i32(handle, item.name.c_str(), &value) != ESP_OK) {
+        return false;
+      }
+      item.setInt(value);
+    }
+    return true;
+  }
+
+  static bool write_item(nvs_handle_t handle, const ConfigItem &item) {
+    if (item.isString()) {
+      return nvs_set_str(handle, item.name.c_str(), item.getString().c_str()) == ESP_OK;
+    }
+    return nvs_set_i32(handle, item.name.c_str(), item.getInt()) == ESP_OK;
+  }
+
+  static bool write_record(nvs_handle_t handle, uint32_t version, uint32_t crc) {
+    ConfigRecord record = { CONFIG_MAGIC, version, crc };
+    return nvs_set_blob(handle, CONFIG_COMMIT_KEY, &record, sizeof(record)) == ESP_OK;
+  }
+
+  // journal: ConfigRecord header (crc over the payload), then per item
+  // [is_string][name length][name][value length lo][value length hi][value]
+  static std::vector<uint8_t> encode_journal(const std::vector<ConfigItem> &items, const std::vector<size_t> &changed, uint32_t version) {
+    std::vector<uint8_t> journal(sizeof(ConfigRecord));
+    for (size_t index : changed) {
+      const ConfigItem &item = items.at(index);
+      String value = item.valueAsString();
+      journal.push_back(item.isString());
+      journal.push_back(item.name.length());
+      journal.insert(journal.end(), item.name.c_str(), item.name.c_str() + item.name.length());
+      journal.push_back(value.length() & 0xff);
+      journal.push_back(value.length() >> 8);
+      journal.insert(journal.end(), value.c_str(), value.c_str() + value.length());
+    }
+    ConfigRecord header = { CONFIG_MAGIC, version, crc32(0, journal.data() + sizeof(ConfigRecord), journal.size() - sizeof(ConfigRecord)) };
+    memcpy(journal.data(), &header, sizeof(header));
+    return journal;
+  }
+
+  bool replay_journal(nvs_handle_t handle, std::vector<ConfigItem> &items) {
+    size_t length = 0;
+    nvs_get_blob(handle, CONFIG_JOURNAL_KEY, NULL, &length);
+    std::vector<uint8_t> journal(length);
+    ConfigRecord header;
+    bool valid = length >= sizeof(header) && nvs_get_blob(handle, CONFIG_JOURNAL_KEY, journal.data(), &length) == ESP_OK;
+    if (valid) {
+      memcpy(&header, journal.data(), sizeof(header));
+      valid = header.magic == CONFIG_MAGIC && header.crc == crc32(0, journal.data() + sizeof(header), length - sizeof(header));
+    }
+
+    size_t pos = sizeof(header);
+    while (valid && pos + 4 <= length) {
+      bool is_string = journal[pos];
+      uint8_t name_length = journal[pos + 1];
+      if (pos + 2 + name_length + 2 > length) {
+        break;
+      }
+      String name = journal_string(&journal[pos + 2], name_length);
+      pos += 2 + name_length;
+      uint16_t value_length = journal[pos] | (journal[pos + 1] << 8);
+      pos += 2;
+      if (pos + value_length > length) {
+        break;
+      }
+      String value = journal_string(&journal[pos], value_length);
+      pos += value_length;
+
+      ConfigItem item = is_string ? ConfigItem(name, value) : ConfigItem(name, (int)value.toInt());
+      write_item(handle, item);
+    }
+
+    if (valid) {
+      for (ConfigItem &item : items) {
+        read_item(handle, item);
+      }
+      write_record(handle, header.version, items_crc(handle, items));
+      version = header.version;
+    }
+    // a torn journal means the keys were never touched - the old config stands
+    nvs_erase_key(handle, CONFIG_JOURNAL_KEY);
+    nvs_commit(handle);
+    Serial.println(valid ? "*** Config: interrupted commit replayed ***" : "*** Config: torn journal discarded ***");
+    return valid;
+  }
+};
+
 class ConfigManager;
 
 class ConfigManager {
@@ -119,6 +355,10 @@ public:
       server.on("/submit_config", HTTP_POST, std::bind(&ConfigManager::handle_config_submit, this));
       server.on("/submit_wifi", HTTP_POST, std::bind(&ConfigManager::handle_wifi_submit, this));
       server.on("/status_wifi", std::bind(&ConfigManager::handle_wifi_status_check, this));
+      for (auto &route : routes) {
+        std::function<void(WebServer &)> handler = route.second;
+        server.on(route.first, HTTP_GET, [this, handler]() { handler(server); });
+      }
       server.onNotFound(std::bind(&ConfigManager::handle_NotFound, this));
       server.begin();
       started = true;
@@ -139,6 +379,7 @@ public:
     }
 
     preferences.end();
+    clear_wifi_cache();
     this->wifi_creds_state = WIFI_CREDS_STATE::valid;
 
     Serial.println("!!! New WiFi credentials for " + new_ssid + " saved !!!");
@@ -148,12 +389,74 @@ public:
     this->wifi_creds_state = WIFI_CREDS_STATE::idle_invalid;
   }
 
+  // BSSID and channel of the last good connection, used for fast reconnects
+  bool get_wifi_cache(uint8_t *bssid, int32_t &channel) {
+    preferences.begin("wifi_creds", RO_MODE);
+    bool valid = preferences.isKey("bssid") && preferences.getBytes("bssid", bssid, 6) == 6;
+    channel = preferences.getInt("channel", 0);
+    preferences.end();
+    return valid && channel > 0;
+  }
+
+  void set_wifi_cache(const uint8_t *bssid, int32_t channel) {
+    uint8_t cached_bssid[6];
+    int32_t cached_channel;
+    if (get_wifi_cache(cached_bssid, cached_channel) && cached_channel == channel && memcmp(cached_bssid, bssid, 6) == 0) {
+      return;  // unchanged - save the flash write
+    }
+    preferences.begin("wifi_creds", RW_MODE);
+    preferences.putBytes("bssid", bssid, 6);
+    preferences.putInt("channel", channel);
+    preferences.end();
+  }
+
+  void clear_wifi_cache() {
+    preferences.begin("wifi_creds", RW_MODE);
+    preferences.remove("bssid");
+    preferences.remove("channel");
+    preferences.end();
+  }
+
   void register_item(ConfigItem item) {
-    this->items.push_back(item);
+    if (loaded) {  // registered late - needs its own read
+      store.load_one(item);
+    }
+    std::shared_ptr<ConfigSnapshot> next = std::make_shared<ConfigSnapshot>(*current());
+    next->push_back(item);
+    publish(next);
+  }
+
+  // reads every registered item in one NVS session
+  void load() {
+    std::shared_ptr<ConfigSnapshot> next = std::make_shared<ConfigSnapshot>(*current());
+    store.load(*next);
+    publish(next);
+    loaded = true;
+    Serial.println("*** Config v" + String(store.version) + (store.crc_ok ? " loaded ***" : " loaded - CRC MISMATCH ***"));
+  }
+
+  // called (from the web server task) after a new config has been committed
+  void add_change_listener(std::function<void()> listener) {
+    this->listeners.push_back(listener);
+  }
+
+  // extra GET pages next to the config forms - register before the server is set up
+  void add_route(String uri, std::function<void(WebServer &)> handler) {
+    this->routes.push_back(std::make_pair(uri, handler));
+  }
+
+  // called from the web server task after every handleClient(), for responses sent over several ticks
+  void add_poll_hook(std::function<void()> hook) {
+    this->poll_hooks.push_back(hook);
+  }
+
+  const ConfigStore &get_store() {
+    return store;
   }
 
   String getString(String key) {
-    for (ConfigItem item : this->items) {
+    std::shared_ptr<const ConfigSnapshot> snapshot = current();
+    for (const ConfigItem &item : *snapshot) {
       if (item.name == key) {
         return item.getString();
       }
@@ -162,7 +465,8 @@ public:
   }
 
   int getInt(String key) {
-    for (ConfigItem item : this->items) {
+    std::shared_ptr<const ConfigSnapshot> snapshot = current();
+    for (const ConfigItem &item : *snapshot) {
       if (item.name == key) {
         return item.getInt();
       }
@@ -179,6 +483,9 @@ public:
 
   void step_loop() {
     server.handleClient();
+    for (auto &hook : poll_hooks) {
+      hook();
+    }
   }
 
   WIFI_CREDS_STATE get_state() {
@@ -190,8 +497,16 @@ public:
   }
 
 private:
+  typedef std::vector<ConfigItem> ConfigSnapshot;
+
   WebServer server;
-  std::vector<ConfigItem> items = {};
+  // readers take a reference to the whole snapshot, so a commit is seen all at once
+  std::shared_ptr<const ConfigSnapshot> items = std::make_shared<ConfigSnapshot>();
+  ConfigStore store;
+  bool loaded = false;
+  std::vector<std::function<void()>> listeners;
+  std::vector<std::pair<String, std::function<void(WebServer &)>>> routes;
+  std::vector<std::function<void()>> poll_hooks;
   String ssid;
   String password;
   String new_ssid;
@@ -199,6 +514,14 @@ private:
   WIFI_CREDS_STATE wifi_creds_state;
   bool started = false;
 
+  std::shared_ptr<const ConfigSnapshot> current() {
+    return std::atomic_load(&items);
+  }
+
+  void publish(std::shared_ptr<const ConfigSnapshot> next) {
+    std::atomic_store(&items, next);
+  }
+
   void handle_home() {
     String html = R"(
         <!DOCTYPE html>
@@ -234,7 +557,7 @@ private:
       )";
 
     String contents = "";
-    for (ConfigItem item : this->items) {
+    for (const ConfigItem &item : *current()) {
       contents += "<label for=\"" + item.name + "\">" + item.name + ":</label><br>";
       if (item.isString()) {
         contents += "<input type=\"text\" id=\"" + item.name + "\" name=\"" + item.name + "\" value=\"" + item.getString() + "\"><br>";
@@ -281,18 +604,35 @@ private:
     }
   }
   void handle_config_submit() {
-    for (int i = 0; i < this->items.size(); i++) {
-      String new_value = server.arg(this->items.at(i).name);
+    std::shared_ptr<const ConfigSnapshot> old_snapshot = current();
+    std::shared_ptr<ConfigSnapshot> next = std::make_shared<ConfigSnapshot>(*old_snapshot);
+    std::vector<size_t> changed;
+
+    for (size_t i = 0; i < next->size(); i++) {
+      ConfigItem &item = next->at(i);
+      String new_value = server.arg(item.name);
 
-      if (this->items.at(i).isString()) {
-        size_t written = this->items.at(i).setString(new_value);
-        Serial.println(this->items.at(i).name + " <S< " + this->items.at(i).getString()+" ["+written+"]");
+      if (item.isString()) {
+        item.setString(new_value);
       } else {
-        size_t written = this->items.at(i).setInt(new_value.toInt());
-        Serial.println(this->items.at(i).name + " <I< " + this->items.at(i).getInt()+" ["+written+"]");
+        item.setInt(new_value.toInt());
+      }
+      if (!item.sameValue(old_snapshot->at(i))) {
+        changed.push_back(i);
+        Serial.println(item.name + (item.isString() ? " <S< " : " <I< ") + item.valueAsString());
       }
     }
-    server.send(200, "text/html", "Saved");
+
+    if (!store.commit(*next, changed)) {
+      Serial.println("<><><><><> BAD CONFIG WRITE <><><><><><>");
+      server.send(500, "text/html", "Save failed");
+      return;
+    }
+    publish(next);
+    for (auto &listener : listeners) {
+      listener();
+    }
+    server.send(200, "text/html", "Saved (" + String((int)changed.size()) + " changed, v" + String(store.version) + ")");
   }
 
   void handle_wifi_submit() {
@@ -0,0 +1,334 @@
+// ----------------------------------------------------------------------
+//
+//   Local data endpoints for ESP32 devices
+//
+//   Copyright (C) 2022  Shoestring and University of Cambridge
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, version 3 of the License.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see https://www.gnu.org/licenses/.
+//
+// ----------------------------------------------------------------------
+
+#include "data_server.h"
+#include "logger.h"
+
+DataServer data_server;
+
+#define HTTP_STREAM_HEADER \
+  "HTTP/1.1 200 OK\r\n" \
+  "Cache-Control: no-cache\r\n" \
+  "Connection: close\r\n" \
+  "Access-Control-Allow-Origin: *\r\n"
+
+void DataServer::begin(ShoestringLib &lib, uint16_t bins, float bin_hz) {
+  lock = xSemaphoreCreateMutex();
+  frame = memory_budget.take_array<char>(FRAME_MESSAGE_SIZE, "data_frame");
+  rows = memory_budget.take_array<uint8_t>(WATERFALL_ROWS * WATERFALL_BINS, "waterfall");
+  row_ms = memory_budget.take_array<uint32_t>(WATERFALL_ROWS, "waterfall_ms");
+  pool = max(bins / WATERFALL_BINS, 1);
+  columns = min(bins / pool, WATERFALL_BINS);
+  this->bin_hz = bin_hz;
+
+  lib.add_frame_hook([this](const char *message, size_t length) { set_frame(message, length); });
+  lib.add_http_route("/data/latest", [this](WebServer &server) { handle_latest(server); });
+  lib.add_http_route("/data/waterfall", [this](WebServer &server) { handle_waterfall(server); });
+  lib.add_http_route("/data/live", [this](WebServer &server) { handle_live(server); });
+  lib.add_http_poll([this]() { poll(); });
+  lib.add_metrics_hook("http", [this](JsonObject out) { report(out); });
+  LOG_INFO("Data pages on /data, waterfall of %u rows x %u columns", WATERFALL_ROWS, columns);
+}
+
+/****** Task2 ******/
+
+void DataServer::set_frame(const char *message, size_t length) {
+  if (xSemaphoreTake(lock, 0) != pdTRUE) {
+    frames_skipped++;
+    return;
+  }
+  if (claims > 0) {
+    xSemaphoreGive(lock);
+    frames_skipped++;  // being sent
+    return;
+  }
+  memcpy(frame, message, length);
+  frame_length = length;
+  frame_sequence++;
+  frame_ms = millis();
+  xSemaphoreGive(lock);
+}
+
+// one waterfall row from a magnitude spectrum, each column the loudest of its bins
+void DataServer::add_spectrum(const float *magnitudes, uint16_t bins) {
+  uint8_t row[WATERFALL_BINS] = { 0 };
+  for (uint16_t c = 0; c < columns && (c + 1) * pool <= bins; c++) {
+    float peak = 0;
+    for (uint16_t i = c * pool; i < (c + 1) * pool; i++) {
+      peak = max(peak, magnitudes[i]);
+    }
+    float code = (20 * log10f(peak) - WATERFALL_MIN_DB) / WATERFALL_STEP_DB;  // -inf for silence
+    row[c] = code <= 0 ? 0 : (code >= 255 ? 255 : (uint8_t)(code + 0.5f));
+  }
+
+  if (xSemaphoreTake(lock, 0) != pdTRUE) {
+    rows_skipped++;
+    return;
+  }
+  uint32_t slot = row_count % WATERFALL_ROWS;
+  memcpy(rows + slot * WATERFALL_BINS, row, columns);
+  row_ms[slot] = millis();
+  row_count++;
+  xSemaphoreGive(lock);
+}
+
+/****** Pages - wifi task ******/
+
+void DataServer::handle_latest(WebServer &server) {
+  requests++;
+  if (xSemaphoreTake(lock, pdMS_TO_TICKS(DATA_LOCK_WAIT_MS)) != pdTRUE) {
+    server.send(503, "text/plain", "Busy");
+    return;
+  }
+  if (frame_length == 0) {
+    xSemaphoreGive(lock);
+    server.send(503, "text/plain", "No frame yet");
+    return;
+  }
+  claims++;
+  String header = HTTP_STREAM_HEADER "Content-Type: application/json\r\n";
+  header += "Content-Length: " + String((unsigned)frame_length) + "\r\n";
+  header += "X-Frame-Age-Ms: " + String((unsigned long)(millis() - frame_ms)) + "\r\n\r\n";
+  xSemaphoreGive(lock);
+
+  DataStream *stream = open_stream(server, DataStreamKind::latest, header);
+  if (stream == NULL) {
+    release_frame();
+    return;
+  }
+  stream->claimed = true;
+  stream->offset = 0;
+}
+
+void DataServer::handle_waterfall(WebServer &server) {
+  requests++;
+  bool raw = server.arg("format") == "raw";
+  String header = HTTP_STREAM_HEADER "Transfer-Encoding: chunked\r\n";
+  if (raw) {
+    header += "Content-Type: application/octet-stream\r\n";
+    header += "X-Waterfall-Bins: " + String(columns) + "\r\n";
+    header += "X-Bin-Hz: " + String(bin_hz * pool, 4) + "\r\n";
+    header += "X-Min-Db: " + String(WATERFALL_MIN_DB, 1) + "\r\n";
+    header += "X-Step-Db: " + String(WATERFALL_STEP_DB, 2) + "\r\n";
+  } else {
+    header += "Content-Type: text/csv\r\n";
+  }
+  header += "\r\n";
+
+  DataStream *stream = open_stream(server, raw ? DataStreamKind::waterfall_raw : DataStreamKind::waterfall_csv, header);
+  if (stream != NULL) {
+    // the rows held now, the ring may move on while they are sent
+    stream->end = row_count;
+    stream->next = row_count > WATERFALL_ROWS ? row_count - WATERFALL_ROWS : 0;
+    stream->header = !raw;
+  }
+}
+
+void DataServer::handle_live(WebServer &server) {
+  requests++;
+  DataStream *stream = open_stream(server, DataStreamKind::live, HTTP_STREAM_HEADER "Content-Type: text/event-stream\r\n\r\n");
+  if (stream != NULL) {
+    stream->next = 0;  // send the latest frame straight away
+  }
+}
+
+DataServer::DataStream *DataServer::open_stream(WebServer &server, DataStreamKind kind, const String &header) {
+  for (DataStream &stream : streams) {
+    if (stream.kind != DataStreamKind::none) {
+      continue;
+    }
+    // the response is ours from here on, the web server is done with the request once the handler returns
+    stream.client = server.client();
+    stream.client.setNoDelay(true);
+    if (stream.client.print(header) != header.length()) {
+      dropped++;
+      close_stream(stream);
+      return NULL;
+    }
+    stream.kind = kind;
+    stream.sent_ms = millis();
+    return &stream;
+  }
+  server.send(503, "text/plain", "Too many streams");
+  return NULL;
+}
+
+void DataServer::poll() {
+  for (DataStream &stream : streams) {
+    if (stream.kind == DataStreamKind::none) {
+      continue;
+    }
+    bool ok = stream.client.connected()
+              && (stream.kind == DataStreamKind::latest ? send_latest(stream)
+                  : stream.kind == DataStreamKind::live ? send_live(stream)
+                                                        : send_waterfall(stream));
+    if (!ok) {
+      dropped++;
+      close_stream(stream);
+    }
+  }
+}
+
+// the frame claimed by handle_latest(), then the connection is closed
+bool DataServer::send_latest(DataStream &stream) {
+  if (!send_frame(stream)) {
+    return false;
+  }
+  if (!stream.claimed) {
+    close_stream(stream);  // all sent
+  }
+  return true;
+}
+
+// the newest frame, if there is one the client has not had - frames made in between are skipped
+bool DataServer::send_live(DataStream &stream) {
+  uint32_t now = millis();
+  if (!stream.claimed) {
+    if (stream.next == frame_sequence) {
+      if (now - stream.sent_ms < DATA_KEEPALIVE_MS) {
+        return true;
+      }
+      stream.sent_ms = now;
+      return stream.client.print(": keepalive\n\n") == 13;
+    }
+    if (xSemaphoreTake(lock, 0) != pdTRUE) {
+      return true;  // Task2 is updating it, next tick
+    }
+    claims++;
+    stream.next = frame_sequence;
+    xSemaphoreGive(lock);
+    stream.claimed = true;
+    stream.offset = 0;
+    stream.sent_ms = now;
+    if (stream.client.print("data: ") != 6) {
+      return false;
+    }
+  }
+  if (!send_frame(stream)) {
+    return false;
+  }
+  return stream.claimed || stream.client.print("\n\n") == 2;
+}
+
+// the next DATA_SEND_BYTES of the claimed frame, without the lock - Task2 does not touch
+// the frame while it is claimed. Released once it has all gone
+bool DataServer::send_frame(DataStream &stream) {
+  uint32_t now = millis();
+  size_t length = min(frame_length - stream.offset, (size_t)DATA_SEND_BYTES);
+  size_t sent = stream.client.write((const uint8_t *)frame + stream.offset, length);
+  if (sent > 0) {
+    stream.offset += sent;
+    stream.sent_ms = now;
+  } else if (now - stream.sent_ms >= DATA_STALL_MS) {
+    return false;
+  }
+  if (stream.offset == frame_length) {
+    stream.claimed = false;
+    release_frame();
+  }
+  return true;
+}
+
+void DataServer::release_frame() {
+  xSemaphoreTake(lock, portMAX_DELAY);  // Task2 only holds it for a copy
+  claims--;
+  xSemaphoreGive(lock);
+}
+
+// the column line, then one row per call, then the last chunk
+bool DataServer::send_waterfall(DataStream &stream) {
+  int length = 0;
+  if (stream.header) {
+    length = snprintf(row_text, DATA_ROW_TEXT, "ms");
+    for (uint16_t c = 0; c < columns; c++) {
+      length += snprintf(row_text + length, DATA_ROW_TEXT - length, ",%.2f", c * pool * bin_hz);
+    }
+    length += snprintf(row_text + length, DATA_ROW_TEXT - length, "\n");
+    stream.header = false;
+    return send_chunk(stream.client, row_text, length);
+  }
+  if (stream.next >= stream.end) {
+    bool ok = stream.client.print("0\r\n\r\n") == 5;
+    close_stream(stream);
+    return ok;
+  }
+
+  // only the formatting is done under the lock, the row is sent from row_text
+  if (xSemaphoreTake(lock, 0) != pdTRUE) {
+    return true;
+  }
+  if (row_count - stream.next > WATERFALL_ROWS) {
+    stream.next = row_count - WATERFALL_ROWS;  // overwritten while we were sending
+  }
+  if (stream.next >= stream.end) {
+    xSemaphoreGive(lock);
+    return true;
+  }
+  uint32_t slot = stream.next % WATERFALL_ROWS;
+  const uint8_t *row = rows + slot * WATERFALL_BINS;
+  if (stream.kind == DataStreamKind::waterfall_raw) {
+    for (uint8_t i = 0; i < 4; i++) {
+      row_text[i] = row_ms[slot] >> (8 * i);
+    }
+    memcpy(row_text + 4, row, columns);
+    length = 4 + columns;
+  } else {
+    length = snprintf(row_text, DATA_ROW_TEXT, "%lu", (unsigned long)row_ms[slot]);
+    for (uint16_t c = 0; c < columns; c++) {
+      length += snprintf(row_text + length, DATA_ROW_TEXT - length, ",%.1f", WATERFALL_MIN_DB + row[c] * WATERFALL_STEP_DB);
+    }
+    length += snprintf(row_text + length, DATA_ROW_TEXT - length, "\n");
+  }
+  xSemaphoreGive(lock);
+  stream.next++;
+  return send_chunk(stream.client, row_text, length);
+}
+
+bool DataServer::send_chunk(WiFiClient &client, const char *data, size_t length) {
+  char size_line[12];
+  int n = snprintf(size_line, sizeof(size_line), "%x\r\n", (unsigned)length);
+  return client.write((const uint8_t *)size_line, n) == (size_t)n
+         && client.write((const uint8_t *)data, length) == length
+         && client.write((const uint8_t *)"\r\n", 2) == 2;
+}
+
+void DataServer::close_stream(DataStream &stream) {
+  if (stream.claimed) {
+    stream.claimed = false;
+    release_frame();
+  }
+  stream.client.stop();
+  stream.kind = DataStreamKind::none;
+}
+
+void DataServer::report(JsonObject out) {
+  uint8_t active = 0;
+  for (DataStream &stream : streams) {
+    if (stream.kind != DataStreamKind::none) {
+      active++;
+    }
+  }
+  out["requests"] = requests;
+  out["streams"] = active;
+  out["dropped"] = dropped;
+  out["frames_skipped"] = frames_skipped;
+  out["rows_skipped"] = rows_skipped;
+  out["rows"] = min(row_count, (uint32_t)WATERFALL_ROWS);
+}
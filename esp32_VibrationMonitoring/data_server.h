@@ -0,0 +1,160 @@
+// ----------------------------------------------------------------------
+//
+//   Local data endpoints for ESP32 devices
+//
+//   Copyright (C) 2022  Shoestring and University of Cambridge
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, version 3 of the License.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see https://www.gnu.org/licenses/.
+//
+// ----------------------------------------------------------------------
+
+#ifndef DATA_SERVER_H
+#define DATA_SERVER_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <WebServer.h>
+#include "shoestring_lib.h"
+#include "memory_budget.h"
+
+/**********************************************************
+ * Read-only data pages on the config web server, so the
+ * node can be looked at on site when the broker cannot be
+ * reached:
+ *
+ *   /data/latest     the last frame, as published
+ *   /data/waterfall  the last WATERFALL_ROWS spectra of
+ *                    channel 0, oldest first, as CSV in dB
+ *                    (?format=raw: per row 4 bytes millis,
+ *                    little endian, then one code per column)
+ *   /data/live       the newest frame whenever there is a
+ *                    new one, as server-sent events
+ *
+ * The frame is kept in one buffer of FRAME_MESSAGE_SIZE and
+ * the waterfall in a ring of 8 bit codes, WATERFALL_BINS
+ * columns each holding the largest of its FFT bins:
+ *
+ *   level_db = WATERFALL_MIN_DB + code * WATERFALL_STEP_DB
+ *
+ * Both are filled by Task2 and sent straight from these
+ * buffers, nothing is copied per request. Task2 never waits
+ * for the web server: if a page is being sent from the
+ * buffers it skips that update and counts it.
+ *
+ * Handlers run from the wifi task's handleClient() and only
+ * ever send a bounded amount. All three pages are streams:
+ * the handler writes the response header and parks the
+ * connection in one of DATA_MAX_STREAMS slots, then poll()
+ * (after every handleClient()) sends at most one row, or
+ * DATA_SEND_BYTES of the frame, per stream per tick.
+ *
+ * The lock is only held to format a row or to claim the
+ * frame, never across a socket write. A claimed frame is
+ * sent a slice per tick and Task2 leaves it alone until
+ * every stream has finished with it. A stream whose client
+ * has gone, or has taken nothing for DATA_STALL_MS, is
+ * dropped.
+ *
+ *   "http": {"requests": 12, "streams": 1, "dropped": 2,
+ *            "frames_skipped": 0, "rows_skipped": 1, "rows": 64}
+ **/
+
+#define WATERFALL_ROWS 64
+#define WATERFALL_BINS 128
+#define WATERFALL_MIN_DB -20.0f
+#define WATERFALL_STEP_DB 0.5f  // codes span -20 to 107.5 dB of FFT magnitude
+#define DATA_MAX_STREAMS 2
+#define DATA_ROW_TEXT 1024       // one CSV line
+#define DATA_LOCK_WAIT_MS 20     // how long a page waits for Task2 to finish an update
+#define DATA_KEEPALIVE_MS 15000  // comment sent on an idle live feed, finds clients that have gone
+#define DATA_SEND_BYTES 1436     // frame bytes written per stream per tick, one TCP segment
+#define DATA_STALL_MS 5000       // a stream taking nothing for this long is dropped
+
+#define DATA_ARENA_BYTES \
+  (arena_bytes(FRAME_MESSAGE_SIZE) + arena_bytes(WATERFALL_ROWS * WATERFALL_BINS) \
+   + arena_bytes(sizeof(uint32_t) * WATERFALL_ROWS))
+
+enum class DataStreamKind : uint8_t { none,
+                                      latest,
+                                      live,
+                                      waterfall_csv,
+                                      waterfall_raw };
+
+class DataServer {
+public:
+  // before lib.setup() - the routes are added when the web server starts.
+  // bins and bin_hz describe the magnitudes passed to add_spectrum()
+  void begin(ShoestringLib &lib, uint16_t bins, float bin_hz);
+
+  // Task2
+  void set_frame(const char *message, size_t length);
+  void add_spectrum(const float *magnitudes, uint16_t bins);
+
+  // wifi task
+  void poll();
+
+  void report(JsonObject out);
+
+private:
+  struct DataStream {
+    DataStreamKind kind = DataStreamKind::none;
+    WiFiClient client;
+    uint32_t next;  // frame sequence or waterfall row to send next
+    uint32_t end;   // waterfall row to stop at
+    bool header;    // CSV column line still to send
+    bool claimed;   // part-way through the frame, holding it
+    size_t offset;  // frame bytes sent so far
+    uint32_t sent_ms;
+  };
+
+  SemaphoreHandle_t lock = NULL;
+
+  // guarded by lock
+  char *frame;
+  size_t frame_length = 0;
+  uint32_t frame_sequence = 0;
+  uint32_t frame_ms = 0;
+  uint8_t *rows;
+  uint32_t *row_ms;
+  uint32_t row_count = 0;  // rows ever added, the newest is row_count - 1
+  uint8_t claims = 0;      // streams part-way through the frame, Task2 leaves it alone
+
+  uint16_t pool = 1;  // FFT bins per column
+  uint16_t columns = 0;
+  float bin_hz = 0;
+
+  // wifi task only
+  DataStream streams[DATA_MAX_STREAMS];
+  char row_text[DATA_ROW_TEXT];
+
+  uint32_t requests = 0;
+  uint32_t dropped = 0;
+  uint32_t frames_skipped = 0;
+  uint32_t rows_skipped = 0;
+
+  void handle_latest(WebServer &server);
+  void handle_waterfall(WebServer &server);
+  void handle_live(WebServer &server);
+  DataStream *open_stream(WebServer &server, DataStreamKind kind, const String &header);
+  bool send_latest(DataStream &stream);
+  bool send_live(DataStream &stream);
+  bool send_frame(DataStream &stream);
+  void release_frame();
+  bool send_waterfall(DataStream &stream);
+  bool send_chunk(WiFiClient &client, const char *data, size_t length);
+  void close_stream(DataStream &stream);
+};
+
+extern DataServer data_server;
+
+#endif
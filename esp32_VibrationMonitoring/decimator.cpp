@@ -0,0 +1,133 @@
+// ----------------------------------------------------------------------
+//
+//   Anti-aliasing decimator for ESP32 devices
+//
+//   Copyright (C) 2022  Shoestring and University of Cambridge
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, version 3 of the License.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see https://www.gnu.org/licenses/.
+//
+// ----------------------------------------------------------------------
+
+#include "decimator.h"
+
+#ifdef DECIMATOR_ESP_DSP
+#include <esp_dsp.h>
+#endif
+
+bool Decimator::begin(uint8_t decimation) {
+  if (decimation < 1 || decimation > DECIMATOR_MAX_FACTOR) {
+    return false;
+  }
+  factor = decimation;
+  taps = DECIMATOR_TAPS_PER_FACTOR * factor;
+  if (taps > capacity) {
+    coeffs = memory_budget.take_array<float>(taps, "decimator_taps");
+    delay = memory_budget.take_array<float>(2 * taps, "decimator_delay");
+    capacity = taps;
+  }
+
+  // windowed sinc, cut-off at the output Nyquist frequency (0.5 / factor of the input rate)
+  float cutoff = 0.5 / factor;
+  float centre = (taps - 1) * 0.5;
+  float sum = 0;
+  for (uint16_t i = 0; i < taps; i++) {
+    float t = i - centre;
+    float sinc = 2 * cutoff * (t == 0 ? 1.0 : sin(2 * PI * cutoff * t) / (2 * PI * cutoff * t));
+    float window = 0.42 - 0.5 * cos(2 * PI * i / (taps - 1)) + 0.08 * cos(4 * PI * i / (taps - 1));
+    coeffs[i] = sinc * window;
+    sum += coeffs[i];
+  }
+  // unity gain at DC (the taps are symmetric, so no reversal is needed for the dot product)
+  for (uint16_t i = 0; i < taps; i++) {
+    coeffs[i] /= sum;
+  }
+  reset();
+  return true;
+}
+
+void Decimator::reset() {
+  if (delay != NULL) {
+    memset(delay, 0, 2 * taps * sizeof(float));
+  }
+  pos = 0;
+  filled = 0;
+  phase = 0;
+}
+
+bool Decimator::push(float x, float &y) {
+  delay[pos] = x;
+  delay[pos + taps] = x;
+  pos++;
+  if (pos == taps) {
+    pos = 0;
+  }
+  if (filled < taps) {
+    filled++;
+  }
+  if (++phase < factor) {
+    return false;
+  }
+  phase = 0;
+  if (filled < taps) {
+    return false;
+  }
+  // delay[pos .. pos+taps) holds the last taps inputs, oldest first
+  y = dot(&delay[pos]);
+  return true;
+}
+
+size_t Decimator::process(const float *in, size_t n, float *out) {
+  size_t n_out = 0;
+  size_t i = 0;
+  while (i < n) {
+    // copy the inputs up to the next output into both halves at once, in runs that stop at the wrap
+    uint16_t run = min((size_t)(factor - phase), n - i);
+    run = min(run, (uint16_t)(taps - pos));
+    memcpy(&delay[pos], &in[i], run * sizeof(float));
+    memcpy(&delay[pos + taps], &in[i], run * sizeof(float));
+    i += run;
+    pos += run;
+    if (pos == taps) {
+      pos = 0;
+    }
+    filled = min((uint16_t)(filled + run), taps);
+    phase += run;
+    if (phase < factor) {
+      continue;
+    }
+    phase = 0;
+    if (filled < taps) {
+      continue;
+    }
+    out[n_out++] = dot(&delay[pos]);
+  }
+  return n_out;
+}
+
+float Decimator::dot(const float *window) {
+#ifdef DECIMATOR_ESP_DSP
+  float result;
+  dsps_dotprod_f32(coeffs, window, &result, taps);
+  return result;
+#else
+  // taps is a multiple of 4: four independent accumulators keep the FPU pipeline busy
+  float acc0 = 0, acc1 = 0, acc2 = 0, acc3 = 0;
+  for (uint16_t i = 0; i < taps; i += 4) {
+    acc0 += coeffs[i] * window[i];
+    acc1 += coeffs[i + 1] * window[i + 1];
+    acc2 += coeffs[i + 2] * window[i + 2];
+    acc3 += coeffs[i + 3] * window[i + 3];
+  }
+  return (acc0 + acc1) + (acc2 + acc3);
+#endif
+}
@@ -0,0 +1,91 @@
+// ----------------------------------------------------------------------
+//
+//   Anti-aliasing decimator for ESP32 devices
+//
+//   Copyright (C) 2022  Shoestring and University of Cambridge
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, version 3 of the License.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see https://www.gnu.org/licenses/.
+//
+// ----------------------------------------------------------------------
+
+#ifndef DECIMATOR_H
+#define DECIMATOR_H
+
+#include <Arduino.h>
+#include "memory_budget.h"
+
+/**********************************************************
+ * Streaming low-pass FIR + decimate by an integer factor.
+ *
+ * The sensor is sampled factor times faster than the
+ * analysis rate; the filter removes everything above the
+ * output Nyquist frequency before only every factor-th
+ * sample is kept, so vibration above it no longer folds
+ * into the bands.
+ *
+ * Only the kept outputs are computed, which is the work of
+ * a polyphase decimator (taps / factor MACs per input).
+ * The delay line is stored twice so the newest taps inputs
+ * are always contiguous and each output is a single dot
+ * product - done by esp-dsp (SIMD on the ESP32-S3) when
+ * the library is available, otherwise by an unrolled loop.
+ *
+ * The filter is a Blackman windowed sinc with its cut-off
+ * at the output Nyquist frequency and
+ * DECIMATOR_TAPS_PER_FACTOR * factor taps, designed at
+ * run time. Outputs start once the delay line is full.
+ *
+ * The taps and the delay line are taken from the arena by
+ * the first begin(), sized for that factor - users budget
+ * DECIMATOR_ARENA_BYTES(factor) per filter.
+ **/
+
+#define DECIMATOR_MAX_FACTOR 8
+#define DECIMATOR_TAPS_PER_FACTOR 32
+#define DECIMATOR_MAX_TAPS (DECIMATOR_MAX_FACTOR * DECIMATOR_TAPS_PER_FACTOR)
+#define DECIMATOR_ARENA_BYTES(factor) (3 * arena_bytes(sizeof(float) * DECIMATOR_TAPS_PER_FACTOR * (factor)))  // taps + delay line
+
+#if __has_include(<esp_dsp.h>)
+#define DECIMATOR_ESP_DSP
+#endif
+
+class Decimator {
+public:
+  // a later begin() with a larger factor than the first takes a new block
+  bool begin(uint8_t factor);
+  void reset();
+  // true when x completed an output sample, written to y
+  bool push(float x, float &y);
+  // block version of push(), same outputs - the inputs between outputs are copied into the
+  // delay line together and each output is one dot product; returns the number written
+  size_t process(const float *in, size_t n, float *out);
+
+  uint8_t get_factor() { return factor; }
+  uint16_t get_taps() { return taps; }
+  // in input samples
+  float group_delay() { return (taps - 1) * 0.5; }
+
+private:
+  float *coeffs = NULL;  // taps, ARENA_ALIGN aligned for the esp-dsp kernels
+  float *delay = NULL;  // 2 * taps
+  uint16_t capacity = 0;  // taps the blocks hold
+  uint16_t taps = 0;
+  uint16_t pos = 0;
+  uint16_t filled = 0;
+  uint8_t factor = 1;
+  uint8_t phase = 0;
+
+  float dot(const float *window);
+};
+
+#endif
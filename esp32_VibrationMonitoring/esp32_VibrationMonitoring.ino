@@ -18,35 +18,87 @@
 //
 //----------------------------------------------------------------------
 #include "shoestring_lib.h"
+#include "logger.h"
+#include "boot_profiler.h"
+#include "i2c_bus.h"
+#include "aux_sensors.h"
+#include "accel_sensor.h"
+#include "decimator.h"
+#include "zoom_fft.h"
+#include "velocity.h"
+#include "benchmarks.h"
+#include "memory_budget.h"
+#include "burst.h"
+#include "spectrum_codec.h"
+#include "data_server.h"
+#include "line_tracker.h"
+#include "tach.h"
+#include "order_tracking.h"
+#include "cepstrum.h"
+#include "sensor_health.h"
 #include <Adafruit_Sensor.h>
 #include <Wire.h>
-#include <Adafruit_ADXL345_U.h>
 #include "arduinoFFT.h"
-#include <Adafruit_ST7789.h>  // Hardware-specific library for ST7789
 #include <ArduinoJson.h>
 #include "Adafruit_MCP9808.h"
+#include <algorithm>
 
 
 // FFT settings
 const uint16_t samples = 1024; // Must be a power of 2
 const double samplingFrequency = 300; // Adjust to your needs
 unsigned int sampling_period_us;
-float vReal[samples]; // Buffer for FFT input
-float acceleration_buffer[samples]; // Buffer to be filledt
-float vImag[samples]; // Imaginary part (not used but required by some FFT library functions)
+float *vReal; // Buffer for FFT input
+float (*channel_buffers)[samples]; // Buffers to be filled, one per accelerometer
+float *vImag; // Imaginary part (not used but required by some FFT library functions)
+static_assert(ZOOM_SAMPLES == samples, "the zoom spectrum reuses the FFT buffers");
+const uint16_t freq_bands = 10; // Hz range per band
+const uint16_t n_bands = (samplingFrequency*0.5)/freq_bands;
+float band_magnitudes[n_bands+1]; // Band maxima from the latest frame, shown on the display
 // double bufferSamples[samples]; 
 // long int bufferMillis[samples];
-bool bufferFull = false; // Indicates when the buffer is ready for FFT
+bool bufferFull = false; // Indicates when the buffers of every channel are ready for FFT
+uint8_t next_channel = 0; // channel loop_callback analyses next
 int buff_start;
 int sampleCounter = 0;
-StaticJsonDocument<6000> JSONbuffer;
+uint8_t spectrum_bits = 0; // full spectrum code size, 0 = only the bands, see "spectrum_bits" config
+float spectrum_floor_db = NAN; // noise floor threshold above the median bin, NAN = off
+float *spectrum_magnitudes; // the channel's magnitudes, held until the rest of the frame is built
+uint16_t *spectrum_codes;
+uint8_t *spectrum_packed;
+char *spectrum_text;
+TrackDocument *track_doc; // tracked lines, published between frames
+char *track_message;
+float *order_pulses; // tach edges within the buffer being analysed
+float peak_snr_db = 10; // peakFrequency is only reported this far above the noise floor, see "peak_snr_db" config
+uint8_t n_cepstrum_peaks = 0; // sideband families per frame, 0 = off, see "cepstrum_peaks" config
+// even at 12 bits and no thresholding the full spectrum leaves half of the MQTT buffer for the rest - when
+// the rest grows past that the spectrum is sent at fewer bits, see attachSpectrum()
+// (the replay simulator's "full" scenario checks a whole frame with every option on against MQTT_BUFFER_SIZE)
+static_assert(spectrum_text_bytes(samples/2, SPECTRUM_MAX_BITS) <= 2000, "full spectrum too big for the frame");
+
+// Memory budget - the buffers above and the network buffers all come out of one arena, checked at compile time
+ARENA_DEFINE(arena_bytes(sizeof(float) * samples * ACCEL_MAX_CHANNELS) // channel_buffers
+             + 2 * arena_bytes(sizeof(float) * samples)                // vReal, vImag
+             + ACCEL_MAX_CHANNELS * DECIMATOR_ARENA_BYTES(DECIMATOR_MAX_FACTOR) // decimators
+             + ZOOM_ARENA_BYTES
+             + arena_bytes(sizeof(float) * samples/2)                            // spectrum_magnitudes
+             + arena_bytes(sizeof(uint16_t) * samples/2)                         // spectrum_codes
+             + arena_bytes(spectrum_packed_bytes(samples/2, SPECTRUM_MAX_BITS))  // spectrum_packed
+             + arena_bytes(spectrum_text_bytes(samples/2, SPECTRUM_MAX_BITS))    // spectrum_text
+             + SHOESTRING_ARENA_BYTES
+             + DATA_ARENA_BYTES
+             + TRACK_ARENA_BYTES
+             + TACH_ARENA_BYTES + ORDER_ARENA_BYTES
+             + BENCH_ARENA_BYTES);
 
 float buffer_total;
 float buffer_mean; 
 
 // arduinoFFT FFT = arduinoFFT(); 
 
-ArduinoFFT<float> FFT = ArduinoFFT<float>(vReal, vImag, samples, samplingFrequency, true);
+ArduinoFFT<float> FFT = ArduinoFFT<float>(NULL, NULL, samples, samplingFrequency, true); // arrays set in setup()
+VelocitySpectrum velocity;
 
 #define SCL_INDEX 0x00
 #define SCL_TIME 0x01
@@ -54,77 +106,132 @@ ArduinoFFT<float> FFT = ArduinoFFT<float>(vReal, vImag, samples, samplingFrequen
 #define SCL_PLOT 0x03
 
 ShoestringLib shlib;
+extern ConfigDisplay display;
 
 // Sensor settings
 
-Adafruit_ADXL345_Unified accel = Adafruit_ADXL345_Unified(12345);
+AccelSensor *channels[ACCEL_MAX_CHANNELS];
+uint8_t n_channels = 0;
+uint8_t decimation = 1; // sensors are sampled this many times faster than samplingFrequency, see "decimation" config
+Decimator decimators[ACCEL_MAX_CHANNELS];
+float last_sample[ACCEL_MAX_CHANNELS];
 Adafruit_MCP9808 tempsensor = Adafruit_MCP9808();
-
-// Screen Settings
-Adafruit_ST7789 oled_display = Adafruit_ST7789(TFT_CS, TFT_DC, TFT_RST);
-#define TEXT_SIZE 1
-#define TFT_CS  7
-#define TFT_DC 39
-#define TFT_RST  40
-#define TFT_BACKLITE  45
-#define TFT_I2C_POWER  21
+I2CBus *aux_bus = &i2c_bus0; // bus for the slow sensors, see "aux_i2c_bus" config
 
 
 // Task handles for the two tasks
 TaskHandle_t Task1;
 TaskHandle_t Task2;
+// Stack sizes in bytes: the sizes the device has always run with. Only trim them from the device's own
+// stacks.<task>.free_min in the "memory" metrics, keeping STACK_LOW_BYTES spare - the replay simulator's
+// --stacks figures leave out lwIP, PubSubClient, printf and the real libraries, so they are far too low.
+#define TASK1_STACK 10000
+#define TASK2_STACK 80000
+
+// Sampler statistics - all channels are read back to back in each tick, sharing its timestamp
+uint32_t frame_start_us; // time of sample 0 of the current buffers
+uint32_t read_errors = 0;
+uint32_t max_tick_us = 0; // time to read every channel once
+uint32_t group_delay_us = 0; // decimator delay, taken off frame_start_us
 
 // Other Variables
 
-volatile bool interrupt_flag = false;
-volatile bool value = true;
-volatile bool prev_value = true;
+// long int timestamp;
+// long int millistamp;
+
+
 
-bool debounced_value = true;
-bool prev_debounced_value = true;
 
-unsigned long interrupt_time;
-unsigned long trigger_time;
 
-// long int timestamp;
-// long int millistamp;
 
 
 
+void sampler_begin(){
+  buff_start = millis();
+  sampling_period_us = round(1000000*(1.0/(samplingFrequency*decimation)));
+  LOG_INFO("Sampling period (us): %u", sampling_period_us);
+  // decimator output lags its input by the filter group delay
+  group_delay_us = decimation > 1 ? decimators[0].group_delay() * sampling_period_us : 0;
+}
 
+// One sampler tick, due at period_start. Task1code calls it once per sampling period while
+// burst.is_sampling(); the host replay simulator (tools/replay_sim) drives it directly from its virtual clock.
+void sampler_step(uint32_t period_start){
+  if (burst.take_restart()) {
+    // first tick of a burst - the filters still hold the end of the last one
+    for (uint8_t c = 0; c < n_channels; c++) {
+      decimators[c].reset();
+    }
+    zoom.restart();
+    tracker.restart();
+  }
+  // the sensors are read even while the buffers wait for analysis, so the decimators and zoom see a continuous signal
+  bool storing = !bufferFull;
+  if (storing && sampleCounter == 0) {
+    health.frame_start(channels); // range changes only between buffers
+  }
+  // the decimators of all channels run in step, so they all produce an output on the same tick
+  bool output = true;
+  for (uint8_t c = 0; c < n_channels; c++) {
+    float x, y, z;
+    bool ok = channels[c]->read(x, y, z);
+    if (storing) {
+      health.push(c, ok, x, y, z);
+    }
+    if (ok) {
+      last_sample[c] = z + x + y;
+    } else {
+      // hold the last value rather than put a step into the spectrum
+      read_errors++;
+    }
+    float sample = last_sample[c];
+    if (decimation > 1) {
+      output = decimators[c].push(last_sample[c], sample);
+    }
+    if (output && storing) {
+      channel_buffers[c][sampleCounter] = sample;
+    }
+    if (output && c == 0 && zoom.is_enabled()) {
+      zoom.push(sample);
+    }
+    if (output && c == 0 && tracker.is_enabled()) {
+      tracker.push(sample);
+    }
+  }
+  i2c_bus0.set_next_deadline(period_start + sampling_period_us);
+  max_tick_us = max(max_tick_us, (uint32_t)(micros() - period_start));
 
+  if (output && storing) {
+    if (sampleCounter == 0) {
+      frame_start_us = period_start - group_delay_us;
+    }
+    sampleCounter++;
 
+    if(sampleCounter >= samples){
+      sampleCounter = 0;
+      health.frame_done();
+      bufferFull = true;
+      int buff_time = millis()-buff_start;
+      LOG_DEBUG("Buffer Filled in %d", buff_time);
+      burst.buffer_filled(zoom.is_enabled() && !zoom.is_ready());
 
+    }
+  }else if (!storing){
+    LOG_EVERY_MS(1000, LOG_DEBUG, "Buffer Full");
+  }
+}
 
 void Task1code(void * pvParameters){
-  sensors_event_t event;
-  buff_start = millis();
-  sampling_period_us = round(1000000*(1.0/samplingFrequency));
-  Serial.print("Sampling period (us): ");
-  Serial.println(sampling_period_us);
+  sampler_begin();
 
-  int period_start = micros();
+  uint32_t period_start = micros();
   for(;;){
-    if(!bufferFull){
-      accel.getEvent(&event);
-      acceleration_buffer[sampleCounter] = event.acceleration.z + event.acceleration.x + event.acceleration.y;
-      vImag[sampleCounter] = 0;
-      sampleCounter++;     
-
-      if(sampleCounter >= samples){
-        sampleCounter = 0;
-        bufferFull = true;
-        Serial.print("Buffer Filled in ");
-        int buff_time = millis()-buff_start;
-        Serial.println(buff_time);
-
-      }
-      // Serial.print("Sampling Period (us): "); 
-      // Serial.println(period);
-    }else{
-      Serial.println("Buffer Full");
-      // delay(10);
-      }
+    if (!burst.is_sampling()) {
+      // burst mode between bursts - block rather than spin core 0
+      burst.wait_for_arm();
+      period_start = micros();
+    }
+    sampler_step(period_start);
     while (micros() - period_start < sampling_period_us ){
     }
     period_start += sampling_period_us;
@@ -140,63 +247,161 @@ void Task2code(void * pvParameters){
 
 
 void setup() {
-  shlib.addConfig("debounce_time", 20);
+  boot_profiler.phase_done("runtime");  // reset until setup() starts
+  shlib.addConfig("accels", ACCEL_DEFAULT_SPEC); // accelerometer per channel, see accel_sensor.h
+  shlib.addConfig("accel_range_g", 16); // accelerometer range, 2/4/8/16, 0 = automatic, see sensor_health.h
+  shlib.addConfig("decimation", 1); // oversample by this factor (1-8) and low-pass filter before analysis, 1 = off
+  shlib.addConfig("zoom_centre_hz", "0"); // centre of the high resolution spectrum of channel 0, 0 = off
+  shlib.addConfig("zoom_factor", 16); // zoom span is samplingFrequency / zoom_factor, see zoom_fft.h
+  shlib.addConfig("velocity_hp_hz", 10); // velocity RMS ignores everything below this
+  shlib.addConfig("iso_class", 1); // ISO 10816-1 machine class (1-4) for the velocity zone
+  shlib.addConfig("aux_i2c_bus", 0); // 0: slow sensors share Wire with the accelerometer, 1: Wire1 on I2C2 pins
+  shlib.addConfig("temp_period_ms", 5000); // how often the MCP9808 is polled
+  shlib.addConfig("burst_period_s", 0); // measure in bursts this far apart, 0 = sample continuously, see burst.h
+  shlib.addConfig("burst_frames", 1); // buffers of every channel per burst
+  shlib.addConfig("spectrum_bits", 0); // add every FFT bin, log quantised to 8 or 12 bits, 0 = off, see spectrum_codec.h
+  shlib.addConfig("spectrum_floor_db", 0); // send bins less than this many dB above the median bin as 0, 0 = off
+  shlib.addConfig("track_freqs", ""); // lines to follow between frames, Hz, comma separated, "" = off, see line_tracker.h
+  shlib.addConfig("track_block_ms", 500); // one tracked amplitude per line this often
+  shlib.addConfig("tach_pin", -1); // GPIO of a once-per-rev speed sensor, -1 = none, see tach.h
+  shlib.addConfig("tach_ppr", 1); // tach pulses per revolution
+  shlib.addConfig("tach_debounce_us", 500); // tach edges closer than this to the last one are ignored
+  shlib.addConfig("peak_snr_db", 10); // peakFrequency is 0 unless the largest bin is this far above the median bin
+  shlib.addConfig("cepstrum_peaks", 0); // sideband families found from the cepstrum per frame, 0 = off, see cepstrum.h
+  data_server.begin(shlib, samples/2, samplingFrequency/samples); // /data pages, see data_server.h
   shlib.setup();
-  Serial.begin(9600);
-  Serial.print("Starting Up...");
-  // Initialise IMU
-  if(!accel.begin()) {
-    Serial.println("Ooops, no ADXL345 detected ... Check your wiring!");
+  LOG_INFO("Starting Up...");
+  channel_buffers = (float (*)[samples])memory_budget.take_array<float>(samples * ACCEL_MAX_CHANNELS, "channel_buffers");
+  vReal = memory_budget.take_array<float>(samples, "vReal");
+  vImag = memory_budget.take_array<float>(samples, "vImag");
+  FFT.setArrays(vReal, vImag);
+  i2c_bus0.begin();
+  if (shlib.getInt("aux_i2c_bus") == 1) {
+    i2c_bus1.begin(I2C2_SDA_PIN, I2C2_SCL_PIN);
+    aux_bus = &i2c_bus1;
+  }
+  // Initialise IMUs
+  n_channels = create_accel_sensors(shlib.getString("accels"), channels, ACCEL_MAX_CHANNELS);
+  if(n_channels == 0) {
+    LOG_ERROR("Ooops, no ADXL345 detected ... Check your wiring!");
     while(1);
   }
-  accel.setRange(ADXL345_RANGE_16_G);
+  decimation = constrain(shlib.getInt("decimation"), 1, DECIMATOR_MAX_FACTOR);
+  health.begin(n_channels, shlib.getInt("accel_range_g"));
+  for (uint8_t c = 0; c < n_channels; c++) {
+    channels[c]->set_range(health.get_range(c));
+    // the ADXL345 powers up at 100Hz, below the sampling rate, so keep its bandwidth (ODR/2) above Nyquist
+    float rate = channels[c]->set_data_rate(samplingFrequency*decimation);
+    LOG_INFO("Channel %u output data rate %.2f Hz", c, rate);
+    if (decimation > 1) {
+      decimators[c].begin(decimation); // filter taken from the arena only when it is used
+    }
+  }
+  if (decimation > 1) {
+    LOG_INFO("Decimating by %u with %u taps", decimation, decimators[0].get_taps());
+  }
+  velocity.begin(samplingFrequency, samples, shlib.getInt("velocity_hp_hz"), shlib.getInt("iso_class"),
+                 0.5*(samples/n_bands), n_bands+1); // same bands as downSample()
+  if (shlib.getInt("spectrum_bits") > 0) {
+    spectrum_bits = constrain(shlib.getInt("spectrum_bits"), SPECTRUM_MIN_BITS, SPECTRUM_MAX_BITS);
+    if (shlib.getInt("spectrum_floor_db") > 0) {
+      spectrum_floor_db = shlib.getInt("spectrum_floor_db");
+    }
+    spectrum_magnitudes = memory_budget.take_array<float>(samples/2, "spectrum_magnitudes");
+    spectrum_codes = memory_budget.take_array<uint16_t>(samples/2, "spectrum_codes");
+    spectrum_packed = memory_budget.take_array<uint8_t>(spectrum_packed_bytes(samples/2, spectrum_bits), "spectrum_packed");
+    spectrum_text = memory_budget.take_array<char>(spectrum_text_bytes(samples/2, spectrum_bits), "spectrum_text");
+  }
+  float zoom_centre = shlib.getString("zoom_centre_hz").toFloat();
+  if (zoom_centre > 0) {
+    zoom.begin(samplingFrequency, zoom_centre, shlib.getInt("zoom_factor"));
+  }
+  uint32_t track_block = max(shlib.getInt("track_block_ms"), 1) * samplingFrequency / 1000;
+  if (tracker.begin(samplingFrequency, shlib.getString("track_freqs"), track_block) > 0) {
+    track_doc = memory_budget.create<TrackDocument>("track_doc");
+    track_message = memory_budget.take_array<char>(TRACK_MESSAGE_SIZE, "track_message");
+  }
+  peak_snr_db = shlib.getInt("peak_snr_db");
+  n_cepstrum_peaks = constrain(shlib.getInt("cepstrum_peaks"), 0, CEPSTRUM_MAX_PEAKS);
+  if (tach.begin(shlib.getInt("tach_pin"), max(shlib.getInt("tach_debounce_us"), 0), constrain(shlib.getInt("tach_ppr"), 1, 255))) {
+    order_pulses = memory_budget.take_array<float>(TACH_MAX_PULSES, "order_pulses");
+  }
 
-  if (!tempsensor.begin(0x18)) {
-    Serial.println("Couldn't find MCP9808! Check your connections and verify the address is correct.");
+  if (!tempsensor.begin(0x18, aux_bus->wire())) {
+    LOG_ERROR("Couldn't find MCP9808! Check your connections and verify the address is correct.");
     while (1);
   }
-  Serial.println("Found MCP9808!");
+  LOG_INFO("Found MCP9808!");
   tempsensor.setResolution(3); // sets the resolution mode of reading, the modes are defined in the table bellow:
 
-  // Initialise Screen
-  delay(1000);
-  pinMode(TFT_BACKLITE, OUTPUT);
-  digitalWrite(TFT_BACKLITE, HIGH);
-  pinMode(TFT_I2C_POWER, OUTPUT);
-  digitalWrite(TFT_I2C_POWER, HIGH);
-  delay(10);
-  oled_display.init(135, 240);  // Init ST7789 240x135
-  oled_display.setRotation(3);
-  oled_display.fillScreen(ST77XX_BLACK);
-  oled_display.setTextWrap(false);
-  oled_display.fillScreen(ST77XX_BLACK);
-  oled_display.setCursor(0, 30);
-  oled_display.setTextColor(ST77XX_RED);
-  oled_display.setTextSize(2);
-  oled_display.print("Starting...");
-  delay(1000);
+  // slow sensors are polled by their own task, frames only pick up the cached values
+  aux_sensors.add_sensor("temperature", shlib.getInt("temp_period_ms"), [](float &value) {
+    value = aux_bus->transaction(I2CPriority::slow, []() { return tempsensor.readTempC(); });
+    return true;
+  });
+  aux_sensors.begin();
+  burst.begin(max(shlib.getInt("burst_period_s"), 0), shlib.getInt("burst_frames"));
+  boot_profiler.phase_done("sensors");
+
+  shlib.add_metrics_hook("i2c0", [](JsonObject out) { i2c_bus0.report(out); });
+  if (i2c_bus1.is_started()) {
+    shlib.add_metrics_hook("i2c1", [](JsonObject out) { i2c_bus1.report(out); });
+  }
+  shlib.add_metrics_hook("aux", [](JsonObject out) { aux_sensors.report(out); });
+  shlib.add_metrics_hook("health", [](JsonObject out) { health.report(out); });
+  shlib.add_metrics_hook("sampler", [](JsonObject out) {
+    out["channels"] = n_channels;
+    out["read_errors"] = read_errors;
+    out["tick_max_us"] = max_tick_us;
+    out["period_us"] = sampling_period_us;
+    out["decimation"] = decimation;
+  });
+  if (!burst.is_continuous()) {
+    shlib.add_metrics_hook("burst", [](JsonObject out) { burst.report(out); });
+  }
+  if (tach.is_enabled()) {
+    shlib.add_metrics_hook("tach", [](JsonObject out) { tach.report(out); });
+  }
+  if (tracker.is_enabled()) {
+    shlib.add_metrics_hook("track", [](JsonObject out) { tracker.report(out); });
+  }
+  shlib.add_command_hook("measure", [](const String &payload) { burst.trigger(); });
+
+#ifdef RUN_BENCHMARKS
+  benchmark_sampling(channels, n_channels, samplingFrequency*decimation);
+  benchmark_decimator();
+  benchmark_spectrum_codec();
+  benchmark_line_tracker(samplingFrequency);
+#endif
+
+  // Screen is initialised by shlib.setup() and driven by its own task
+
+  // set before Task2 starts - shlib.loop() analyses frames even while WiFi is still connecting
+  shlib.set_loop_hook(loop_callback);
 
   xTaskCreatePinnedToCore(
-    Task1code, /* Task function. */
-    "Task1",   /* name of task. */
-    10000,     /* Stack size of task */
-    NULL,      /* parameter of the task */
-    1,         /* priority of the task */
-    &Task1,    /* Task handle to keep track of created task */
-    0);        /* pin task to core 0 */ 
+    Task1code,   /* Task function. */
+    "Task1",     /* name of task. */
+    TASK1_STACK, /* Stack size of task */
+    NULL,        /* parameter of the task */
+    1,           /* priority of the task */
+    &Task1,      /* Task handle to keep track of created task */
+    0);          /* pin task to core 0 */ 
 
   xTaskCreatePinnedToCore(
-    Task2code, /* Task function. */
-    "Task2",   /* name of task. */
-    80000,     /* Stack size of task */
-    NULL,      /* parameter of the task */
-    1,         /* priority of the task */
-    &Task2,    /* Task handle to keep track of created task */
-    1);        /* pin task to core 1 */
+    Task2code,   /* Task function. */
+    "Task2",     /* name of task. */
+    TASK2_STACK, /* Stack size of task */
+    NULL,        /* parameter of the task */
+    1,           /* priority of the task */
+    &Task2,      /* Task handle to keep track of created task */
+    1);          /* pin task to core 1 */
+  memory_budget.watch_stack("Task1", Task1, TASK1_STACK);
+  memory_budget.watch_stack("Task2", Task2, TASK2_STACK);
+  memory_budget.log_summary();
+  boot_profiler.phase_done("tasks");
 
 
-  shlib.set_loop_hook(loop_callback);
-  delay(5);
   // timestamp = get_timestamp();
   // millistamp = millis();
 }
@@ -206,61 +411,142 @@ void setup() {
 void loop() {
 }
 
-bool loop_callback(StaticJsonDocument<3000>& JSONdoc) {
+bool loop_callback(FrameDocument& JSONdoc) {
+  if (tracker.is_enabled()) {
+    publishTracking();
+  }
 
   if(bufferFull){
     /// Do analysis here
-      // float tempVReal[samples];
-      // // Safely copy data from the shared buffer to the temporary buffer
+      // one channel per call, each published as its own frame
+      uint8_t channel = next_channel;
+      uint32_t channel_start_us = frame_start_us;
+      // Safely copy data from the shared buffer to the temporary buffer
       for(int i = 0; i < samples; i++) {
-        vReal[i] = acceleration_buffer[i];
+        vReal[i] = channel_buffers[channel][i];
+        vImag[i] = 0;
       }
-
-      bufferFull = false;
-      buff_start = millis();
-      Serial.println("Buffer Emptied"); // Can copy the buffer and move this up
+      health.check(channel, JSONdoc); // while the sampler is held off, as for the buffer itself
+
+      next_channel++;
+      bool last_channel = next_channel >= n_channels;
+      if (last_channel) {
+        next_channel = 0;
+        if (!tach.is_enabled()) {
+          releaseBuffers(); // every channel copied - let the sampler refill them
+        }
+      }
+      if (n_channels > 1) {
+        JSONdoc["channel"] = channel;
+        JSONdoc["sensor"] = channels[channel]->describe();
+        JSONdoc["frame_start_us"] = channel_start_us; // same for every channel of one acquisition
+      }
+      boot_profiler.milestone("first_buffer");
 
       int start = millis();
       removeOffset(vReal);
       int static_offset_time = millis()-start;
-      Serial.print("removing offset took: ");
-      Serial.println(static_offset_time);
+      LOG_DEBUG("removing offset took: %d", static_offset_time);
 
 
 
       start = millis();
-      JSONdoc["acceleration"] = calculateRMS(vReal);
+      float rms = calculateRMS(vReal);
+      JSONdoc["acceleration"] = rms;
       int RMS_time = millis()-start;
-      Serial.print("RMS took: ");
-      Serial.println(RMS_time);
+      LOG_DEBUG("RMS took: %d", RMS_time);
 
       start = millis();
       // ArduinoFFT V2.0.0
       FFT.windowing(FFTWindow::Hamming, FFTDirection::Forward);	/* Weigh data */
       FFT.compute(FFTDirection::Forward); /* Compute FFT */
       FFT.complexToMagnitude(); /* Compute magnitudes */
+      float snr = peakSNR(vReal, vImag); // vImag is free once the magnitudes are computed
+      JSONdoc["peak_snr_db"] = snr;
       float x;
-      if (JSONdoc["acceleration"] > 0.2){x = FFT.majorPeak();} else {x = 0.00;}
+      if (snr >= peak_snr_db){x = FFT.majorPeak();} else {x = 0.00;}
       JSONdoc["peakFrequency"] = x;
       // Serial.println("Computed magnitudes:");
       // PrintVector(vReal, (samples >> 1), SCL_FREQUENCY);
       downSample(vReal, samples, JSONdoc);
       int fft_time = millis()-start;
-      Serial.print("FFT took: ");
-      Serial.println(fft_time);
+      LOG_DEBUG("FFT took: %d", fft_time);
+
+      if (spectrum_bits > 0) {
+        // coded last, once the size of the rest of the frame is known
+        memcpy(spectrum_magnitudes, vReal, sizeof(float) * samples/2);
+      }
 
-      JSONdoc["temperature"] = tempsensor.readTempC();
+      start = millis();
+      velocity.analyse(vReal, JSONdoc);
+      int velocity_time = millis()-start;
+      LOG_DEBUG("Velocity took: %d", velocity_time);
+
+      if (channel == 0) {
+        display.setSpectrum(band_magnitudes, n_bands+1, rms);
+        data_server.add_spectrum(vReal, samples/2);
+      }
+
+      if (n_cepstrum_peaks > 0) {
+        // the last to read the magnitudes, they are replaced by the cepstrum
+        start = millis();
+        analyseCepstrum(JSONdoc.createNestedArray("cepstrum"));
+        int cepstrum_time = millis()-start;
+        LOG_DEBUG("Cepstrum took: %d", cepstrum_time);
+      }
+
+      if (channel == 0 && zoom.is_ready()) {
+        // the main spectrum is finished with vReal/vImag
+        start = millis();
+        zoom.analyse(FFT, vReal, vImag, JSONdoc.createNestedObject("zoom"));
+        int zoom_time = millis()-start;
+        LOG_DEBUG("Zoom FFT took: %d", zoom_time);
+      }
+
+      if (tach.is_enabled()) {
+        // last, the main and zoom spectra are finished with vReal/vImag
+        start = millis();
+        analyseOrders(channel_buffers[channel], channel_start_us, JSONdoc.createNestedObject("orders"));
+        if (last_channel) {
+          releaseBuffers(); // the orders are resampled from the raw buffers, so they are held until now
+        }
+        int orders_time = millis()-start;
+        LOG_DEBUG("Order tracking took: %d", orders_time);
+      }
+
+      aux_sensors.attach(JSONdoc);
+
+      if (spectrum_bits > 0) {
+        start = millis();
+        attachSpectrum(vImag, JSONdoc); // the zoom and orders are finished with vImag
+        int spectrum_time = millis()-start;
+        LOG_DEBUG("Spectrum coding took: %d", spectrum_time);
+      }
 
      
       
     
     return true;
   }
+  // nothing to analyse - start, finish or wait out a burst
+  burst.poll();
+  shlib.set_network_tick_ms(burst.is_idle() ? BURST_IDLE_WIFI_TICK_MS : WIFI_TICK_MS);
+  if (burst.is_idle()) {
+    delay(BURST_IDLE_POLL_MS);
+  }
   return false;
 }
 
 
 
+void releaseBuffers(){
+  bufferFull = false;
+  buff_start = millis();
+  LOG_DEBUG("Buffer Emptied");
+}
+
+
+
 float calculateRMS(float *vData) {
   float squareSum = 0.0;
   for (int i = 0; i<samples; i++){
@@ -284,11 +570,8 @@ void removeOffset(float *vData){
 }
 
 
-void downSample(float *vData, uint16_t bufferSize, StaticJsonDocument<3000>& JSONdoc){
-  uint16_t freq_bands = 10; // Hz range per band
-  uint16_t n_bands = (samplingFrequency*0.5)/freq_bands;
+void downSample(float *vData, uint16_t bufferSize, FrameDocument& JSONdoc){
   uint16_t samples_per_band = 0.5*(bufferSize/n_bands);
-  double downsampledData[n_bands];
 
   
 
@@ -312,6 +595,7 @@ void downSample(float *vData, uint16_t bufferSize, StaticJsonDocument<3000>& JSO
   
     JSONdoc["fft"][i]["frequency"] = tag_string;
     JSONdoc["fft"][i]["magnitude"] = mag_max;
+    band_magnitudes[i] = mag_max;
     
     // Serial.println(tag_string);
     // Serial.print(frequency);
@@ -322,6 +606,137 @@ void downSample(float *vData, uint16_t bufferSize, StaticJsonDocument<3000>& JSO
 
 
 
+// Largest bin (DC left out) over the median bin in dB, the median standing for the noise floor
+float peakSNR(const float *vData, float *scratch){
+  uint16_t bins = samples/2 - 1;
+  float peak = 0;
+  for (uint16_t i = 0; i < bins; i++) {
+    scratch[i] = vData[i + 1];
+    peak = max(peak, scratch[i]);
+  }
+  if (peak <= 0) {
+    return 0;
+  }
+  std::nth_element(scratch, scratch + bins/2, scratch + bins);
+  float noise_floor = max(scratch[bins/2], peak * 1e-6f); // at most 120dB, a silent floor is not infinitely far down
+  return 20 * log10(peak / noise_floor);
+}
+
+
+
+// Every bin of the magnitude spectrum, compressed - see spectrum_codec.h
+// Coded at spectrum_bits, then 2 bits fewer at a time until the frame fits FRAME_MESSAGE_SIZE with
+// room for the timestamp and id - left out when it does not fit even at SPECTRUM_MIN_BITS
+void attachSpectrum(float *scratch, FrameDocument& JSONdoc){
+  JsonObject spectrum = JSONdoc.createNestedObject("spectrum");
+  if (spectrum.isNull()) {
+    return; // the document is full, loop() refuses the frame
+  }
+  spectrum["bins"] = samples/2;
+  spectrum["bin_hz"] = samplingFrequency / samples;
+  for (int bits = spectrum_bits; ; bits = max(bits - 2, SPECTRUM_MIN_BITS)) {
+    SpectrumHeader header;
+    spectrum_quantise(spectrum_magnitudes, samples/2, bits, spectrum_floor_db, scratch, spectrum_codes, header);
+    size_t length = spectrum_pack(spectrum_codes, header, spectrum_packed);
+    base64_encode(spectrum_packed, length, spectrum_text);
+
+    spectrum["bits"] = header.bits;
+    spectrum["top_db"] = header.top_db;
+    spectrum["step_db"] = header.step_db;
+    if (!isnan(header.floor_db)) {
+      spectrum["floor_db"] = header.floor_db;
+    }
+    spectrum["data"] = (const char*)spectrum_text; // not copied, the buffer outlives the publish
+    if (measureJson(JSONdoc) + FRAME_TAIL_BYTES < FRAME_MESSAGE_SIZE) {
+      if (bits < spectrum_bits) {
+        LOG_EVERY_MS(10000, LOG_WARN, "Full spectrum sent at %d bits to fit the frame", bits);
+      }
+      return;
+    }
+    if (bits == SPECTRUM_MIN_BITS) {
+      break;
+    }
+  }
+  JSONdoc.remove("spectrum");
+  LOG_EVERY_MS(10000, LOG_WARN, "Full spectrum left out, the frame is too big even at %d bits", SPECTRUM_MIN_BITS);
+}
+
+
+
+// Spectrum against shaft angle, in orders of the running speed - see order_tracking.h
+void analyseOrders(const float *buffer, uint32_t start_us, JsonObject out){
+  float period_us = 1e6 / samplingFrequency;
+  uint16_t n_pulses = tach.pulses(start_us, start_us + (uint32_t)((samples - 1) * period_us), order_pulses, TACH_MAX_PULSES);
+  float revs = order_resample(buffer, samples, period_us, order_pulses, n_pulses, tach.get_ppr(), vReal, samples);
+  out["pulses"] = n_pulses;
+  if (revs == 0) {
+    return; // stopped, too slow for ORDER_MIN_REVS or the tach ring overran
+  }
+  out["rpm"] = 60e6 * revs / (order_pulses[n_pulses - 1] - order_pulses[0]);
+  out["revs"] = revs;
+  out["resolution"] = 1 / revs;
+
+  removeOffset(vReal);
+  for (int i = 0; i < samples; i++) {
+    vImag[i] = 0;
+  }
+  FFT.windowing(FFTWindow::Hamming, FFTDirection::Forward);
+  FFT.compute(FFTDirection::Forward);
+  FFT.complexToMagnitude();
+
+  uint16_t peak = 1;
+  for (uint16_t i = 2; i < samples/2; i++) {
+    if (vReal[i] > vReal[peak]) {
+      peak = i;
+    }
+  }
+  out["peak_order"] = peak / revs;
+  JsonArray bands = out.createNestedArray("bands");
+  for (uint16_t order = 1; order <= ORDER_BANDS; order++) {
+    uint16_t from = max((int)ceilf((order - 0.5f) * revs), 1);
+    uint16_t to = min((int)ceilf((order + 0.5f) * revs), samples/2);
+    if (from >= to) {
+      break; // past the highest order
+    }
+    float mag_max = 0;
+    for (uint16_t i = from; i < to; i++) {
+      mag_max = max(mag_max, vReal[i]);
+    }
+    JsonObject band = bands.createNestedObject();
+    band["order"] = order;
+    band["magnitude"] = mag_max;
+  }
+}
+
+
+
+// Sideband families from the cepstrum of the magnitudes in vReal - see cepstrum.h
+void analyseCepstrum(JsonArray out){
+  cepstrum_compute(FFT, vReal, vImag, samples);
+  CepstrumPeak peaks[CEPSTRUM_MAX_PEAKS];
+  uint8_t n_peaks = cepstrum_peaks(vReal, samples, peaks, n_cepstrum_peaks);
+  for (uint8_t p = 0; p < n_peaks; p++) {
+    JsonObject family = out.createNestedObject();
+    family["spacing_hz"] = samplingFrequency / peaks[p].quefrency;
+    family["quefrency_ms"] = 1000 * peaks[p].quefrency / samplingFrequency;
+    family["amplitude"] = peaks[p].amplitude;
+    family["rahmonics"] = peaks[p].rahmonics;
+    family["energy"] = peaks[p].energy;
+  }
+}
+
+
+
+// Tracked lines go out as soon as each block is done, on their own sub-topic - see line_tracker.h
+void publishTracking(){
+  if (tracker.take(*track_doc)) {
+    serializeJson(*track_doc, track_message, TRACK_MESSAGE_SIZE);
+    shlib.publish("track", track_message);
+  }
+}
+
+
+
 void PrintVector(float *vData, uint16_t bufferSize, uint8_t scaleType)
 {
   for (uint16_t i = 0; i < bufferSize; i++)
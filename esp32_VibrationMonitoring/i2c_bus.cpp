@@ -0,0 +1,161 @@
+// ----------------------------------------------------------------------
+//
+//   Shared I2C bus arbiter for ESP32 devices
+//
+//   Copyright (C) 2022  Shoestring and University of Cambridge
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, version 3 of the License.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see https://www.gnu.org/licenses/.
+//
+// ----------------------------------------------------------------------
+
+#include "i2c_bus.h"
+
+I2CBus i2c_bus0(Wire, "i2c0");
+I2CBus i2c_bus1(Wire1, "i2c1");
+
+static const char *priority_names[I2C_N_PRIORITIES] = { "sample", "slow" };
+
+bool I2CBus::begin(int sda, int scl, uint32_t frequency) {
+  if (started) {
+    return true;
+  }
+  for (uint8_t i = 0; i < I2C_MAX_WAITERS; i++) {
+    waiters[i].grant = xSemaphoreCreateBinary();
+    waiters[i].used = false;
+  }
+  started = bus.begin(sda, scl, frequency);
+  return started;
+}
+
+void I2CBus::acquire(I2CPriority priority) {
+  uint32_t requested = micros();
+  if (priority != I2CPriority::sample) {
+    defer_for_sample();
+  }
+
+  for (;;) {
+    SemaphoreHandle_t grant = NULL;
+    portENTER_CRITICAL(&mux);
+    if (!busy) {
+      busy = true;
+      owner_priority = priority;
+      grant_us = micros();
+      record_wait(priority, grant_us - requested);
+      portEXIT_CRITICAL(&mux);
+      return;
+    }
+    for (uint8_t i = 0; i < I2C_MAX_WAITERS; i++) {
+      if (!waiters[i].used) {
+        waiters[i] = { true, priority, next_sequence++, requested, waiters[i].grant };
+        grant = waiters[i].grant;
+        break;
+      }
+    }
+    portEXIT_CRITICAL(&mux);
+
+    if (grant != NULL) {
+      xSemaphoreTake(grant, portMAX_DELAY);  // release() handed the bus to us
+      return;
+    }
+    vTaskDelay(1);  // every waiter slot taken - try again shortly
+  }
+}
+
+void I2CBus::release() {
+  uint32_t now = micros();
+  SemaphoreHandle_t grant = NULL;
+
+  portENTER_CRITICAL(&mux);
+  I2CBusStats &s = stats[(uint8_t)owner_priority];
+  uint32_t hold = now - grant_us;
+  s.transactions++;
+  s.total_hold_us += hold;
+  s.max_hold_us = max(s.max_hold_us, hold);
+
+  // highest priority first, first come first served within a priority
+  int8_t next = -1;
+  for (uint8_t i = 0; i < I2C_MAX_WAITERS; i++) {
+    if (!waiters[i].used) {
+      continue;
+    }
+    if (next < 0 || waiters[i].priority < waiters[next].priority
+        || (waiters[i].priority == waiters[next].priority && (int32_t)(waiters[i].sequence - waiters[next].sequence) < 0)) {
+      next = i;
+    }
+  }
+  if (next >= 0) {
+    Waiter &w = waiters[next];
+    w.used = false;
+    owner_priority = w.priority;
+    grant_us = now;
+    record_wait(w.priority, now - w.requested_us);
+    grant = w.grant;
+  } else {
+    busy = false;
+  }
+  portEXIT_CRITICAL(&mux);
+
+  if (grant != NULL) {
+    xSemaphoreGive(grant);
+  }
+}
+
+// called with mux held
+void I2CBus::record_wait(I2CPriority priority, uint32_t wait) {
+  I2CBusStats &s = stats[(uint8_t)priority];
+  s.total_wait_us += wait;
+  s.max_wait_us = max(s.max_wait_us, wait);
+}
+
+// Hold a slow transaction back if it would still be on the bus when the next
+// sample is due. A deadline long past means the sampler is stopped.
+void I2CBus::defer_for_sample() {
+  uint32_t start = micros();
+  bool counted = false;
+  for (;;) {
+    uint32_t deadline = next_deadline_us;
+    int32_t until = (int32_t)(deadline - micros());
+    if (deadline == 0 || until > SLOW_TRANSACTION_US || until < -SLOW_MAX_DEFER_US) {
+      return;
+    }
+    if (micros() - start > SLOW_MAX_DEFER_US) {
+      return;
+    }
+    if (!counted) {
+      portENTER_CRITICAL(&mux);
+      deferred++;
+      portEXIT_CRITICAL(&mux);
+      counted = true;
+    }
+    delayMicroseconds(50);
+  }
+}
+
+void I2CBus::report(JsonObject out) {
+  I2CBusStats snapshot[I2C_N_PRIORITIES];
+  portENTER_CRITICAL(&mux);
+  memcpy(snapshot, stats, sizeof(snapshot));
+  uint32_t deferred_count = deferred;
+  portEXIT_CRITICAL(&mux);
+
+  for (uint8_t p = 0; p < I2C_N_PRIORITIES; p++) {
+    const I2CBusStats &s = snapshot[p];
+    JsonObject section = out.createNestedObject(priority_names[p]);
+    section["n"] = s.transactions;
+    section["wait_max_us"] = s.max_wait_us;
+    section["wait_mean_us"] = s.transactions ? (uint32_t)(s.total_wait_us / s.transactions) : 0;
+    section["hold_max_us"] = s.max_hold_us;
+    section["hold_mean_us"] = s.transactions ? (uint32_t)(s.total_hold_us / s.transactions) : 0;
+  }
+  out["deferred"] = deferred_count;
+}
@@ -0,0 +1,120 @@
+// ----------------------------------------------------------------------
+//
+//   Shared I2C bus arbiter for ESP32 devices
+//
+//   Copyright (C) 2022  Shoestring and University of Cambridge
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, version 3 of the License.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see https://www.gnu.org/licenses/.
+//
+// ----------------------------------------------------------------------
+
+#ifndef I2C_BUS_H
+#define I2C_BUS_H
+
+#include <Arduino.h>
+#include <Wire.h>
+#include <ArduinoJson.h>
+
+/**********************************************************
+ * Serialises access to one TwoWire bus between tasks.
+ *
+ * Every sensor access is wrapped in transaction(priority,
+ * fn). The bus is handed to the highest priority waiter on
+ * release, so a pending accelerometer read always goes
+ * before queued slow-sensor reads.
+ *
+ * A transfer in progress cannot be interrupted, so slow
+ * transactions are also kept out of the gap just before the
+ * next sample is due: the sampler publishes its next
+ * deadline with set_next_deadline() and a slow transaction
+ * that would not finish in time waits until the sample has
+ * been read (for at most SLOW_MAX_DEFER_US).
+ *
+ * Wait (request -> grant) and hold (grant -> release) times
+ * are kept per priority for the metrics message.
+ **/
+
+#define I2C2_SDA_PIN 16
+#define I2C2_SCL_PIN 15
+
+#define I2C_MAX_WAITERS 4
+#define SLOW_TRANSACTION_US 400  // worst case slow-sensor transfer at 400kHz
+#define SLOW_MAX_DEFER_US 5000   // never starve slow sensors for longer than this
+
+enum class I2CPriority : uint8_t { sample = 0,
+                                   slow = 1 };
+#define I2C_N_PRIORITIES 2
+
+struct I2CBusStats {
+  uint32_t transactions = 0;
+  uint32_t max_wait_us = 0;
+  uint64_t total_wait_us = 0;
+  uint32_t max_hold_us = 0;
+  uint64_t total_hold_us = 0;
+};
+
+class I2CBus {
+public:
+  I2CBus(TwoWire &wire, const char *name)
+    : bus(wire), name(name) {}
+  bool begin(int sda = -1, int scl = -1, uint32_t frequency = 400000);
+  bool is_started() { return started; }
+  TwoWire *wire() { return &bus; }
+  const char *get_name() { return name; }
+
+  template<typename F>
+  auto transaction(I2CPriority priority, F fn) -> decltype(fn()) {
+    acquire(priority);
+    auto result = fn();
+    release();
+    return result;
+  }
+
+  void set_next_deadline(uint32_t due_us) { next_deadline_us = due_us; }
+  void report(JsonObject out);
+
+private:
+  struct Waiter {
+    bool used;
+    I2CPriority priority;
+    uint32_t sequence;
+    uint32_t requested_us;
+    SemaphoreHandle_t grant;  // one per slot, created in begin()
+  };
+
+  TwoWire &bus;
+  const char *name;
+  bool started = false;
+  portMUX_TYPE mux = portMUX_INITIALIZER_UNLOCKED;
+
+  // guarded by mux
+  bool busy = false;
+  Waiter waiters[I2C_MAX_WAITERS];
+  uint32_t next_sequence = 0;
+  I2CPriority owner_priority = I2CPriority::slow;
+  uint32_t grant_us = 0;
+  I2CBusStats stats[I2C_N_PRIORITIES];
+  uint32_t deferred = 0;
+
+  volatile uint32_t next_deadline_us = 0;
+
+  void acquire(I2CPriority priority);
+  void release();
+  void record_wait(I2CPriority priority, uint32_t wait);
+  void defer_for_sample();
+};
+
+extern I2CBus i2c_bus0;  // Wire - accelerometer
+extern I2CBus i2c_bus1;  // Wire1 on I2C2_SDA_PIN/I2C2_SCL_PIN - auxiliary sensors
+
+#endif
@@ -0,0 +1,157 @@
+// ----------------------------------------------------------------------
+//
+//   Goertzel line tracker for ESP32 devices
+//
+//   Copyright (C) 2022  Shoestring and University of Cambridge
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, version 3 of the License.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see https://www.gnu.org/licenses/.
+//
+// ----------------------------------------------------------------------
+
+#include "line_tracker.h"
+#include "logger.h"
+
+LineTracker tracker;
+
+uint8_t LineTracker::begin(float sample_rate, const String &list, uint32_t block) {
+  this->sample_rate = sample_rate;
+  n_lines = 0;
+  int start = 0;
+  while (start <= (int)list.length()) {
+    int end = list.indexOf(',', start);
+    if (end < 0) {
+      end = list.length();
+    }
+    String item = list.substring(start, end);
+    start = end + 1;
+    item.trim();
+    if (item.length() == 0) {
+      continue;
+    }
+    float hz = item.toFloat();
+    if (hz <= 0 || hz >= sample_rate / 2) {
+      LOG_ERROR("Tracked line \"%s\" not between 0 and %.1f Hz", item.c_str(), sample_rate / 2);
+      continue;
+    }
+    if (n_lines >= TRACK_MAX_LINES) {
+      LOG_ERROR("More than %u tracked lines, %s Hz and after ignored", TRACK_MAX_LINES, item.c_str());
+      break;
+    }
+    freqs[n_lines] = hz;
+    coeffs[n_lines] = 2 * cos(2 * PI * hz / sample_rate);
+    n_lines++;
+  }
+  if (n_lines == 0) {
+    return 0;
+  }
+
+  this->block = max(block, (uint32_t)8);
+  float w = 2 * PI / this->block;
+  step_re = cos(w);
+  step_im = sin(w);
+  restart();
+  LOG_INFO("Tracking %u lines, %lu samples (%.0f ms) per block, %.2f Hz resolution", n_lines,
+           (unsigned long)this->block, this->block * 1000 / sample_rate, 2 * sample_rate / this->block);
+  return n_lines;
+}
+
+void LineTracker::restart() {
+  for (uint8_t i = 0; i < n_lines; i++) {
+    s1[i] = s2[i] = 0;
+  }
+  count = 0;
+  window_sum = 0;
+  sum = 0;
+  window_re = 1;
+  window_im = 0;
+}
+
+void LineTracker::push(float x) {
+  float w = 0.5f - 0.5f * window_re;
+  float xw = (x - offset) * w;
+  for (uint8_t i = 0; i < n_lines; i++) {
+    float s = xw + coeffs[i] * s1[i] - s2[i];
+    s2[i] = s1[i];
+    s1[i] = s;
+  }
+  window_sum += w;
+  sum += x;
+
+  float re = window_re * step_re - window_im * step_im;
+  float im = window_re * step_im + window_im * step_re;
+  window_re = re;
+  window_im = im;
+
+  if (++count >= block) {
+    finish_block();
+  }
+}
+
+// |X|^2 = s1^2 + s2^2 - coeff s1 s2 at the end of the block, and a sine of
+// amplitude A gives |X| = A * window_sum / 2
+void LineTracker::finish_block() {
+  float result[TRACK_MAX_LINES];
+  for (uint8_t i = 0; i < n_lines; i++) {
+    float power = s1[i] * s1[i] + s2[i] * s2[i] - coeffs[i] * s1[i] * s2[i];
+    result[i] = 2 * sqrtf(max(power, 0.0f)) / window_sum;
+  }
+  offset = sum / count;
+
+  portENTER_CRITICAL(&mux);
+  memcpy(amplitudes, result, sizeof(float) * n_lines);
+  end_us = micros();
+  if (blocks != taken) {
+    missed++;
+  }
+  blocks++;
+  portEXIT_CRITICAL(&mux);
+
+  restart();  // the window phasor starts from exactly 1 every block, so it never drifts
+}
+
+bool LineTracker::take(JsonDocument &doc) {
+  float result[TRACK_MAX_LINES];
+  portENTER_CRITICAL(&mux);
+  bool fresh = taken != blocks;
+  uint32_t sequence = blocks;
+  uint32_t at_us = end_us;
+  memcpy(result, amplitudes, sizeof(float) * n_lines);
+  taken = blocks;
+  portEXIT_CRITICAL(&mux);
+  if (!fresh) {
+    return false;
+  }
+
+  doc.clear();
+  doc["seq"] = sequence;
+  doc["end_us"] = at_us;
+  doc["block_ms"] = (uint32_t)(block * 1000 / sample_rate + 0.5f);
+  JsonArray hz = doc.createNestedArray("hz");
+  JsonArray amp = doc.createNestedArray("amp");
+  for (uint8_t i = 0; i < n_lines; i++) {
+    hz.add(freqs[i]);
+    amp.add(result[i]);
+  }
+  return true;
+}
+
+void LineTracker::report(JsonObject out) {
+  portENTER_CRITICAL(&mux);
+  uint32_t n_blocks = blocks;
+  uint32_t n_missed = missed;
+  portEXIT_CRITICAL(&mux);
+  out["lines"] = n_lines;
+  out["block"] = block;
+  out["blocks"] = n_blocks;
+  out["missed"] = n_missed;
+}
@@ -0,0 +1,115 @@
+// ----------------------------------------------------------------------
+//
+//   Goertzel line tracker for ESP32 devices
+//
+//   Copyright (C) 2022  Shoestring and University of Cambridge
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, version 3 of the License.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see https://www.gnu.org/licenses/.
+//
+// ----------------------------------------------------------------------
+
+#ifndef LINE_TRACKER_H
+#define LINE_TRACKER_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include "memory_budget.h"
+
+/**********************************************************
+ * Amplitude of a few known frequencies (running speed,
+ * blade pass, gear mesh...), updated much faster than the
+ * full spectrum.
+ *
+ * "track_freqs" lists the lines in Hz, comma separated, e.g.
+ * "24.75,49.5,173.25". Each one gets a Goertzel filter that
+ * is run on every analysis-rate sample of channel 0 as it
+ * arrives, Hann windowed, over blocks of "track_block_ms"
+ * (block = sample rate * track_block_ms / 1000 samples):
+ *
+ *   s = x * w[n] + 2 cos(2 pi f / fs) * s1 - s2
+ *
+ * That is one multiply-add per line per sample instead of a
+ * 1024 point FFT, and a result every block rather than every
+ * 3.4 s. A line is resolved to about 2 * fs / block Hz (the
+ * Hann main lobe), so a 500 ms block separates lines 4 Hz
+ * apart. The offset is taken off using the previous block's
+ * mean.
+ *
+ * Each finished block is published on its own sub-topic,
+ * <mqtt_topic>/<identifier>/track, as amplitudes (peak,
+ * same units as the samples):
+ *
+ *   {"seq": 17, "end_us": 8512345, "block_ms": 500,
+ *    "hz": [24.75, 49.5], "amp": [0.012, 0.98]}
+ *
+ * push() and restart() run in the sampling task, take() in
+ * the analysis loop. A block that is not taken before the
+ * next one finishes is counted as missed.
+ *
+ *   "track": {"lines": 2, "block": 150, "blocks": 120, "missed": 0}
+ **/
+
+#define TRACK_MAX_LINES 32
+#define TRACK_JSON_CAPACITY 1536
+#define TRACK_MESSAGE_SIZE 1024
+
+typedef StaticJsonDocument<TRACK_JSON_CAPACITY> TrackDocument;
+
+#define TRACK_ARENA_BYTES (arena_bytes(sizeof(TrackDocument)) + arena_bytes(TRACK_MESSAGE_SIZE))
+
+class LineTracker {
+public:
+  // returns the number of lines, 0 (off) for an empty list
+  uint8_t begin(float sample_rate, const String &freqs, uint32_t block);
+  bool is_enabled() { return n_lines > 0; }
+
+  // sampling task
+  void push(float x);
+  void restart();
+
+  // analysis loop - fills doc with the newest block not taken yet
+  bool take(JsonDocument &doc);
+  void report(JsonObject out);
+
+private:
+  float sample_rate;
+  uint8_t n_lines = 0;
+  float freqs[TRACK_MAX_LINES];
+  float coeffs[TRACK_MAX_LINES];
+  uint32_t block = 0;
+
+  // sampling task only
+  float s1[TRACK_MAX_LINES];
+  float s2[TRACK_MAX_LINES];
+  uint32_t count = 0;
+  float window_sum = 0;
+  float sum = 0;
+  float offset = 0;
+  // Hann window phasor, rotated by step every sample
+  float window_re = 1, window_im = 0;
+  float step_re, step_im;
+
+  // guarded by mux
+  portMUX_TYPE mux = portMUX_INITIALIZER_UNLOCKED;
+  float amplitudes[TRACK_MAX_LINES];
+  uint32_t end_us = 0;
+  uint32_t blocks = 0;
+  uint32_t taken = 0;
+  uint32_t missed = 0;
+
+  void finish_block();
+};
+
+extern LineTracker tracker;
+
+#endif
@@ -0,0 +1,124 @@
+// ----------------------------------------------------------------------
+//
+//   Non-blocking logger for ESP32 devices
+//
+//   Copyright (C) 2022  Shoestring and University of Cambridge
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, version 3 of the License.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see https://www.gnu.org/licenses/.
+//
+// ----------------------------------------------------------------------
+
+#include "logger.h"
+#include "memory_budget.h"
+
+Logger logger;
+
+static const char level_tags[] = { '-', 'E', 'W', 'I', 'D' };
+
+bool LogRateLimit::allow(uint32_t interval_ms) {
+  uint32_t now = millis();
+  if (first || now - last >= interval_ms) {
+    first = false;
+    last = now;
+    return true;
+  }
+  return false;
+}
+
+Logger::Logger()
+  : head(0), n_dropped(0), n_rate_limited(0) {
+  for (uint32_t i = 0; i < LOG_RING_SLOTS; i++) {
+    slots[i].sequence.store(i, std::memory_order_relaxed);
+  }
+}
+
+void Logger::begin(unsigned long baud) {
+  if (started) {
+    return;
+  }
+  Serial.begin(baud);
+  started = true;
+
+  TaskHandle_t task;
+  xTaskCreatePinnedToCore(
+    drain_task,            /* Task function. */
+    "LogDrain",            /* name of task. */
+    LOG_DRAIN_STACK,       /* Stack size of task */
+    this,                  /* parameter of the task */
+    tskIDLE_PRIORITY + 1,  /* priority of the task */
+    &task,                 /* Task handle to keep track of created task */
+    1);                    /* pin task to core 1 */
+  memory_budget.watch_stack("LogDrain", task, LOG_DRAIN_STACK);
+}
+
+// Multi-producer enqueue (bounded MPMC ring, one sequence counter per slot).
+// A producer claims a slot by advancing head, formats into it, then
+// publishes it by bumping the slot sequence.
+void Logger::write(uint8_t level, const char* format, ...) {
+  uint32_t pos = head.load(std::memory_order_relaxed);
+  Slot* slot;
+  for (;;) {
+    slot = &slots[pos & (LOG_RING_SLOTS - 1)];
+    uint32_t seq = slot->sequence.load(std::memory_order_acquire);
+    int32_t diff = (int32_t)(seq - pos);
+    if (diff == 0) {
+      if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+        break;
+      }
+    } else if (diff < 0) {
+      n_dropped.fetch_add(1, std::memory_order_relaxed);  // ring full
+      return;
+    } else {
+      pos = head.load(std::memory_order_relaxed);
+    }
+  }
+
+  slot->level = level;
+  slot->timestamp = millis();
+  va_list args;
+  va_start(args, format);
+  vsnprintf(slot->text, sizeof(slot->text), format, args);
+  va_end(args);
+
+  slot->sequence.store(pos + 1, std::memory_order_release);
+}
+
+// Single consumer: only the drain task calls this.
+bool Logger::drain_one() {
+  Slot* slot = &slots[tail & (LOG_RING_SLOTS - 1)];
+  uint32_t seq = slot->sequence.load(std::memory_order_acquire);
+  if ((int32_t)(seq - (tail + 1)) < 0) {
+    return false;
+  }
+
+  char tag = slot->level < sizeof(level_tags) ? level_tags[slot->level] : '?';
+  Serial.printf("[%lu][%c] %s\n", (unsigned long)slot->timestamp, tag, slot->text);
+
+  slot->sequence.store(tail + LOG_RING_SLOTS, std::memory_order_release);
+  tail++;
+  return true;
+}
+
+void Logger::drain_task(void* pvParameters) {
+  Logger* self = (Logger*)pvParameters;
+  for (;;) {
+    while (self->drain_one()) {
+    }
+    uint32_t dropped = self->dropped();
+    if (dropped != self->reported_dropped) {
+      Serial.printf("[log] %lu messages dropped\n", (unsigned long)(dropped - self->reported_dropped));
+      self->reported_dropped = dropped;
+    }
+    vTaskDelay(pdMS_TO_TICKS(LOG_DRAIN_PERIOD_MS));
+  }
+}
@@ -0,0 +1,137 @@
+// ----------------------------------------------------------------------
+//
+//   Non-blocking logger for ESP32 devices
+//
+//   Copyright (C) 2022  Shoestring and University of Cambridge
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, version 3 of the License.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see https://www.gnu.org/licenses/.
+//
+// ----------------------------------------------------------------------
+
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <Arduino.h>
+#include <atomic>
+
+/**********************************************************
+ * Leveled logging that never blocks the caller.
+ *
+ * LOG_xxx() formats the message straight into a slot of a
+ * lock-free ring buffer and returns. A low priority task
+ * drains the ring to Serial in the background. If the ring
+ * is full the message is dropped and counted instead of
+ * waiting, so the sampling and analysis loops never stall
+ * on the UART.
+ *
+ * Levels above LOG_LEVEL are compiled out completely, so
+ * debug timing lines cost nothing in a release build.
+ *
+ * Not for use from ISRs (uses vsnprintf).
+ **/
+
+#define LOG_LEVEL_NONE 0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_INFO 3
+#define LOG_LEVEL_DEBUG 4
+
+// #define LOG_LEVEL LOG_LEVEL_DEBUG
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
+#define LOG_BAUD 115200
+#define LOG_RING_SLOTS 32  // must be a power of 2
+#define LOG_LINE_LENGTH 120
+#define LOG_DRAIN_PERIOD_MS 20
+#define LOG_DRAIN_STACK 3072
+
+class LogRateLimit {
+public:
+  // true at most once per interval_ms for this call site
+  bool allow(uint32_t interval_ms);
+
+private:
+  bool first = true;
+  uint32_t last = 0;
+};
+
+class Logger {
+public:
+  Logger();
+  void begin(unsigned long baud = LOG_BAUD);
+  void write(uint8_t level, const char* format, ...) __attribute__((format(printf, 3, 4)));
+
+  uint32_t dropped() { return n_dropped.load(std::memory_order_relaxed); }
+  uint32_t rate_limited() { return n_rate_limited.load(std::memory_order_relaxed); }
+  void count_rate_limited() { n_rate_limited.fetch_add(1, std::memory_order_relaxed); }
+
+private:
+  struct Slot {
+    std::atomic<uint32_t> sequence;
+    uint8_t level;
+    uint32_t timestamp;
+    char text[LOG_LINE_LENGTH];
+  };
+
+  Slot slots[LOG_RING_SLOTS];
+  std::atomic<uint32_t> head;
+  uint32_t tail = 0;
+  std::atomic<uint32_t> n_dropped;
+  std::atomic<uint32_t> n_rate_limited;
+  uint32_t reported_dropped = 0;
+  bool started = false;
+
+  static void drain_task(void* pvParameters);
+  bool drain_one();
+};
+
+extern Logger logger;
+
+#if LOG_LEVEL >= LOG_LEVEL_ERROR
+#define LOG_ERROR(...) logger.write(LOG_LEVEL_ERROR, __VA_ARGS__)
+#else
+#define LOG_ERROR(...) do {} while (0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_WARN
+#define LOG_WARN(...) logger.write(LOG_LEVEL_WARN, __VA_ARGS__)
+#else
+#define LOG_WARN(...) do {} while (0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_INFO
+#define LOG_INFO(...) logger.write(LOG_LEVEL_INFO, __VA_ARGS__)
+#else
+#define LOG_INFO(...) do {} while (0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(...) logger.write(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#else
+#define LOG_DEBUG(...) do {} while (0)
+#endif
+
+// e.g. LOG_EVERY_MS(1000, LOG_WARN, "Buffer Full");
+#define LOG_EVERY_MS(interval_ms, log_macro, ...) \
+  do { \
+    static LogRateLimit _log_limit; \
+    if (_log_limit.allow(interval_ms)) { \
+      log_macro(__VA_ARGS__); \
+    } else { \
+      logger.count_rate_limited(); \
+    } \
+  } while (0)
+
+#endif
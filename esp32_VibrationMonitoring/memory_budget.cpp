@@ -0,0 +1,75 @@
+// ----------------------------------------------------------------------
+//
+//   Memory budget for ESP32 devices
+//
+//   Copyright (C) 2022  Shoestring and University of Cambridge
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, version 3 of the License.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see https://www.gnu.org/licenses/.
+//
+// ----------------------------------------------------------------------
+
+#include "memory_budget.h"
+#include "logger.h"
+
+// defined by the sketch with ARENA_DEFINE()
+extern uint8_t memory_arena[];
+extern const size_t memory_arena_size;
+
+MemoryBudget memory_budget;
+
+void *MemoryBudget::take(size_t bytes, const char *name) {
+  size_t size = arena_bytes(bytes);
+  if (used + size > memory_arena_size) {
+    LOG_ERROR("Arena: no room for %s (%u bytes, %u of %u used) - add it to ARENA_DEFINE()",
+              name, (unsigned)size, (unsigned)used, (unsigned)memory_arena_size);
+    delay(100);  // let the logger drain
+    abort();
+  }
+  void *block = memory_arena + used;
+  used += size;
+  LOG_INFO("Arena: %s %u bytes", name, (unsigned)size);
+  return block;
+}
+
+void MemoryBudget::watch_stack(const char *name, TaskHandle_t task, uint32_t size) {
+  if (task == NULL || n_stacks >= STACK_WATCH_MAX) {
+    return;
+  }
+  stacks[n_stacks++] = { name, task, size };
+}
+
+void MemoryBudget::log_summary() {
+  LOG_INFO("Arena: %u of %u bytes used, limit %u", (unsigned)used, (unsigned)memory_arena_size,
+           (unsigned)ARENA_MAX_BYTES);
+}
+
+void MemoryBudget::report(JsonObject out) {
+  out["arena"] = memory_arena_size;
+  out["arena_used"] = used;
+  out["heap_free"] = ESP.getFreeHeap();
+  out["heap_min"] = ESP.getMinFreeHeap();
+  out["heap_max_block"] = ESP.getMaxAllocHeap();
+
+  JsonObject section = out.createNestedObject("stacks");
+  for (uint8_t i = 0; i < n_stacks; i++) {
+    // in bytes on the ESP32, where a stack word is a byte
+    uint32_t free_min = uxTaskGetStackHighWaterMark(stacks[i].task);
+    JsonObject stack = section.createNestedObject(stacks[i].name);
+    stack["size"] = stacks[i].size;
+    stack["free_min"] = free_min;
+    if (free_min < STACK_LOW_BYTES) {
+      LOG_WARN("Task %s stack low: %u of %u bytes never used", stacks[i].name, (unsigned)free_min,
+               (unsigned)stacks[i].size);
+    }
+  }
+}
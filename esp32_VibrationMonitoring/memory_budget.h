@@ -0,0 +1,103 @@
+// ----------------------------------------------------------------------
+//
+//   Memory budget for ESP32 devices
+//
+//   Copyright (C) 2022  Shoestring and University of Cambridge
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, version 3 of the License.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see https://www.gnu.org/licenses/.
+//
+// ----------------------------------------------------------------------
+
+#ifndef MEMORY_BUDGET_H
+#define MEMORY_BUDGET_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <new>
+
+/**********************************************************
+ * One statically sized arena for the analysis and network
+ * buffers, and a watch on every task's stack.
+ *
+ * Each module publishes what it takes from the arena as a
+ * constant (SHOESTRING_ARENA_BYTES, ZOOM_ARENA_BYTES,
+ * DATA_ARENA_BYTES, DECIMATOR_ARENA_BYTES...) and the
+ * sketch adds them to its own buffers in ARENA_DEFINE().
+ * The total is checked against ARENA_MAX_BYTES when the
+ * sketch compiles, so a bigger frame or FFT that does not
+ * fit in internal RAM fails the build instead of the heap.
+ *
+ * The arena is in .bss (internal RAM), is carved up during
+ * setup() and never freed. Every block is logged as it is
+ * taken; taking more than the budget means a module's share
+ * is missing from ARENA_DEFINE() - that is logged and the
+ * device restarts.
+ *
+ * Tasks register their stacks with watch_stack() once they
+ * are created. The metrics show the least free stack each
+ * task has had, which is what the stack sizes are trimmed
+ * from:
+ *
+ *   "memory": {"arena": 47152, "arena_used": 38960,
+ *              "heap_free": 181220, "heap_min": 176004, "heap_max_block": 110580,
+ *              "stacks": {"Task2": {"size": 12288, "free_min": 6140}, ...}}
+ **/
+
+#define ARENA_ALIGN 16  // the esp-dsp kernels want 16 byte aligned operands
+#define ARENA_MAX_BYTES (96 * 1024)  // internal RAM set aside for buffers
+#define STACK_WATCH_MAX 8
+#define STACK_LOW_BYTES 1024  // warn when a task has had less free stack than this
+
+// bytes a buffer takes from the arena, padding included
+constexpr size_t arena_bytes(size_t bytes) {
+  return (bytes + ARENA_ALIGN - 1) / ARENA_ALIGN * ARENA_ALIGN;
+}
+
+// the arena itself, sized by the sketch - use once, at file scope
+#define ARENA_DEFINE(bytes) \
+  static_assert((bytes) <= ARENA_MAX_BYTES, "buffers exceed ARENA_MAX_BYTES, see memory_budget.h"); \
+  alignas(ARENA_ALIGN) uint8_t memory_arena[(bytes)]; \
+  extern const size_t memory_arena_size = (bytes)
+
+class MemoryBudget {
+public:
+  // setup() only, not thread safe
+  void *take(size_t bytes, const char *name);
+  template<typename T>
+  T *take_array(size_t count, const char *name) {
+    return (T *)take(sizeof(T) * count, name);
+  }
+  template<typename T>
+  T *create(const char *name) {
+    return new (take(sizeof(T), name)) T();
+  }
+
+  void watch_stack(const char *name, TaskHandle_t task, uint32_t size);
+  void log_summary();
+  void report(JsonObject out);
+
+private:
+  size_t used = 0;
+
+  struct Stack {
+    const char *name;
+    TaskHandle_t task;
+    uint32_t size;
+  };
+  Stack stacks[STACK_WATCH_MAX];
+  uint8_t n_stacks = 0;
+};
+
+extern MemoryBudget memory_budget;
+
+#endif
@@ -0,0 +1,52 @@
+// ----------------------------------------------------------------------
+//
+//   Order tracking for ESP32 devices
+//
+//   Copyright (C) 2022  Shoestring and University of Cambridge
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, version 3 of the License.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see https://www.gnu.org/licenses/.
+//
+// ----------------------------------------------------------------------
+
+#include "order_tracking.h"
+
+// Catmull-Rom between x[i] and x[i + 1], the ends held
+static float interpolate(const float *x, uint16_t n, float position) {
+  int i = (int)floorf(position);
+  float f = position - i;
+  float p0 = x[constrain(i - 1, 0, n - 1)];
+  float p1 = x[constrain(i, 0, n - 1)];
+  float p2 = x[constrain(i + 1, 0, n - 1)];
+  float p3 = x[constrain(i + 2, 0, n - 1)];
+  return p1 + 0.5f * f * (p2 - p0 + f * (2 * p0 - 5 * p1 + 4 * p2 - p3 + f * (3 * (p1 - p2) + p3 - p0)));
+}
+
+float order_resample(const float *x, uint16_t n, float period_us, const float *pulses, uint16_t n_pulses,
+                     uint8_t ppr, float *out, uint16_t m) {
+  if (n_pulses < 2) {
+    return 0;
+  }
+  float revs = (n_pulses - 1) / (float)ppr;
+  if (revs < ORDER_MIN_REVS) {
+    return 0;
+  }
+  // step in pulse intervals, so point k is at k * step intervals after the first pulse
+  float step = (n_pulses - 1) / (float)m;
+  for (uint16_t k = 0; k < m; k++) {
+    float angle = k * step;
+    uint16_t j = min((uint16_t)angle, (uint16_t)(n_pulses - 2));
+    float t = pulses[j] + (angle - j) * (pulses[j + 1] - pulses[j]);
+    out[k] = interpolate(x, n, t / period_us);
+  }
+  return revs;
+}
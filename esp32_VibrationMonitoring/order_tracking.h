@@ -0,0 +1,63 @@
+// ----------------------------------------------------------------------
+//
+//   Order tracking for ESP32 devices
+//
+//   Copyright (C) 2022  Shoestring and University of Cambridge
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, version 3 of the License.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see https://www.gnu.org/licenses/.
+//
+// ----------------------------------------------------------------------
+
+#ifndef ORDER_TRACKING_H
+#define ORDER_TRACKING_H
+
+#include <Arduino.h>
+#include "tach.h"
+
+/**********************************************************
+ * Computed order tracking: a buffer resampled at equal
+ * steps of shaft angle instead of time, so a line that
+ * follows the running speed stays in one FFT bin while the
+ * speed changes, where a fixed-Hz band smears it.
+ *
+ * The shaft angle is taken as turning at a steady speed
+ * between two tach pulses (1 / ppr of a turn each). The
+ * angle from the first to the last pulse in the buffer is
+ * split into m equal steps and the signal is read at each
+ * step's time by cubic (Catmull-Rom) interpolation. Over
+ * the same buffer the angle steps always come faster than
+ * the samples did, so nothing aliases.
+ *
+ * The FFT of the m resampled points has its bins at
+ *
+ *   order = bin / revs
+ *
+ * so the resolution is 1 / revs orders and the highest
+ * order m / (2 revs). The frame gets bands of one order
+ * around each whole order, in the magnitude units of "fft":
+ *
+ *   "orders": {"rpm": 1493.2, "revs": 84.6, "resolution": 0.0118,
+ *              "peak_order": 1.002, "bands": [{"order": 1, "magnitude": 270.3}, ...]}
+ **/
+
+#define ORDER_MIN_REVS 4  // fewer turns in a buffer and there is no order spectrum
+#define ORDER_BANDS 10
+#define ORDER_ARENA_BYTES arena_bytes(sizeof(float) * TACH_MAX_PULSES)
+
+// x holds n samples period_us apart, pulses the edge times (ascending, in us from
+// x[0]), ppr per turn. Writes m points into out and returns the turns they cover,
+// 0 if that is less than ORDER_MIN_REVS.
+float order_resample(const float *x, uint16_t n, float period_us, const float *pulses, uint16_t n_pulses,
+                     uint8_t ppr, float *out, uint16_t m);
+
+#endif
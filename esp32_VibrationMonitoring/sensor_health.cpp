@@ -0,0 +1,148 @@
+// ----------------------------------------------------------------------
+//
+//   Accelerometer health checks for ESP32 devices
+//
+//   Copyright (C) 2022  Shoestring and University of Cambridge
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, version 3 of the License.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see https://www.gnu.org/licenses/.
+//
+// ----------------------------------------------------------------------
+
+#include "sensor_health.h"
+#include "logger.h"
+
+SensorHealth health;
+
+static float full_scale(range_t range) {
+  return (2 << range) * SENSORS_GRAVITY_STANDARD;
+}
+
+void SensorHealth::begin(uint8_t channels, uint8_t range_g) {
+  n_channels = min(channels, (uint8_t)ACCEL_MAX_CHANNELS);
+  automatic = range_g == 0;
+  range_t start = ADXL345_RANGE_16_G;
+  switch (range_g) {
+    case 0: start = ADXL345_RANGE_2_G; break;  // automatic, only ever goes up
+    case 2: start = ADXL345_RANGE_2_G; break;
+    case 4: start = ADXL345_RANGE_4_G; break;
+    case 8: start = ADXL345_RANGE_8_G; break;
+  }
+  for (uint8_t c = 0; c < ACCEL_MAX_CHANNELS; c++) {
+    memset(&filling[c], 0, sizeof(Reads));
+    memset(&finished[c], 0, sizeof(Reads));
+    range[c] = start;
+    wanted[c] = start;
+    range_changes[c] = 0;
+    clipped_frames[c] = 0;
+    stuck_frames[c] = 0;
+    dropout_frames[c] = 0;
+  }
+  if (automatic) {
+    LOG_INFO("Accelerometer range automatic, starting at %ug", 2 << start);
+  } else {
+    LOG_INFO("Accelerometer range %ug", 2 << start);
+  }
+}
+
+void SensorHealth::frame_start(AccelSensor **channels) {
+  for (uint8_t c = 0; c < n_channels; c++) {
+    range_t next = wanted[c];
+    if (next != range[c]) {
+      channels[c]->set_range(next);
+      range[c] = next;
+      range_changes[c]++;
+    }
+  }
+}
+
+void SensorHealth::push(uint8_t channel, bool ok, float x, float y, float z) {
+  Reads &r = filling[channel];
+  r.reads++;
+  if (!ok) {
+    r.dropouts++;
+    return;
+  }
+  float largest = max(fabsf(x), max(fabsf(y), fabsf(z)));
+  r.peak = max(r.peak, largest);
+  if (largest >= HEALTH_CLIP_FRACTION * full_scale(range[channel])) {
+    r.clipped++;
+  }
+  if (x == r.last[0] && y == r.last[1] && z == r.last[2]) {
+    r.run++;
+    r.longest_run = max(r.longest_run, r.run);
+  } else {
+    r.run = 1;
+  }
+  r.last[0] = x;
+  r.last[1] = y;
+  r.last[2] = z;
+}
+
+void SensorHealth::frame_done() {
+  for (uint8_t c = 0; c < n_channels; c++) {
+    finished[c] = filling[c];
+    memset(&filling[c], 0, sizeof(Reads));
+  }
+}
+
+void SensorHealth::check(uint8_t channel, JsonDocument &frame) {
+  const Reads &r = finished[channel];
+  bool clipped = r.clipped > 0;
+  bool stuck = r.longest_run >= HEALTH_STUCK_READS;
+  bool dropout = r.dropouts > 0;
+  clipped_frames[channel] += clipped;
+  stuck_frames[channel] += stuck;
+  dropout_frames[channel] += dropout;
+
+  String flags;
+  if (clipped) {
+    flags += ",clipped";
+  }
+  if (stuck) {
+    flags += ",stuck";
+  }
+  if (dropout) {
+    flags += ",dropout";
+  }
+  String quality = "ok";
+  if (flags.length() > 0) {
+    quality = flags.substring(1);
+    LOG_EVERY_MS(10000, LOG_WARN, "Channel %u frame %s", channel, quality.c_str());
+  }
+  frame["range_g"] = 2 << range[channel];
+  frame["peak_g"] = r.peak / SENSORS_GRAVITY_STANDARD;
+  frame["quality"] = quality;
+
+  // a stuck or silent sensor says nothing about the range it needs
+  if (!automatic || stuck || r.reads == r.dropouts) {
+    return;
+  }
+  range_t now = range[channel];
+  if (now < ADXL345_RANGE_16_G && (clipped || r.peak >= HEALTH_UP_FRACTION * full_scale(now))) {
+    wanted[channel] = (range_t)(now + 1);
+    LOG_INFO("Channel %u peaked at %.2fg, range up to %ug", channel, r.peak / SENSORS_GRAVITY_STANDARD, 4 << now);
+  }
+}
+
+void SensorHealth::report(JsonObject out) {
+  out["automatic"] = automatic;
+  JsonArray channels = out.createNestedArray("channels");
+  for (uint8_t c = 0; c < n_channels; c++) {
+    JsonObject channel = channels.createNestedObject();
+    channel["range_g"] = 2 << range[c];
+    channel["range_changes"] = range_changes[c];
+    channel["clipped_frames"] = clipped_frames[c];
+    channel["stuck_frames"] = stuck_frames[c];
+    channel["dropout_frames"] = dropout_frames[c];
+  }
+}
@@ -0,0 +1,107 @@
+// ----------------------------------------------------------------------
+//
+//   Accelerometer health checks for ESP32 devices
+//
+//   Copyright (C) 2022  Shoestring and University of Cambridge
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, version 3 of the License.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see https://www.gnu.org/licenses/.
+//
+// ----------------------------------------------------------------------
+
+#ifndef SENSOR_HEALTH_H
+#define SENSOR_HEALTH_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include "accel_sensor.h"
+
+/**********************************************************
+ * Checks on the raw reads behind every frame, and the
+ * accelerometer range chosen from them.
+ *
+ * The sampler passes each read of each channel to push()
+ * while a buffer fills. A frame is flagged
+ *
+ *   clipped  an axis reached HEALTH_CLIP_FRACTION of the
+ *            range - the spectrum is distorted
+ *   stuck    HEALTH_STUCK_READS identical x,y,z reads in a
+ *            row - a live sensor always shows some noise
+ *   dropout  reads failed and the last sample was held
+ *
+ * "accel_range_g" fixes the range (2, 4, 8 or 16 g), or 0
+ * ranges automatically: start at 2g and go up a range as
+ * soon as a frame clips or peaks above HEALTH_UP_FRACTION of
+ * full scale. It never comes back down. In full resolution
+ * mode the ADXL345 keeps its 4mg step on every range, so a
+ * lower range would give up headroom and gain nothing - the
+ * range only has to stay clear of the largest peak seen so
+ * far. A change is made by the sampler before the first read
+ * of the next buffer, so no frame mixes two ranges.
+ *
+ * check() adds to each frame:
+ *
+ *   "range_g": 4, "peak_g": 2.31, "quality": "ok"  (or e.g. "clipped,dropout")
+ *
+ * Everything is counted from the reads alone, so a replay
+ * of the same signal always gives the same flags.
+ **/
+
+#define HEALTH_CLIP_FRACTION 0.99
+#define HEALTH_STUCK_READS 64
+#define HEALTH_UP_FRACTION 0.8
+
+class SensorHealth {
+public:
+  // range_g: 2, 4, 8 or 16, 0 = automatic
+  void begin(uint8_t n_channels, uint8_t range_g);
+  range_t get_range(uint8_t channel) { return range[channel]; }
+
+  // sampling task: before the first read of a buffer, makes any range change that is due
+  void frame_start(AccelSensor **channels);
+  void push(uint8_t channel, bool ok, float x, float y, float z);
+  // sampling task: the buffer is full, its reads are ready for check()
+  void frame_done();
+
+  // analysis: flags the finished frame of channel and picks the range for its next one.
+  // Call before the buffers are released.
+  void check(uint8_t channel, JsonDocument &frame);
+  void report(JsonObject out);
+
+private:
+  struct Reads {
+    uint32_t reads;
+    uint32_t dropouts;
+    uint32_t clipped;
+    uint32_t run;  // identical reads so far
+    uint32_t longest_run;
+    float last[3];
+    float peak;  // m/s^2, largest axis
+  };
+
+  uint8_t n_channels = 0;
+  bool automatic = false;
+  Reads filling[ACCEL_MAX_CHANNELS];
+  Reads finished[ACCEL_MAX_CHANNELS];
+  range_t range[ACCEL_MAX_CHANNELS];
+  volatile range_t wanted[ACCEL_MAX_CHANNELS];  // set by check(), applied by frame_start()
+
+  // metrics
+  uint32_t range_changes[ACCEL_MAX_CHANNELS];
+  uint32_t clipped_frames[ACCEL_MAX_CHANNELS];
+  uint32_t stuck_frames[ACCEL_MAX_CHANNELS];
+  uint32_t dropout_frames[ACCEL_MAX_CHANNELS];
+};
+
+extern SensorHealth health;
+
+#endif
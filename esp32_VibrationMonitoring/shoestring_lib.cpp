@@ -1,13 +1,13 @@
 #include "shoestring_lib.h"
+#include "logger.h"
+#include "boot_profiler.h"
+#include <esp_sntp.h>
 
 
 // General Variables
 const char* ntpServer = "pool.ntp.org";
 unsigned long lastTriggerTime;
 
-#define I2C2_SDA_PIN 16
-#define I2C2_SCL_PIN 15
-
 WiFiClient espClient;
 PubSubClient client(espClient);
 ConfigDisplay display;
@@ -15,8 +15,9 @@ bool include_timestamp = false;
 
 
 void ShoestringLib::setup() {
-  //set up serial communication
-  Serial.begin(115200);
+  //set up serial communication - all output goes through the non-blocking logger
+  logger.begin(LOG_BAUD);
+  boot_profiler.phase_done("serial");
 #ifdef WAIT_FOR_SERIAL
   while (true) {
     if (Serial.available() >= 2) {
@@ -30,8 +31,9 @@ void ShoestringLib::setup() {
     }
   }
 #endif
-  Serial.println("+++++++++++START+++++++++++");
+  LOG_INFO("+++++++++++START+++++++++++");
   display.initialise();
+  boot_profiler.phase_done("display");
 
   //set up config manager
   cm.register_item(ConfigItem("mqtt_url", "127.0.0.1"));
@@ -39,20 +41,54 @@ void ShoestringLib::setup() {
   cm.register_item(ConfigItem("mqtt_topic", "vibration_monitoring"));
   cm.register_item(ConfigItem("identifier", "machine_1"));
   cm.register_item(ConfigItem("incl_tstamp", "true"));
+  cm.register_item(ConfigItem("static_ip", ""));  // blank for DHCP
+  cm.register_item(ConfigItem("gateway", ""));
+  cm.register_item(ConfigItem("subnet", ""));
+  cm.register_item(ConfigItem("dns", ""));
+  cm.load();
+  cm.add_change_listener([this]() {
+    include_timestamp = cm.getString("incl_tstamp").equalsIgnoreCase("true");
+  });
+  boot_profiler.phase_done("config");
 
-  // set up wifi using wifi manager
-  WifiManager wm(&cm);
-  wm.setup();
+  // set up wifi using wifi manager - connects in the background
+  wm.begin();
+  boot_profiler.phase_done("wifi_start");
 
-  // set up time
-  
+  // set up time - SNTP syncs in the background once the network is up
+  sntp_set_time_sync_notification_cb([](struct timeval *tv) {
+    boot_profiler.milestone("time_synced");
+  });
   configTime(0, 0, ntpServer);
-  printLocalTime();
   lastTriggerTime = 0;
 
-  // setup client
-  client.setBufferSize(4000);
+  // setup client - the analysis loop's documents and buffers live in the arena, not on Task2's stack
+  frame_doc = memory_budget.create<FrameDocument>("frame_doc");
+  frame_message = memory_budget.take_array<char>(FRAME_MESSAGE_SIZE, "frame_message");
+  metrics_doc = memory_budget.create<MetricsDocument>("metrics_doc");
+  metrics_message = memory_budget.take_array<char>(METRICS_MESSAGE_SIZE, "metrics_message");
+  client.setBufferSize(MQTT_BUFFER_SIZE);
+  client.setCallback([this](char *topic, uint8_t *payload, unsigned int length) {
+    on_message(topic, payload, length);
+  });
   include_timestamp = cm.getString("incl_tstamp").equalsIgnoreCase("true");
+  add_metrics_hook("boot", [](JsonObject out) {
+    boot_profiler.report(out);
+  });
+  add_metrics_hook("config", [this](JsonObject out) {
+    const ConfigStore &store = cm.get_store();
+    out["version"] = store.version;
+    out["crc_ok"] = store.crc_ok;
+    out["commits"] = store.commits;
+    out["last_changed"] = store.last_changed;
+  });
+  add_metrics_hook("memory", [this](JsonObject out) {
+    memory_budget.report(out);
+    out["frame_json_max"] = frame_json_max;
+    out["frame_max"] = frame_message_max;
+    out["frames_refused"] = frames_refused;
+  });
+  boot_profiler.phase_done("mqtt_setup");
 }
 
 void ShoestringLib::reconnect() {
@@ -62,22 +98,28 @@ void ShoestringLib::reconnect() {
     current_mqtt_server_port = cm.getInt("mqtt_port");
     display.setMQTTIP(current_mqtt_server_addr+":"+current_mqtt_server_port);
     client.setServer(current_mqtt_server_addr.c_str(), current_mqtt_server_port);
-    Serial.println("Attempting MQTT connection to " + current_mqtt_server_addr + ":" + current_mqtt_server_port + "...");
-    mqttConnectTimestamp = now - 16000;  //force retry
+    LOG_INFO("Attempting MQTT connection to %s:%d...", current_mqtt_server_addr.c_str(), current_mqtt_server_port);
+    mqttConnectTimestamp = now - MQTT_RETRY_MAX_MS - 1;  //force retry
+    mqtt_retry_ms = MQTT_RETRY_MIN_MS;
   }
 
-  if (now - mqttConnectTimestamp > 15000) {
+  if (now - mqttConnectTimestamp > mqtt_retry_ms) {
     display.setMQTTStatus("Connecting...");
     const String status_topic = "status/"+cm.getString("identifier")+"/alive";
     if (client.connect(cm.getString("identifier").c_str(),status_topic.c_str(),1,true,"{\"connected\":false}")) {  //todo randomise
-      Serial.println("ONLINE");
+      LOG_INFO("MQTT ONLINE");
+      boot_profiler.milestone("mqtt_connected");
+      mqtt_retry_ms = MQTT_RETRY_MIN_MS;
       display.setMQTTStatus("Connected");
       const char* connected_message = "{\"connected\":true}";
       client.publish(status_topic.c_str(),connected_message,true);
+      for (auto &hook : command_hooks) {
+        client.subscribe(("cmd/" + cm.getString("identifier") + "/" + hook.first).c_str());
+      }
     } else {
-      Serial.print("failed, rc=");
-      Serial.print(client.state());
-      Serial.println(" try again in 15 seconds");
+      // back off quickly from 1s so a broker that is still starting up is picked up early
+      mqtt_retry_ms = min(mqtt_retry_ms * 2, (long)MQTT_RETRY_MAX_MS);
+      LOG_WARN("MQTT failed, rc=%d try again in %ld seconds", client.state(), mqtt_retry_ms / 1000);
       display.setMQTTStatus("Failed");
     }
     mqttConnectTimestamp = now;
@@ -85,54 +127,146 @@ void ShoestringLib::reconnect() {
 }
 
 void ShoestringLib::loop() {
-  
-  cm.step_loop();
-  if (!client.connected()) {
-    reconnect();
+  // the config web server is served from the wifi manager's task
+  bool online = wm.is_connected() && client.connected();
+  if (!online) {
+    if (wm.is_connected()) {
+      reconnect();
+    }
     delay(29);
   } else {
     client.loop();
+    if (millis() - metricsTimestamp > METRICS_PERIOD_MS) {
+      publish_metrics();
+    }
+  }
 
-    StaticJsonDocument<3000> JSONdoc;
-    bool result = this->callback(JSONdoc);
+  // analysis keeps running while offline so the display stays live
+  FrameDocument &JSONdoc = *frame_doc;
+  JSONdoc.clear();
+  bool result = this->callback(JSONdoc);
 
-    if (result) {    
-      int start_2 = millis();
+  if (result) {
+    int start_2 = millis();
 
-      if(include_timestamp){
-        get_timestamp();
-        JSONdoc["timestamp"] = String(timestamp_buffer);
-      } else {
-        JSONdoc["timestamp"] = "not_included";
-      }
-      JSONdoc["id"] = cm.getString("identifier");
-      
-      // print to serial
-      // serializeJson(JSONdoc, Serial);
-      // Serial.println();
-      // Serial.print("Size of payload: ");
-      // Serial.println(sizeof(JSONdoc));
-
-      //send over MQTT
-      char JSONmessageBuffer[4000];
-      serializeJson(JSONdoc, JSONmessageBuffer, sizeof(JSONmessageBuffer));
-      String topic = cm.getString("mqtt_topic") + "/" + cm.getString("identifier");
-      client.publish(topic.c_str(), JSONmessageBuffer);
-
-      int total_2 = millis()-start_2;
-      Serial.print("Send MQTT took: ");
-      Serial.println(total_2);
+    if(include_timestamp){
+      get_timestamp();
+      JSONdoc["timestamp"] = String(timestamp_buffer);
+    } else {
+      JSONdoc["timestamp"] = "not_included";
     }
+    JSONdoc["id"] = cm.getString("identifier");
+    
+    // print to serial
+    // serializeJson(JSONdoc, Serial);
+    // Serial.println();
+    // Serial.print("Size of payload: ");
+    // Serial.println(sizeof(JSONdoc));
+
+    // serialised even while offline, the local data pages still want it
+    frame_json_max = max(frame_json_max, JSONdoc.memoryUsage());
+    size_t length = measureJson(JSONdoc);
+    frame_message_max = max(frame_message_max, length);
+    // a frame with fields missing or one PubSubClient would drop is refused here, for the local pages too
+    if (JSONdoc.overflowed()) {
+      frames_refused++;
+      LOG_EVERY_MS(10000, LOG_ERROR, "Frame larger than FRAME_JSON_CAPACITY - not published");
+      return;
+    }
+    if (length >= FRAME_MESSAGE_SIZE) {
+      frames_refused++;
+      LOG_EVERY_MS(10000, LOG_ERROR, "Frame of %u bytes larger than FRAME_MESSAGE_SIZE - not published", (unsigned)length);
+      return;
+    }
+    serializeJson(JSONdoc, frame_message, FRAME_MESSAGE_SIZE);
+    for (auto &hook : frame_hooks) {
+      hook(frame_message, length);
+    }
+    if (!online) {
+      LOG_EVERY_MS(10000, LOG_WARN, "Offline - frame not published");
+      return;
+    }
+
+    //send over MQTT
+    String topic = cm.getString("mqtt_topic") + "/" + cm.getString("identifier");
+    if (topic.length() + 7 + length > MQTT_BUFFER_SIZE) {
+      frames_refused++;
+      LOG_EVERY_MS(10000, LOG_ERROR, "Topic %s too long for MQTT_HEADER_ROOM - frame not published", topic.c_str());
+      return;
+    }
+    client.publish(topic.c_str(), frame_message);
+    if (!boot_profiler.reached("first_frame")) {
+      boot_profiler.milestone("first_frame");
+      boot_profiler.log_summary();
+    }
+
+    int total_2 = millis()-start_2;
+    LOG_DEBUG("Send MQTT took: %d", total_2);
   }
   // yield();
   
 }
 
+void ShoestringLib::publish_metrics() {
+  MetricsDocument &doc = *metrics_doc;
+  doc.clear();
+  doc["uptime_ms"] = millis();
+
+  WifiMetrics wifi = wm.get_metrics();
+  JsonObject wifi_section = doc.createNestedObject("wifi");
+  wifi_section["connects"] = wifi.connects;
+  wifi_section["disconnects"] = wifi.disconnects;
+  wifi_section["fast_connects"] = wifi.fast_connects;
+  wifi_section["fast_misses"] = wifi.fast_misses;
+  wifi_section["last_connect_ms"] = wifi.last_connect_ms;
+  wifi_section["max_connect_ms"] = wifi.max_connect_ms;
+  wifi_section["mean_connect_ms"] = wifi.connects ? wifi.total_connect_ms / wifi.connects : 0;
+  wifi_section["rssi"] = WiFi.RSSI();
+
+  for (auto &hook : metrics_hooks) {
+    hook.second(doc.createNestedObject(hook.first));
+  }
+
+  serializeJson(doc, metrics_message, METRICS_MESSAGE_SIZE);
+  String topic = "status/" + cm.getString("identifier") + "/metrics";
+  client.publish(topic.c_str(), metrics_message);
+  metricsTimestamp = millis();
+}
+
+
+bool ShoestringLib::publish(const String &subtopic, const char *payload) {
+  if (!wm.is_connected() || !client.connected()) {
+    return false;
+  }
+  String topic = cm.getString("mqtt_topic") + "/" + cm.getString("identifier") + "/" + subtopic;
+  return client.publish(topic.c_str(), payload);
+}
+
+
+void ShoestringLib::on_message(char *topic, uint8_t *payload, unsigned int length) {
+  String prefix = "cmd/" + cm.getString("identifier") + "/";
+  String name = String(topic);
+  if (!name.startsWith(prefix)) {
+    return;
+  }
+  name = name.substring(prefix.length());
+  String body;
+  body.reserve(length);
+  for (unsigned int i = 0; i < length; i++) {
+    body += (char)payload[i];
+  }
+  for (auto &hook : command_hooks) {
+    if (hook.first == name) {
+      LOG_INFO("Command %s", name.c_str());
+      hook.second(body);
+    }
+  }
+}
+
 
 void ShoestringLib::printLocalTime() {
   get_timestamp();
-  Serial.print("Time > ");
-  Serial.println(timestamp_buffer);
+  LOG_INFO("Time > %s", timestamp_buffer);
 }
 
 void ShoestringLib::get_timestamp() {
@@ -140,8 +274,9 @@ void ShoestringLib::get_timestamp() {
   struct timeval tv; 
   char ms_buffer[10];
 
-  if (!getLocalTime(&timeinfo)) {
-    Serial.println("Failed to obtain time");
+  if (!getLocalTime(&timeinfo, 0)) {  // never wait for SNTP here
+    LOG_EVERY_MS(10000, LOG_WARN, "Failed to obtain time");
+    strcpy(timestamp_buffer, "not_synced");
     return;
   }
   gettimeofday(&tv, NULL);
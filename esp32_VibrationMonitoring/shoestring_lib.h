@@ -11,6 +11,7 @@
 #include <ArduinoJson.h>
 #include <WiFi.h>
 #include <Wire.h>
+#include "memory_budget.h"
 
 class MapEntry {
   public:
@@ -29,14 +30,61 @@ class OutputMap {
     std::vector<MapEntry> items = {};
 };
 
+#define METRICS_PERIOD_MS 60000
+#define MQTT_RETRY_MIN_MS 1000
+#define MQTT_RETRY_MAX_MS 15000
+
+// frame and metrics buffers, taken from the arena by setup()
+#define MQTT_BUFFER_SIZE 4000  // PubSubClient's packet buffer, fixed header, topic and payload together
+#define MQTT_HEADER_ROOM 96    // fixed header (5), topic length (2) and a topic of up to 89 characters
+#define FRAME_JSON_CAPACITY 4096
+#define FRAME_MESSAGE_SIZE (MQTT_BUFFER_SIZE - MQTT_HEADER_ROOM)  // largest frame that can be published
+#define FRAME_TAIL_BYTES 128   // left by the loop hook for the timestamp and id that loop() adds
+#define METRICS_JSON_CAPACITY 2048
+#define METRICS_MESSAGE_SIZE 2048
+
+typedef StaticJsonDocument<FRAME_JSON_CAPACITY> FrameDocument;
+typedef StaticJsonDocument<METRICS_JSON_CAPACITY> MetricsDocument;
+
+#define SHOESTRING_ARENA_BYTES \
+  (arena_bytes(sizeof(FrameDocument)) + arena_bytes(FRAME_MESSAGE_SIZE) \
+   + arena_bytes(sizeof(MetricsDocument)) + arena_bytes(METRICS_MESSAGE_SIZE))
+
 class ShoestringLib {
 public:
-  ShoestringLib(){};
+  ShoestringLib():wm(&cm){};
   void setup();
   void loop();
-  void set_loop_hook(std::function<bool(ArduinoJson::StaticJsonDocument<3000>&)> callback) {
+  void set_loop_hook(std::function<bool(FrameDocument&)> callback) {
     this->callback = callback;
   };
+  // each hook fills in its own section of the periodic status/<identifier>/metrics message
+  void add_metrics_hook(String section, std::function<void(JsonObject)> hook) {
+    this->metrics_hooks.push_back(std::make_pair(section, hook));
+  };
+  // each hook handles the messages on cmd/<identifier>/<name>, called from Task2
+  void add_command_hook(String name, std::function<void(const String&)> hook) {
+    this->command_hooks.push_back(std::make_pair(name, hook));
+  };
+  // each hook sees every serialised frame, online or not, called from Task2 - the message is reused for the next frame
+  void add_frame_hook(std::function<void(const char*, size_t)> hook) {
+    this->frame_hooks.push_back(hook);
+  };
+  // read-only pages on the config web server, served from the wifi task - register before setup()
+  void add_http_route(String uri, std::function<void(WebServer&)> handler) {
+    cm.add_route(uri, handler);
+  };
+  void add_http_poll(std::function<void()> hook) {
+    cm.add_poll_hook(hook);
+  };
+  // how often the wifi task (web server, LED) wakes without a link event, WIFI_TICK_MS by default
+  void set_network_tick_ms(uint32_t ms) {
+    wm.set_tick_ms(ms);
+  };
+  // publishes on <mqtt_topic>/<identifier>/<subtopic>, for results made between frames - Task2 only, false while offline
+  bool publish(const String &subtopic, const char *payload);
+  // frames built but not published because they overflowed the document or the MQTT buffer
+  uint32_t get_frames_refused() {return frames_refused;};
 
   void printLocalTime();
   void get_timestamp();
@@ -50,13 +98,28 @@ public:
 
 private:
   ConfigManager cm;
-  std::function<bool(ArduinoJson::StaticJsonDocument<3000>&)> callback;
+  WifiManager wm;
+  std::function<bool(FrameDocument&)> callback;
+  std::vector<std::pair<String, std::function<void(JsonObject)>>> metrics_hooks;
+  std::vector<std::pair<String, std::function<void(const String&)>>> command_hooks;
+  std::vector<std::function<void(const char*, size_t)>> frame_hooks;
   String current_mqtt_server_addr = "";
   int current_mqtt_server_port = 0;
   char timestamp_buffer[80];
   long mqttConnectTimestamp = 0;
+  long mqtt_retry_ms = MQTT_RETRY_MIN_MS;
+  long metricsTimestamp = 0;
+  FrameDocument *frame_doc;
+  char *frame_message;
+  MetricsDocument *metrics_doc;
+  char *metrics_message;
+  size_t frame_json_max = 0;  // largest frame so far, to size FRAME_JSON_CAPACITY and FRAME_MESSAGE_SIZE
+  size_t frame_message_max = 0;
+  uint32_t frames_refused = 0;
 
   void reconnect();
+  void publish_metrics();
+  void on_message(char *topic, uint8_t *payload, unsigned int length);
 };
 
 
@@ -0,0 +1,234 @@
+// ----------------------------------------------------------------------
+//
+//   Spectrum compression for ESP32 devices
+//
+//   Copyright (C) 2022  Shoestring and University of Cambridge
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, version 3 of the License.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see https://www.gnu.org/licenses/.
+//
+// ----------------------------------------------------------------------
+
+#include "spectrum_codec.h"
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+
+static const char base64_alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+static inline uint32_t zigzag(int32_t d) {
+  return d >= 0 ? (uint32_t)d << 1 : ((uint32_t)(-d) << 1) - 1;
+}
+
+static inline int32_t unzigzag(uint32_t u) {
+  return (u & 1) ? -(int32_t)((u + 1) >> 1) : (int32_t)(u >> 1);
+}
+
+/****** Encoder ******/
+
+void spectrum_quantise(const float *magnitude, uint16_t bins, uint8_t bits, float floor_db, float *scratch,
+                       uint16_t *codes, SpectrumHeader &header) {
+  uint16_t levels = (1 << bits) - 1;  // largest code
+  float peak = 0;
+  for (uint16_t i = 0; i < bins; i++) {
+    peak = std::max(peak, magnitude[i]);
+  }
+  header.bins = bins;
+  header.bits = bits;
+  header.step_db = SPECTRUM_RANGE_DB / (levels - 1);
+  header.top_db = peak > 0 ? 20 * log10f(peak) : 0;
+  header.floor_db = NAN;
+
+  float threshold_db = header.top_db - SPECTRUM_RANGE_DB - header.step_db / 2;
+  if (!isnan(floor_db) && bins > 2) {
+    // median of everything but DC
+    memcpy(scratch, magnitude + 1, (bins - 1) * sizeof(float));
+    float *middle = scratch + (bins - 1) / 2;
+    std::nth_element(scratch, middle, scratch + bins - 1);
+    if (*middle > 0) {
+      header.floor_db = 20 * log10f(*middle) + floor_db;
+      threshold_db = std::max(threshold_db, header.floor_db);
+    }
+  }
+
+  for (uint16_t i = 0; i < bins; i++) {
+    if (magnitude[i] <= 0) {
+      codes[i] = 0;
+      continue;
+    }
+    float db = 20 * log10f(magnitude[i]);
+    if (db < threshold_db) {
+      codes[i] = 0;
+      continue;
+    }
+    int32_t below = lroundf((header.top_db - db) / header.step_db);
+    codes[i] = (uint16_t)std::max((int32_t)levels - below, (int32_t)1);
+  }
+}
+
+size_t spectrum_pack(const uint16_t *codes, const SpectrumHeader &header, uint8_t *packed) {
+  // k up to bits + 1, where no quotient is longer than one bit
+  uint8_t max_k = header.bits + 1;
+  memset(packed, 0, spectrum_packed_bytes(header.bins, header.bits));
+  uint32_t bit = 0;
+  uint16_t previous = 0;
+  for (uint16_t start = 0; start < header.bins; start += SPECTRUM_BLOCK_BINS) {
+    uint16_t end = std::min((uint16_t)(start + SPECTRUM_BLOCK_BINS), header.bins);
+
+    // bits the block takes for every k
+    uint32_t cost[SPECTRUM_MAX_BITS + 2] = { 0 };
+    uint16_t last = previous;
+    for (uint16_t i = start; i < end; i++) {
+      uint32_t u = zigzag((int32_t)codes[i] - last);
+      last = codes[i];
+      for (uint8_t k = 0; k <= max_k; k++) {
+        cost[k] += (u >> k) + 1 + k;
+      }
+    }
+    uint8_t best = 0;
+    for (uint8_t k = 1; k <= max_k; k++) {
+      if (cost[k] < cost[best]) {
+        best = k;
+      }
+    }
+
+    for (int8_t b = SPECTRUM_K_BITS - 1; b >= 0; b--, bit++) {
+      if ((best >> b) & 1) {
+        packed[bit >> 3] |= 0x80 >> (bit & 7);
+      }
+    }
+    for (uint16_t i = start; i < end; i++) {
+      uint32_t u = zigzag((int32_t)codes[i] - previous);
+      previous = codes[i];
+      for (uint32_t q = u >> best; q > 0; q--, bit++) {
+        packed[bit >> 3] |= 0x80 >> (bit & 7);
+      }
+      bit++;  // the terminating zero
+      for (int8_t b = best - 1; b >= 0; b--, bit++) {
+        if ((u >> b) & 1) {
+          packed[bit >> 3] |= 0x80 >> (bit & 7);
+        }
+      }
+    }
+  }
+  return (bit + 7) / 8;
+}
+
+size_t base64_encode(const uint8_t *data, size_t length, char *text) {
+  size_t n = 0;
+  for (size_t i = 0; i < length; i += 3) {
+    uint32_t group = data[i] << 16;
+    if (i + 1 < length) {
+      group |= data[i + 1] << 8;
+    }
+    if (i + 2 < length) {
+      group |= data[i + 2];
+    }
+    text[n++] = base64_alphabet[(group >> 18) & 0x3F];
+    text[n++] = base64_alphabet[(group >> 12) & 0x3F];
+    text[n++] = i + 1 < length ? base64_alphabet[(group >> 6) & 0x3F] : '=';
+    text[n++] = i + 2 < length ? base64_alphabet[group & 0x3F] : '=';
+  }
+  text[n] = '\0';
+  return n;
+}
+
+/****** Decoder ******/
+
+size_t base64_decode(const char *text, uint8_t *data, size_t max_length) {
+  size_t n = 0;
+  uint32_t group = 0;
+  uint8_t sextets = 0;
+  for (const char *c = text; *c && *c != '='; c++) {
+    const char *found = strchr(base64_alphabet, *c);
+    if (found == NULL) {
+      return 0;
+    }
+    group = (group << 6) | (found - base64_alphabet);
+    if (++sextets == 4) {
+      if (n + 3 > max_length) {
+        return 0;
+      }
+      data[n++] = group >> 16;
+      data[n++] = group >> 8;
+      data[n++] = group;
+      group = 0;
+      sextets = 0;
+    }
+  }
+  // 2 or 3 sextets left over are 1 or 2 bytes
+  if (sextets >= 2) {
+    group <<= 6 * (4 - sextets);
+    for (uint8_t b = 0; b < sextets - 1; b++) {
+      if (n >= max_length) {
+        return 0;
+      }
+      data[n++] = group >> (16 - 8 * b);
+    }
+  }
+  return n;
+}
+
+bool spectrum_unpack(const uint8_t *packed, size_t length, const SpectrumHeader &header, uint16_t *codes) {
+  uint32_t total = length * 8;
+  uint32_t bit = 0;
+  uint16_t previous = 0;
+  uint32_t levels = (1 << header.bits) - 1;
+  uint8_t k = 0;
+  for (uint16_t i = 0; i < header.bins; i++) {
+    if (i % SPECTRUM_BLOCK_BINS == 0) {
+      k = 0;
+      for (uint8_t b = 0; b < SPECTRUM_K_BITS; b++, bit++) {
+        if (bit >= total) {
+          return false;
+        }
+        k = (k << 1) | ((packed[bit >> 3] >> (7 - (bit & 7))) & 1);
+      }
+      if (k > header.bits + 1) {
+        return false;
+      }
+    }
+    uint32_t q = 0;
+    for (;;) {
+      if (bit >= total) {
+        return false;
+      }
+      bool one = packed[bit >> 3] & (0x80 >> (bit & 7));
+      bit++;
+      if (!one) {
+        break;
+      }
+      q++;
+    }
+    uint32_t u = q;
+    for (uint8_t b = 0; b < k; b++, bit++) {
+      if (bit >= total) {
+        return false;
+      }
+      u = (u << 1) | ((packed[bit >> 3] >> (7 - (bit & 7))) & 1);
+    }
+    int32_t code = previous + unzigzag(u);
+    if (code < 0 || code > (int32_t)levels) {
+      return false;
+    }
+    codes[i] = previous = code;
+  }
+  return true;
+}
+
+float spectrum_level(uint16_t code, const SpectrumHeader &header) {
+  if (code == 0) {
+    return 0;
+  }
+  uint16_t levels = (1 << header.bits) - 1;
+  return powf(10, (header.top_db - (levels - code) * header.step_db) / 20);
+}
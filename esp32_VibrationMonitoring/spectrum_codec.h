@@ -0,0 +1,104 @@
+// ----------------------------------------------------------------------
+//
+//   Spectrum compression for ESP32 devices
+//
+//   Copyright (C) 2022  Shoestring and University of Cambridge
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, version 3 of the License.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see https://www.gnu.org/licenses/.
+//
+// ----------------------------------------------------------------------
+
+#ifndef SPECTRUM_CODEC_H
+#define SPECTRUM_CODEC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**********************************************************
+ * Every bin of the magnitude spectrum in a few hundred bytes,
+ * where the "fft" bands keep only one maximum per band.
+ *
+ *  1. log quantisation - each bin becomes a code of bits
+ *     (8 or 12) bits, in steps of step_db down from the
+ *     largest bin, so the codes span SPECTRUM_RANGE_DB.
+ *     Code 0 decodes to 0: below the range, or below the
+ *     noise floor threshold.
+ *  2. noise floor (optional) - bins less than floor_db above
+ *     the median bin are sent as code 0, which costs about a
+ *     bit each after the next steps
+ *  3. delta - each code minus the one before it, zigzag
+ *     mapped to unsigned (0, -1, 1, -2 ... -> 0, 1, 2, 3 ...)
+ *  4. Rice coding in blocks of SPECTRUM_BLOCK_BINS bins, each
+ *     starting with its own k (4 bits), the one that takes
+ *     fewest bits for the block: u >> k in unary (ones, then
+ *     a zero) followed by the low k bits of u, MSB first
+ *  5. base64 for the JSON string
+ *
+ * In the frame:
+ *
+ *   "spectrum": {"bins": 512, "bin_hz": 0.293, "bits": 8,
+ *                "top_db": 47.97, "step_db": 0.378, "floor_db": 9.1,
+ *                "data": "..."}
+ *
+ * floor_db is the absolute threshold and only present when
+ * thresholding is on. Decoded, every bin with a non-zero
+ * code is within step_db / 2 of the original in dB (20
+ * log10 of the magnitude); a bin with code 0 was below the
+ * threshold, or below the range by more than step_db / 2.
+ * Rice coding never takes more than bits + 2 bits a bin plus
+ * the block headers, see spectrum_packed_bytes().
+ * The sketch codes fewer bits than configured when the frame
+ * would not fit the MQTT buffer, so read bits from the frame.
+ *
+ * Plain C++ with no Arduino dependencies, so the host decoder
+ * (tools/spectrum_decode) builds this same file.
+ **/
+
+#define SPECTRUM_RANGE_DB 96.0f
+#define SPECTRUM_MIN_BITS 4
+#define SPECTRUM_MAX_BITS 12
+#define SPECTRUM_BLOCK_BINS 32
+#define SPECTRUM_K_BITS 4
+
+struct SpectrumHeader {
+  uint16_t bins;
+  uint8_t bits;
+  float top_db;
+  float step_db;
+  float floor_db;  // NAN when thresholding is off
+};
+
+// worst case sizes, for the buffers
+constexpr size_t spectrum_packed_bytes(size_t bins, uint8_t bits) {
+  return ((bits + 2) * bins + SPECTRUM_K_BITS * ((bins + SPECTRUM_BLOCK_BINS - 1) / SPECTRUM_BLOCK_BINS) + 7) / 8;
+}
+constexpr size_t spectrum_text_bytes(size_t bins, uint8_t bits) {
+  return (spectrum_packed_bytes(bins, bits) + 2) / 3 * 4 + 1;
+}
+
+// magnitude -> codes and header. floor_db is relative to the median bin,
+// NAN for no thresholding. scratch is bins long and is overwritten.
+void spectrum_quantise(const float *magnitude, uint16_t bins, uint8_t bits, float floor_db, float *scratch,
+                       uint16_t *codes, SpectrumHeader &header);
+// codes -> Rice coded bits, returns the bytes written
+size_t spectrum_pack(const uint16_t *codes, const SpectrumHeader &header, uint8_t *packed);
+// NUL terminated, returns the length without the NUL
+size_t base64_encode(const uint8_t *data, size_t length, char *text);
+
+// decoder side, false on a corrupt or truncated payload
+size_t base64_decode(const char *text, uint8_t *data, size_t max_length);
+bool spectrum_unpack(const uint8_t *packed, size_t length, const SpectrumHeader &header, uint16_t *codes);
+// the magnitude a code stands for, 0 for code 0
+float spectrum_level(uint16_t code, const SpectrumHeader &header);
+
+#endif
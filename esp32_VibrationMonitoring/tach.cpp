@@ -0,0 +1,104 @@
+// ----------------------------------------------------------------------
+//
+//   Speed pulse input for ESP32 devices
+//
+//   Copyright (C) 2022  Shoestring and University of Cambridge
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, version 3 of the License.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see https://www.gnu.org/licenses/.
+//
+// ----------------------------------------------------------------------
+
+#include "tach.h"
+#include "logger.h"
+
+Tachometer tach;
+
+bool Tachometer::begin(int pin, uint32_t debounce_us, uint8_t pulses_per_rev) {
+  if (pin < 0) {
+    return false;
+  }
+  this->debounce_us = debounce_us;
+  ppr = max(pulses_per_rev, (uint8_t)1);
+  times = memory_budget.take_array<uint32_t>(TACH_MAX_PULSES, "tach_pulses");
+  pinMode(pin, INPUT_PULLUP);
+  attachInterruptArg(digitalPinToInterrupt(pin), on_edge, this, FALLING);
+  LOG_INFO("Tach on pin %d, %u pulses/rev, debounce %lu us", pin, ppr, (unsigned long)debounce_us);
+  return true;
+}
+
+void IRAM_ATTR Tachometer::on_edge(void *arg) {
+  Tachometer *self = (Tachometer *)arg;
+  uint32_t now = micros();
+  if (self->count > 0 && now - self->last_us < self->debounce_us) {
+    self->rejected++;
+    return;
+  }
+  portENTER_CRITICAL_ISR(&self->mux);
+  self->times[self->count % TACH_MAX_PULSES] = now;
+  self->count++;
+  self->last_us = now;
+  portEXIT_CRITICAL_ISR(&self->mux);
+}
+
+uint16_t Tachometer::pulses(uint32_t from_us, uint32_t to_us, float *offsets_us, uint16_t max) {
+  uint32_t span = to_us - from_us;
+  uint16_t n = 0;
+  bool covered = false;
+  portENTER_CRITICAL(&mux);
+  uint32_t total = count;
+  uint32_t held = min(total, (uint32_t)TACH_MAX_PULSES);
+  // newest first until the window starts, then reverse
+  for (uint32_t i = 1; i <= held; i++) {
+    uint32_t offset = times[(total - i) % TACH_MAX_PULSES] - from_us;
+    if ((int32_t)offset < 0) {
+      covered = true;
+      break;
+    }
+    if (offset <= span) {
+      if (n >= max) {
+        break;
+      }
+      offsets_us[n++] = offset;
+    }
+  }
+  portEXIT_CRITICAL(&mux);
+  if (!covered && held == TACH_MAX_PULSES) {
+    too_short++;  // the start of the window has been overwritten, the rest is still good
+  }
+  for (uint16_t i = 0; i < n / 2; i++) {
+    float t = offsets_us[i];
+    offsets_us[i] = offsets_us[n - 1 - i];
+    offsets_us[n - 1 - i] = t;
+  }
+  return n;
+}
+
+float Tachometer::rpm() {
+  portENTER_CRITICAL(&mux);
+  uint32_t total = count;
+  uint32_t last = last_us;
+  uint32_t period = total >= 2 ? last - times[(total - 2) % TACH_MAX_PULSES] : 0;
+  portEXIT_CRITICAL(&mux);
+  if (period == 0 || micros() - last > TACH_STOPPED_US) {
+    return 0;
+  }
+  return 60e6f / (period * (float)ppr);
+}
+
+void Tachometer::report(JsonObject out) {
+  out["ppr"] = ppr;
+  out["pulses"] = count;
+  out["rejected"] = rejected;
+  out["rpm"] = rpm();
+  out["short"] = too_short;
+}
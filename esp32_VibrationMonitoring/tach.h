@@ -0,0 +1,85 @@
+// ----------------------------------------------------------------------
+//
+//   Speed pulse input for ESP32 devices
+//
+//   Copyright (C) 2022  Shoestring and University of Cambridge
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, version 3 of the License.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see https://www.gnu.org/licenses/.
+//
+// ----------------------------------------------------------------------
+
+#ifndef TACH_H
+#define TACH_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include "memory_budget.h"
+
+/**********************************************************
+ * Once-per-rev (or n-per-rev) speed pulses on a GPIO.
+ *
+ * "tach_pin" is the input, -1 (the default) for none. The
+ * sensor pulls it low once per mark, falling edges are
+ * timestamped in the interrupt with micros(), the same
+ * clock the sampler's frame_start_us comes from. An edge
+ * less than "tach_debounce_us" after the last one taken is
+ * contact bounce or noise and is dropped, so the debounce
+ * must stay below the shortest pulse period:
+ *
+ *   tach_debounce_us < 60e6 / (max rpm * tach_ppr)
+ *
+ * The last TACH_MAX_PULSES edge times are kept in a ring,
+ * enough for one whole buffer of analysis at up to
+ * TACH_MAX_PULSES / 3.4 s pulses a second. Above that the
+ * order spectrum covers only the end of the buffer ("short"
+ * counts those buffers).
+ *
+ *   "tach": {"ppr": 1, "pulses": 8123, "rejected": 12,
+ *            "rpm": 1493.2, "short": 0}
+ **/
+
+#define TACH_MAX_PULSES 256
+#define TACH_STOPPED_US 2000000  // rpm is 0 after this long without a pulse
+#define TACH_ARENA_BYTES arena_bytes(sizeof(uint32_t) * TACH_MAX_PULSES)
+
+class Tachometer {
+public:
+  bool begin(int pin, uint32_t debounce_us, uint8_t pulses_per_rev);
+  bool is_enabled() { return times != NULL; }
+  uint8_t get_ppr() { return ppr; }
+
+  // times of the edges from from_us to to_us, in us after from_us, oldest first.
+  // Returns the count - only the newest TACH_MAX_PULSES when the ring has overrun
+  uint16_t pulses(uint32_t from_us, uint32_t to_us, float *offsets_us, uint16_t max);
+  float rpm();
+  void report(JsonObject out);
+
+private:
+  uint8_t ppr = 1;
+  uint32_t debounce_us = 0;
+  uint32_t *times = NULL;
+
+  // written by the interrupt
+  portMUX_TYPE mux = portMUX_INITIALIZER_UNLOCKED;
+  volatile uint32_t count = 0;
+  volatile uint32_t last_us = 0;
+  volatile uint32_t rejected = 0;
+
+  uint32_t too_short = 0;  // pulses() windows the ring did not cover
+
+  static void IRAM_ATTR on_edge(void *arg);
+};
+
+extern Tachometer tach;
+
+#endif
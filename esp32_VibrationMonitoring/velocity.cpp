@@ -0,0 +1,92 @@
+// ----------------------------------------------------------------------
+//
+//   Velocity severity from the acceleration spectrum for ESP32 devices
+//
+//   Copyright (C) 2022  Shoestring and University of Cambridge
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, version 3 of the License.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see https://www.gnu.org/licenses/.
+//
+// ----------------------------------------------------------------------
+
+#include "velocity.h"
+#include "logger.h"
+
+// ISO 10816-1 zone boundaries A/B, B/C, C/D in mm/s RMS
+// class I: small machines (<15kW), II: medium (15-75kW),
+// III: large on rigid foundations, IV: large on soft foundations
+static const float iso_limits[4][3] = {
+  { 0.71, 1.8, 4.5 },
+  { 1.12, 2.8, 7.1 },
+  { 1.8, 4.5, 11.2 },
+  { 2.8, 7.1, 18.0 },
+};
+
+bool VelocitySpectrum::begin(float sample_rate, uint16_t n_samples, float high_pass_hz, uint8_t machine_class,
+                             uint16_t band_bins, uint8_t bands) {
+  if (n_samples > VELOCITY_MAX_SAMPLES || band_bins == 0) {
+    return false;
+  }
+  iso_class = constrain(machine_class, 1, 4);
+  bins_per_band = band_bins;
+  n_bands = min(bands, (uint8_t)VELOCITY_MAX_BANDS);
+
+  // sum of squares of the window the frame was weighed with
+  float window_power = 0;
+  for (uint16_t n = 0; n < n_samples; n++) {
+    float w = 0.54 - 0.46 * cos(2 * PI * n / (n_samples - 1));
+    window_power += w * w;
+  }
+
+  // one-sided Parseval: mean square = 2 * sum|X|^2 / (N * sum w^2)
+  float resolution = sample_rate / n_samples;
+  float low_pass_hz = min((float)VELOCITY_LOW_PASS_HZ, sample_rate / 2);
+  first_bin = max((uint16_t)1, (uint16_t)ceil(high_pass_hz / resolution));
+  end_bin = min((uint16_t)(n_samples / 2), (uint16_t)(low_pass_hz / resolution + 1));
+  for (uint16_t k = 0; k < n_samples / 2; k++) {
+    if (k < first_bin || k >= end_bin) {
+      weights[k] = 0;
+      continue;
+    }
+    float to_mm_s = 1000.0 / (2 * PI * k * resolution);
+    weights[k] = 2 * to_mm_s * to_mm_s / (n_samples * window_power);
+  }
+  LOG_INFO("Velocity %.1f-%.1f Hz, ISO 10816-1 class %u", first_bin * resolution, (end_bin - 1) * resolution, iso_class);
+  return true;
+}
+
+float VelocitySpectrum::analyse(const float *magnitude, JsonDocument &frame) {
+  float total = 0;
+  JsonArray bands = frame.createNestedArray("velocity_bands");
+  for (uint8_t b = 0; b < n_bands; b++) {
+    uint16_t from = max(first_bin, (uint16_t)(b * bins_per_band));
+    uint16_t to = min(end_bin, (uint16_t)((b + 1) * bins_per_band));
+    float band = 0;
+    for (uint16_t k = from; k < to; k++) {
+      band += magnitude[k] * magnitude[k] * weights[k];
+    }
+    total += band;
+    bands.add(round(sqrt(band) * 100) / 100);
+  }
+  // bins past the last band still count towards the total
+  for (uint16_t k = max(first_bin, (uint16_t)(n_bands * bins_per_band)); k < end_bin; k++) {
+    total += magnitude[k] * magnitude[k] * weights[k];
+  }
+
+  float rms = sqrt(total);
+  const float *limits = iso_limits[iso_class - 1];
+  char zone = rms < limits[0] ? 'A' : rms < limits[1] ? 'B' : rms < limits[2] ? 'C' : 'D';
+  char zone_string[2] = { zone, '\0' };
+  frame["velocity"] = rms;
+  frame["velocity_zone"] = zone_string;
+  return rms;
+}
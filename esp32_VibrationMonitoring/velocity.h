@@ -0,0 +1,68 @@
+// ----------------------------------------------------------------------
+//
+//   Velocity severity from the acceleration spectrum for ESP32 devices
+//
+//   Copyright (C) 2022  Shoestring and University of Cambridge
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, version 3 of the License.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see https://www.gnu.org/licenses/.
+//
+// ----------------------------------------------------------------------
+
+#ifndef VELOCITY_H
+#define VELOCITY_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+/**********************************************************
+ * Velocity RMS in mm/s and its ISO 10816-1 zone, worked
+ * out from the magnitude spectrum loop_callback already
+ * has - no second FFT.
+ *
+ * Integration is a division by 2*pi*f per bin. Bins below
+ * the high-pass cut (ISO: 10Hz) or above 1000Hz are left
+ * out, which also removes the 1/f blow-up near DC. The RMS
+ * comes from Parseval's theorem with the power of the
+ * Hamming window taken out, so it holds for broadband
+ * vibration and not just for single tones.
+ *
+ * begin() turns all of that into one weight per bin, so a
+ * frame costs one multiply-add per bin. Adds to the frame:
+ *
+ *   "velocity": 2.25,               mm/s RMS
+ *   "velocity_zone": "B",           ISO 10816-1 zone A-D
+ *   "velocity_bands": [0, 2.25, ...] mm/s RMS per fft band
+ **/
+
+#define VELOCITY_MAX_SAMPLES 1024
+#define VELOCITY_MAX_BANDS 32
+#define VELOCITY_LOW_PASS_HZ 1000
+
+class VelocitySpectrum {
+public:
+  // bands follow the "fft" bands: bins_per_band bins each, starting at bin 0
+  bool begin(float sample_rate, uint16_t n_samples, float high_pass_hz, uint8_t iso_class,
+             uint16_t bins_per_band, uint8_t n_bands);
+  // magnitude: |FFT| of the Hamming windowed frame, as left in vReal by complexToMagnitude()
+  float analyse(const float *magnitude, JsonDocument &frame);
+
+private:
+  float weights[VELOCITY_MAX_SAMPLES / 2];  // (mm/s)^2 per |X|^2, 0 outside the pass band
+  uint16_t first_bin = 0;
+  uint16_t end_bin = 0;
+  uint16_t bins_per_band = 1;
+  uint8_t n_bands = 0;
+  uint8_t iso_class = 1;
+};
+
+#endif
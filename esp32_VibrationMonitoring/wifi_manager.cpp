@@ -20,10 +20,16 @@
 
 #include "wifi_manager.h"
 #include "config_display.h"
+#include "logger.h"
+#include "boot_profiler.h"
+#include "memory_budget.h"
 #include <WiFi.h>
 
 extern ConfigDisplay display;
 
+#define EVENT_GOT_IP (1 << 0)
+#define EVENT_DISCONNECTED (1 << 1)
+
 WifiManager::WifiManager(ConfigManager *cm_ptr)
   : state(STA_STATE::start), last_state(STA_STATE::none), config_manager_ptr(cm_ptr) {
   Serial.println("*** WIFI Manager online ***");
@@ -33,29 +39,46 @@ WifiManager::~WifiManager() {
   Serial.println("*** WIFI Manager offline ***");
 }
 
-void WifiManager::setup() {
-  Serial.println("*** WIFI Manager Setup ***");
+void WifiManager::begin() {
+  LOG_INFO("*** WIFI Manager Setup ***");
   WiFi.mode(WIFI_AP_STA);
   WiFi.mode(WIFI_AP);
-  TempAP ap;
+  WiFi.setAutoReconnect(false);  // reconnects are driven by the state machine
 
   pinMode(13, OUTPUT);
-  bool led = false;
-  long last = millis();
+  link_down_time = millis();
 
-  while (state != STA_STATE::connected) {
-    step_loop(ap);
-    led_delay();
-  }
+  xTaskCreatePinnedToCore(
+    wifi_task,        /* Task function. */
+    "WiFi",           /* name of task. */
+    WIFI_TASK_STACK,  /* Stack size of task */
+    this,             /* parameter of the task */
+    1,                /* priority of the task */
+    &task,            /* Task handle to keep track of created task */
+    1);               /* pin task to core 1 */
+  memory_budget.watch_stack("WiFi", task, WIFI_TASK_STACK);
 
-  Serial.print("Connected at:");
-  Serial.println(WiFi.localIP());
-  digitalWrite(13, false);
+  // wake the state machine as soon as the link changes rather than on the next tick
+  WiFi.onEvent([this](WiFiEvent_t event, WiFiEventInfo_t info) {
+    if (task != NULL) {
+      xTaskNotify(task, EVENT_GOT_IP, eSetBits);
+    }
+  }, ARDUINO_EVENT_WIFI_STA_GOT_IP);
+  WiFi.onEvent([this](WiFiEvent_t event, WiFiEventInfo_t info) {
+    if (task != NULL) {
+      xTaskNotify(task, EVENT_DISCONNECTED, eSetBits);
+    }
+  }, ARDUINO_EVENT_WIFI_STA_DISCONNECTED);
+}
 
-  display.setWiFiSSID(config_manager_ptr->getWiFiSSID());
-  display.setWiFiStatus("Connected");
-  display.setIP(WiFi.localIP().toString());
-  // flash_ip(WiFi.localIP().toString());
+void WifiManager::wifi_task(void * pvParameters) {
+  WifiManager *self = (WifiManager *)pvParameters;
+  for (;;) {
+    uint32_t events = 0;
+    xTaskNotifyWait(0, 0xffffffff, &events, pdMS_TO_TICKS(self->tick_ms));
+    self->step_loop();
+    self->update_led();
+  }
 }
 
 void WifiManager::flash_ip(String ip) {
@@ -87,65 +110,57 @@ void WifiManager::flash_ip(String ip) {
 void WifiManager::print_state() {
   switch (state) {
     case STA_STATE::start:
-      Serial.println("><> Start");
+      LOG_INFO("><> Start");
       display.setWiFiStatus("Started");
       break;
     case STA_STATE::ap:
-      Serial.println("><> AP");
+      LOG_INFO("><> AP");
       display.setWiFiStatus("AP mode");
       break;
     case STA_STATE::try_existing:
-      Serial.println("><> Try Exist");
+      LOG_INFO("><> Try Exist");
       display.setWiFiStatus("Connecting...");
       break;
     case STA_STATE::try_new:
-      Serial.println("><> Try New");
+      LOG_INFO("><> Try New");
       display.setWiFiStatus("New credentials");
       break;
     case STA_STATE::pre_connected_delay:
-      Serial.println("><> Connected-Delay");
+      LOG_INFO("><> Connected-Delay");
       break;
     case STA_STATE::connected:
-      Serial.println("><> Connected");
+      LOG_INFO("><> Connected");
       break;
   }
 }
 
-//counts 0 - 10 with 100ms delay
-void WifiManager::led_delay() {
-  static bool value = false;
-  static int counter = 0;
+// LED pattern per state, on a 1 second cycle
+void WifiManager::update_led() {
+  unsigned long phase = millis() % 1000;
   switch (state) {
     case STA_STATE::start:
       digitalWrite(13, true);
       break;
-    case STA_STATE::ap:
-      if (counter == 0) {
-        digitalWrite(13, value);
-        value = !value;
-      }
+    case STA_STATE::ap:  // 1s on, 1s off
+      digitalWrite(13, (millis() / 1000) % 2 == 0);
       break;
     case STA_STATE::try_existing:
       digitalWrite(13, true);
       break;
     case STA_STATE::try_new:  // on, on, off, off, on, on, ...
-      digitalWrite(13, (counter / 2) % 2 == 0);
+      digitalWrite(13, (phase / 200) % 2 == 0);
       break;
     case STA_STATE::connected:
       digitalWrite(13, false);
       break;
   }
-  delay(100);
-  counter++;
-  if (counter >= 10) {
-    counter = 0;
-  }
 }
 
-void WifiManager::step_loop(TempAP &ap) {
+void WifiManager::step_loop() {
   bool on_entry = state != last_state;
   if (on_entry) {
     print_state();
+    state_entry_time = millis();
   }
   last_state = state;
   STA_STATE next_state = state;
@@ -158,15 +173,13 @@ void WifiManager::step_loop(TempAP &ap) {
       next_state = handle_try_existing(on_entry);
       break;
     case STA_STATE::ap:
-      next_state = handle_ap(on_entry, ap);
+      next_state = handle_ap(on_entry);
       break;
     case STA_STATE::try_new:
       next_state = handle_try_new(on_entry);
       break;
     case STA_STATE::pre_connected_delay:
-      static int count = 0;
-      if (count < 300) {
-        count++;
+      if (time_in_state() < PRE_CONNECTED_DELAY_MS) {  // keep the AP up so the form can show success
         next_state = STA_STATE::pre_connected_delay;
       } else {
         ap.stop();
@@ -174,6 +187,9 @@ void WifiManager::step_loop(TempAP &ap) {
         next_state = STA_STATE::connected;
       }
       break;
+    case STA_STATE::connected:
+      next_state = handle_connected(on_entry);
+      break;
   }
 
   config_manager_ptr->step_loop();
@@ -193,49 +209,85 @@ STA_STATE WifiManager::handle_start(bool on_entry) {
   }
 }
 
-STA_STATE WifiManager::handle_try_existing(bool on_entry) {
-  static int try_counter = 0;
+void WifiManager::apply_static_ip() {
+  IPAddress ip, gateway, subnet, dns;
+  if (!ip.fromString(config_manager_ptr->getString("static_ip"))) {
+    return;  // DHCP
+  }
+  if (!gateway.fromString(config_manager_ptr->getString("gateway"))) {
+    gateway = IPAddress(ip[0], ip[1], ip[2], 1);
+  }
+  if (!subnet.fromString(config_manager_ptr->getString("subnet"))) {
+    subnet = IPAddress(255, 255, 255, 0);
+  }
+  if (!dns.fromString(config_manager_ptr->getString("dns"))) {
+    dns = gateway;
+  }
+  if (!WiFi.config(ip, gateway, subnet, dns)) {
+    LOG_WARN("Static IP %s rejected - using DHCP", ip.toString().c_str());
+  }
+}
 
+STA_STATE WifiManager::handle_try_existing(bool on_entry) {
   if (on_entry) {
     if (!WiFi.disconnect()) {
-      Serial.println("Wifi Failed to disconnect properly");
+      LOG_WARN("Wifi Failed to disconnect properly");
     };
     if (!WiFi.softAPdisconnect()) {
-      Serial.println("Wifi AP Failed to disconnect properly");
+      LOG_WARN("Wifi AP Failed to disconnect properly");
     }
     WiFi.mode(WIFI_STA);
-    WiFi.begin(current_ssid.c_str(), current_password.c_str());
+    apply_static_ip();
+
+    uint8_t bssid[6];
+    int32_t channel;
+    fast_attempt = config_manager_ptr->get_wifi_cache(bssid, channel);
+    if (fast_attempt) {
+      // skip the scan - go straight to the access point we were last on
+      WiFi.begin(current_ssid.c_str(), current_password.c_str(), channel, bssid);
+      LOG_INFO("[*] Fast connect with existing credentials (channel %d)", (int)channel);
+    } else {
+      WiFi.begin(current_ssid.c_str(), current_password.c_str());
+      LOG_INFO("[*] Attempting connection with existing credentials");
+    }
     display.setWiFiSSID(current_ssid);
-    Serial.println("[*] Attempting connection with existing credentials");
-    try_counter = 0;
     this->config_manager_ptr->setup();
   }
 
   if (WiFi.status() == WL_CONNECTED) {
+    LOG_INFO("[+] Wifi connected with existing credentials");
+    if (fast_attempt) {
+      metrics.fast_connects++;
+    }
     return STA_STATE::connected;
-    Serial.println("\n[+] Wifi connected with existing credentials");
-  } else if (try_counter < 300) {  //try connect for 30 seconds
-    if (try_counter % 10 == 0) { Serial.print("."); }
-    try_counter++;
+  }
+
+  if (fast_attempt && time_in_state() > FAST_CONNECT_TIMEOUT_MS) {
+    // access point moved or changed channel - fall back to a full scan
+    LOG_INFO("[*] Fast connect timed out - scanning");
+    metrics.fast_misses++;
+    fast_attempt = false;
+    WiFi.disconnect();
+    WiFi.begin(current_ssid.c_str(), current_password.c_str());
+  }
+
+  if (time_in_state() < TRY_EXISTING_TIMEOUT_MS) {
     return STA_STATE::try_existing;
   }
 
-  Serial.println("\n[+] Unable to connect - openning AP mode while retrying");
+  LOG_WARN("[+] Unable to connect - openning AP mode while retrying");
   retry_mode = true;
   return STA_STATE::ap;
 }
 
-STA_STATE WifiManager::handle_ap(bool on_entry, TempAP &ap) {
-  static int try_counter = 0;
-
+STA_STATE WifiManager::handle_ap(bool on_entry) {
   if (on_entry) {
     if (!WiFi.disconnect()) {
-      Serial.println("Wifi Failed to disconnect properly");
+      LOG_WARN("Wifi Failed to disconnect properly");
     };
     WiFi.mode(WIFI_AP_STA);
     ap.start();
     display.setWiFiSSID(ap.getSSID());
-    try_counter = 0;
     this->config_manager_ptr->setup();
   }
 
@@ -247,8 +299,7 @@ STA_STATE WifiManager::handle_ap(bool on_entry, TempAP &ap) {
   } else if (current_ssid == "" || current_password == "") {
     return STA_STATE::ap;                                                                                                   //No existing credentials - continue to wait as AP
   } else {                                                                                                                  //Existing credentials - try again when timeout occurs
-    if (try_counter < 1800 || (config_manager_ptr->get_state() == WIFI_CREDS_STATE::entering_new && try_counter < 3000)) {  // 3 min timeout or 5 min if form entry ongoing
-      try_counter++;
+    if (time_in_state() < AP_TIMEOUT_MS || (config_manager_ptr->get_state() == WIFI_CREDS_STATE::entering_new && time_in_state() < AP_FORM_TIMEOUT_MS)) {  // 3 min timeout or 5 min if form entry ongoing
       return STA_STATE::ap;
     } else {
       ap.stop();
@@ -258,32 +309,61 @@ STA_STATE WifiManager::handle_ap(bool on_entry, TempAP &ap) {
 }
 
 STA_STATE WifiManager::handle_try_new(bool on_entry) {
-  static int try_counter = 0;
-
   if (on_entry) {
     if (!WiFi.disconnect()) {
-      Serial.println("Wifi Failed to disconnect properly");
+      LOG_WARN("Wifi Failed to disconnect properly");
     };
     display.setWiFiSSID(new_ssid);
+    apply_static_ip();
     WiFi.begin(new_ssid.c_str(), new_password.c_str());
-    Serial.println("\n[*] Trying to connect to new WiFi network: " + new_ssid);
-    try_counter = 0;
+    LOG_INFO("[*] Trying to connect to new WiFi network: %s", new_ssid.c_str());
   }
 
   if (WiFi.status() == WL_CONNECTED) {
-    Serial.println("\n[+] Wifi connected with new credentials");
+    LOG_INFO("[+] Wifi connected with new credentials");
     config_manager_ptr->set_wifi_creds();
+    current_ssid = new_ssid;
+    current_password = new_password;
     return STA_STATE::pre_connected_delay;
   }
 
-  if (try_counter < 600)  //try for 1 minute
+  if (time_in_state() < TRY_NEW_TIMEOUT_MS)  //try for 1 minute
   {
-    if (try_counter % 10 == 0) { Serial.print("-"); }
-    try_counter++;
     return STA_STATE::try_new;
   }
 
-  Serial.println("\n[+] Wifi connection Failed with new credentials");
+  LOG_WARN("[+] Wifi connection Failed with new credentials");
   config_manager_ptr->creds_failed();
   return STA_STATE::ap;
 }
+
+STA_STATE WifiManager::handle_connected(bool on_entry) {
+  if (on_entry) {
+    uint32_t connect_ms = millis() - link_down_time;
+    metrics.connects++;
+    metrics.last_connect_ms = connect_ms;
+    metrics.max_connect_ms = max(metrics.max_connect_ms, connect_ms);
+    metrics.total_connect_ms += connect_ms;
+    LOG_INFO("Connected at: %s after %lu ms", WiFi.localIP().toString().c_str(), (unsigned long)connect_ms);
+    boot_profiler.milestone("wifi_connected");
+
+    config_manager_ptr->set_wifi_cache(WiFi.BSSID(), WiFi.channel());
+    digitalWrite(13, false);
+    display.setWiFiSSID(current_ssid);
+    display.setWiFiStatus("Connected");
+    display.setIP(WiFi.localIP().toString());
+    // flash_ip(WiFi.localIP().toString());
+    connected = true;
+  }
+
+  if (WiFi.status() == WL_CONNECTED) {
+    return STA_STATE::connected;
+  }
+
+  LOG_WARN("[-] Wifi link lost - reconnecting");
+  connected = false;
+  metrics.disconnects++;
+  link_down_time = millis();
+  display.setIP("");
+  return STA_STATE::try_existing;
+}
@@ -30,23 +30,61 @@
  *
  * Timeouts from AP Mode to Try Existing only occur if
  * there is an existing set of credentials to try.
+ *
+ * The state machine runs in its own task so that sampling
+ * and analysis carry on while the network comes up. Losing
+ * the link in Connected goes back to Try Existing, which
+ * first tries a fast connect to the last BSSID/channel
+ * before falling back to a full scan. The task also serves
+ * the config web server and the AP's DNS server.
  **/
 
+#define WIFI_TICK_MS 10
+#define WIFI_TASK_STACK 6144
+#define FAST_CONNECT_TIMEOUT_MS 3000
+#define TRY_EXISTING_TIMEOUT_MS 30000
+#define TRY_NEW_TIMEOUT_MS 60000
+#define AP_TIMEOUT_MS 180000
+#define AP_FORM_TIMEOUT_MS 300000
+#define PRE_CONNECTED_DELAY_MS 30000
+
 enum class STA_STATE {none,start, try_existing, ap, try_new, pre_connected_delay, connected};
 
+struct WifiMetrics {
+  uint32_t connects = 0;
+  uint32_t disconnects = 0;
+  uint32_t fast_connects = 0;      // fast path to cached BSSID/channel succeeded
+  uint32_t fast_misses = 0;        // fast path timed out and fell back to a scan
+  uint32_t last_connect_ms = 0;    // link down (or boot) -> got IP
+  uint32_t max_connect_ms = 0;
+  uint32_t total_connect_ms = 0;
+};
+
 class WifiManager;
 
 class WifiManager{
   public:
     WifiManager(ConfigManager* cm_ptr);
     ~WifiManager();
-    void setup();
+    void begin();
+    bool is_connected() { return connected; }
+    WifiMetrics get_metrics() { return metrics; }
+    // longest the task sleeps between steps when no link event wakes it
+    void set_tick_ms(uint32_t ms) { tick_ms = max(ms, (uint32_t)1); }
 
   private:
     ConfigManager* config_manager_ptr;
+    TempAP ap;
+    TaskHandle_t task = NULL;
 
     STA_STATE state;
     STA_STATE last_state;
+    unsigned long state_entry_time = 0;
+    unsigned long link_down_time = 0;
+
+    volatile bool connected = false;
+    volatile uint32_t tick_ms = WIFI_TICK_MS;
+    WifiMetrics metrics;
 
     String new_ssid;
     String new_password;
@@ -54,18 +92,22 @@ class WifiManager{
     String current_password;
 
     bool retry_mode = false;
+    bool fast_attempt = false;
 
-    void step_loop(TempAP &ap);
+    static void wifi_task(void * pvParameters);
+    void step_loop();
 
     void print_state();
-    void led_delay();
+    void update_led();
     void flash_ip(String ip);
+    unsigned long time_in_state() { return millis() - state_entry_time; }
+    void apply_static_ip();
 
     STA_STATE handle_start(bool on_entry);
     STA_STATE handle_try_existing(bool on_entry);
-    STA_STATE handle_ap(bool on_entry, TempAP &ap);
+    STA_STATE handle_ap(bool on_entry);
     STA_STATE handle_try_new(bool on_entry);
-    STA_STATE handle_retry(bool on_entry);
+    STA_STATE handle_connected(bool on_entry);
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,149 @@
+// ----------------------------------------------------------------------
+//
+//   Zoom FFT for ESP32 devices
+//
+//   Copyright (C) 2022  Shoestring and University of Cambridge
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, version 3 of the License.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see https://www.gnu.org/licenses/.
+//
+// ----------------------------------------------------------------------
+
+#include "zoom_fft.h"
+#include "logger.h"
+
+ZoomFFT zoom;
+
+bool ZoomFFT::begin(float sample_rate, float centre, uint16_t factor) {
+  // split factor into stages, largest first
+  uint16_t remaining = factor;
+  n_stages = 0;
+  while (remaining > 1 && n_stages < ZOOM_MAX_STAGES) {
+    uint8_t stage = DECIMATOR_MAX_FACTOR;
+    while (stage > 1 && remaining % stage != 0) {
+      stage--;
+    }
+    if (stage == 1) {
+      break;
+    }
+    stages_i[n_stages].begin(stage);
+    stages_q[n_stages].begin(stage);
+    n_stages++;
+    remaining /= stage;
+  }
+  if (factor < 2 || remaining != 1) {
+    LOG_ERROR("Zoom factor %u is not a product of %u factors of 2-8", factor, ZOOM_MAX_STAGES);
+    return false;
+  }
+
+  centre_hz = centre;
+  span_hz = sample_rate / factor;
+  window_bins = min((uint16_t)(ZOOM_WINDOW_LINES * factor), (uint16_t)ZOOM_MAX_BINS);
+  if (centre_hz - span_hz / 2 < 0 || centre_hz + span_hz / 2 > sample_rate / 2) {
+    LOG_WARN("Zoom span %.2f-%.2f Hz is outside 0-%.1f Hz", centre_hz - span_hz / 2, centre_hz + span_hz / 2, sample_rate / 2);
+  }
+  float w = 2 * PI * centre_hz / sample_rate;
+  step_re = cos(w);
+  step_im = -sin(w);  // e^-jwt moves the centre to 0 Hz
+  if (samples_i == NULL) {
+    samples_i = memory_budget.take_array<float>(ZOOM_SAMPLES, "zoom_i");
+    samples_q = memory_budget.take_array<float>(ZOOM_SAMPLES, "zoom_q");
+  }
+  count = 0;
+  ready = false;
+  enabled = true;
+  LOG_INFO("Zoom %.2f Hz +/- %.2f Hz, resolution %.4f Hz, %.0f s per spectrum", centre_hz, span_hz / 2,
+           span_hz / ZOOM_SAMPLES, ZOOM_SAMPLES / span_hz);
+  return true;
+}
+
+void ZoomFFT::push(float x) {
+  float i = x * nco_re;
+  float q = x * nco_im;
+
+  float re = nco_re * step_re - nco_im * step_im;
+  float im = nco_re * step_im + nco_im * step_re;
+  // pull the phasor back to unit length so rounding errors cannot build up
+  float gain = 1.5f - 0.5f * (re * re + im * im);
+  nco_re = re * gain;
+  nco_im = im * gain;
+
+  for (uint8_t s = 0; s < n_stages; s++) {
+    // I and Q stages run in step, so they produce outputs together
+    bool output = stages_i[s].push(i, i);
+    stages_q[s].push(q, q);
+    if (!output) {
+      return;
+    }
+  }
+  if (ready) {
+    return;  // previous spectrum not analysed yet - drop, the filters keep running
+  }
+  samples_i[count] = i;
+  samples_q[count] = q;
+  count++;
+  if (count >= ZOOM_SAMPLES) {
+    count = 0;
+    ready = true;
+  }
+}
+
+// drops a partly collected spectrum after a gap in the input, a finished one is kept for analyse()
+void ZoomFFT::restart() {
+  for (uint8_t s = 0; s < n_stages; s++) {
+    stages_i[s].reset();
+    stages_q[s].reset();
+  }
+  if (!ready) {
+    count = 0;
+  }
+}
+
+void ZoomFFT::analyse(ArduinoFFT<float> &fft, float *re, float *im, JsonObject out) {
+  // Hamming on both parts, as the main spectrum only windows real data
+  for (uint16_t n = 0; n < ZOOM_SAMPLES; n++) {
+    float window = 0.54 - 0.46 * cos(2 * PI * n / (ZOOM_SAMPLES - 1));
+    re[n] = samples_i[n] * window;
+    im[n] = samples_q[n] * window;
+  }
+  ready = false;
+
+  fft.compute(re, im, ZOOM_SAMPLES, FFTDirection::Forward);
+  fft.complexToMagnitude(re, im, ZOOM_SAMPLES);
+
+  // bins ZOOM_SAMPLES/2.. are below the centre: k counts from -span/2 to +span/2
+  float resolution = span_hz / ZOOM_SAMPLES;
+  float start = centre_hz - span_hz / 2;
+  float peak = 0;
+  uint16_t peak_index = ZOOM_SAMPLES / 2;
+  for (uint16_t k = ZOOM_SAMPLES / 10; k < ZOOM_SAMPLES - ZOOM_SAMPLES / 10; k++) {
+    float value = re[(k + ZOOM_SAMPLES / 2) % ZOOM_SAMPLES];
+    if (value > peak) {
+      peak = value;
+      peak_index = k;
+    }
+  }
+
+  // every bin of the window around the peak, kept inside the span
+  uint16_t first = constrain(peak_index - window_bins / 2, 0, ZOOM_SAMPLES - window_bins);
+  JsonArray magnitude = out.createNestedArray("magnitude");
+  for (uint16_t k = first; k < first + window_bins; k++) {
+    magnitude.add(round(re[(k + ZOOM_SAMPLES / 2) % ZOOM_SAMPLES] * 100) / 100);
+  }
+
+  out["centre"] = centre_hz;
+  out["span"] = span_hz;
+  out["resolution"] = resolution;
+  out["start"] = start + first * resolution;
+  out["bins"] = window_bins;
+  out["peak"] = start + peak_index * resolution;
+}
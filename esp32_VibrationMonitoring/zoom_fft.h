@@ -0,0 +1,105 @@
+// ----------------------------------------------------------------------
+//
+//   Zoom FFT for ESP32 devices
+//
+//   Copyright (C) 2022  Shoestring and University of Cambridge
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, version 3 of the License.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see https://www.gnu.org/licenses/.
+//
+// ----------------------------------------------------------------------
+
+#ifndef ZOOM_FFT_H
+#define ZOOM_FFT_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include "arduinoFFT.h"
+#include "decimator.h"
+#include "memory_budget.h"
+
+/**********************************************************
+ * High resolution spectrum around one frequency.
+ *
+ * Every analysis-rate sample of channel 0 is mixed down by
+ * the centre frequency (complex NCO), low-pass filtered and
+ * decimated by factor (I and Q separately, in up to
+ * ZOOM_MAX_STAGES Decimator stages of at most 8 each) and
+ * collected until ZOOM_SAMPLES complex points are ready.
+ * The usual FFT size then covers only
+ *
+ *   span = sample rate / factor
+ *
+ * around the centre, so the resolution is factor times finer
+ * for the same memory, at the cost of an acquisition factor
+ * times longer. The outer ~10% of the span lies in the
+ * decimator transition band.
+ *
+ * The frame carries the zoom bins at full resolution, but
+ * only a window of them around the peak: ZOOM_WINDOW_LINES
+ * main FFT bins wide, so factor zoom bins for each, up to
+ * ZOOM_MAX_BINS. The peak is looked for in the inner 80% of
+ * the span, clear of the transition band:
+ *
+ *   "zoom": {"centre": 49.5, "span": 18.75, "resolution": 0.018,
+ *            "start": 49.04, "bins": 64,
+ *            "peak": 49.63, "magnitude": [...]}
+ *
+ * start is the frequency of the first bin of the window.
+ *
+ * push() runs in the sampling task; analyse() runs in the
+ * analysis loop and borrows the main FFT buffers once the
+ * main spectrum is finished with them. The I and Q buffers
+ * and filter stages are taken from the arena by begin(),
+ * so they only use it when the zoom is on.
+ **/
+
+#define ZOOM_SAMPLES 1024  // same as the main FFT
+#define ZOOM_MAX_STAGES 3
+#define ZOOM_WINDOW_LINES 4  // main FFT bins the published window spans
+#define ZOOM_MAX_BINS 64      // the most zoom bins in a frame, reached at factor 16
+#define ZOOM_ARENA_BYTES (2 * arena_bytes(sizeof(float) * ZOOM_SAMPLES) \
+                          + 2 * ZOOM_MAX_STAGES * DECIMATOR_ARENA_BYTES(DECIMATOR_MAX_FACTOR))  // I and Q stages
+
+class ZoomFFT {
+public:
+  // factor must be a product of up to ZOOM_MAX_STAGES factors of 2-8
+  bool begin(float sample_rate, float centre_hz, uint16_t factor);
+  bool is_enabled() { return enabled; }
+  void push(float x);
+  void restart();
+  bool is_ready() { return ready; }
+  // re and im are ZOOM_SAMPLES long and may be overwritten
+  void analyse(ArduinoFFT<float> &fft, float *re, float *im, JsonObject out);
+
+private:
+  bool enabled = false;
+  float centre_hz;
+  float span_hz;
+  uint16_t window_bins;
+  Decimator stages_i[ZOOM_MAX_STAGES];
+  Decimator stages_q[ZOOM_MAX_STAGES];
+  uint8_t n_stages = 0;
+
+  // NCO phasor, rotated by step every sample
+  float nco_re = 1, nco_im = 0;
+  float step_re, step_im;
+
+  float *samples_i = NULL;
+  float *samples_q = NULL;
+  uint16_t count = 0;
+  volatile bool ready = false;  // set by push() when full, cleared by analyse()
+};
+
+extern ZoomFFT zoom;
+
+#endif
@@ -0,0 +1,707 @@
+// ----------------------------------------------------------------------
+//
+//   Fleet load generator - main loop and reporting
+//
+//   Copyright (C) 2022  Shoestring and University of Cambridge
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, version 3 of the License.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see https://www.gnu.org/licenses/.
+//
+// ----------------------------------------------------------------------
+
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <netdb.h>
+#include <poll.h>
+#include <string>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+#include "frame_source.h"
+#include "mqtt_connection.h"
+
+/**********************************************************
+ * Emulates a fleet of vibration monitors against an MQTT
+ * broker and measures what the broker makes of it.
+ *
+ * Every virtual device opens its own connection as the
+ * firmware does: client id = identifier, will on
+ * status/<id>/alive {"connected":false} (QoS 1, retained),
+ * then a retained {"connected":true}. It then publishes a
+ * frame per channel to <mqtt_topic>/<id> every period (+-
+ * jitter) and a metrics message to status/<id>/metrics
+ * every minute.
+ *
+ * Latency is measured two ways: QoS 1 publishes are timed
+ * to their PUBACK, and a subscriber on <mqtt_topic>/# times
+ * every frame from being queued to being delivered (the
+ * frame is matched on its "timestamp"). Both go through one
+ * poll() loop on one thread, so keep an eye on the
+ * "late" count: it means the generator itself fell behind.
+ **/
+
+#define KEEPALIVE_S 15          // PubSubClient default
+#define METRICS_PERIOD_MS 60000 // as the firmware
+#define RETRY_MS 1000           // MQTT_RETRY_MIN_MS
+#define MAX_BACKLOG 262144      // bytes queued on one connection before frames are skipped
+#define DRAIN_MS 2000
+
+struct Options {
+  std::string host = "127.0.0.1";
+  std::string port = "1883";
+  int devices = 100;
+  double period_ms = FRAME_PERIOD_MS;
+  double jitter_ms = 50;
+  double duration_s = 60;
+  double ramp = 50;  // connects per second
+  int qos = 0;
+  int batch = 1;
+  int channels = 1;
+  bool zoom = false;
+  bool metrics = true;
+  bool subscribe = true;
+  bool abrupt = false;
+  double report_s = 5;
+  uint32_t seed = 1;
+  std::string topic = "vibration_monitoring";
+  std::string id_prefix = "machine_";
+  std::string capture;
+};
+
+struct Sent {
+  uint64_t queued_us;
+  std::string timestamp;
+};
+
+struct Device {
+  enum State { idle, connecting, handshake, online, retry };
+  std::string id;
+  std::string data_topic;
+  std::string status_topic;
+  std::string metrics_topic;
+  MqttConnection conn;
+  State state = idle;
+  uint64_t state_since_us = 0;
+  uint64_t next_frame_us = 0;
+  uint64_t next_metrics_us = 0;
+  uint64_t last_packet_us = 0;
+  uint64_t sequence = 0;
+  std::unordered_map<uint16_t, uint64_t> inflight;  // QoS 1 packet id -> queued time
+  std::deque<Sent> unseen;                         // frames the subscriber has not seen yet
+  std::vector<std::string> batch;
+};
+
+// latency samples in ms
+class Latency {
+public:
+  void add(double ms) {
+    samples.push_back(ms);
+    interval.push_back(ms);
+  }
+  size_t count() { return samples.size(); }
+  std::string summary(bool whole_run) {
+    std::vector<double> &s = whole_run ? samples : interval;
+    if (s.empty()) {
+      return "-";
+    }
+    std::sort(s.begin(), s.end());
+    char text[160];
+    snprintf(text, sizeof(text), "p50 %.2f p90 %.2f p99 %.2f p99.9 %.2f max %.2f ms", at(s, 0.5), at(s, 0.9),
+             at(s, 0.99), at(s, 0.999), s.back());
+    return text;
+  }
+  void next_interval() { interval.clear(); }
+
+private:
+  std::vector<double> samples;
+  std::vector<double> interval;
+  static double at(const std::vector<double> &sorted, double p) {
+    size_t i = (size_t)ceil(p * sorted.size());
+    return sorted[std::min(i ? i - 1 : 0, sorted.size() - 1)];
+  }
+};
+
+struct Counters {
+  uint64_t frames = 0;
+  uint64_t messages = 0;
+  uint64_t payload_bytes = 0;
+  uint64_t received = 0;
+  uint64_t late = 0;
+  uint64_t skipped = 0;
+  uint64_t connects = 0;
+  uint64_t disconnects = 0;
+};
+
+static Options options;
+static volatile sig_atomic_t interrupted = 0;
+static std::vector<std::unique_ptr<Device>> devices;
+static std::unordered_map<std::string, Device *> by_topic;
+static Latency connect_latency;
+static Latency puback_latency;
+static Latency delivery_latency;
+static Counters total;
+static Counters interval;
+static uint64_t rng_state;
+
+static uint64_t now_us() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1000000ull + t.tv_nsec / 1000;
+}
+
+static uint64_t wall_us() {
+  struct timespec t;
+  clock_gettime(CLOCK_REALTIME, &t);
+  return t.tv_sec * 1000000ull + t.tv_nsec / 1000;
+}
+
+static double uniform() {
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 7;
+  rng_state ^= rng_state << 17;
+  return (rng_state >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// "timestamp" value of the frame starting at or after from, the end of it in next
+static std::string find_timestamp(const std::string &payload, size_t from = 0, size_t *next = nullptr) {
+  static const std::string key = "\"timestamp\":\"";
+  size_t start = payload.find(key, from);
+  if (start == std::string::npos) {
+    if (next) {
+      *next = std::string::npos;
+    }
+    return "";
+  }
+  start += key.size();
+  size_t end = payload.find('"', start);
+  if (next) {
+    *next = end;
+  }
+  return payload.substr(start, end - start);
+}
+
+static void count_publish(size_t bytes, uint64_t frames) {
+  for (Counters *c : { &total, &interval }) {
+    c->messages++;
+    c->frames += frames;
+    c->payload_bytes += bytes;
+  }
+}
+
+/****** Devices ******/
+
+static void set_state(Device &d, Device::State state, uint64_t now) {
+  d.state = state;
+  d.state_since_us = now;
+}
+
+static void drop_connection(Device &d, uint64_t now) {
+  if (d.state == Device::online) {
+    total.disconnects++;
+    interval.disconnects++;
+  }
+  d.conn.close();
+  d.inflight.clear();
+  d.unseen.clear();
+  d.batch.clear();
+  set_state(d, Device::retry, now);
+}
+
+static void start_connection(Device &d, const struct addrinfo *address, uint64_t now) {
+  if (!d.conn.open(address->ai_addr, address->ai_addrlen)) {
+    set_state(d, Device::retry, now);
+    return;
+  }
+  set_state(d, Device::connecting, now);
+}
+
+static void publish(Device &d, const std::string &topic, const std::string &payload, uint8_t qos, bool retain,
+                    uint64_t now) {
+  uint16_t id = d.conn.publish(topic, payload, qos, retain);
+  if (id) {
+    d.inflight[id] = now;
+  }
+  d.last_packet_us = now;
+}
+
+static void flush_batch(Device &d, uint64_t now) {
+  if (d.batch.empty()) {
+    return;
+  }
+  std::string joined = "[";
+  for (size_t i = 0; i < d.batch.size(); i++) {
+    joined += (i ? "," : "") + d.batch[i];
+  }
+  joined += "]";
+  publish(d, d.data_topic, joined, options.qos, false, now);
+  count_publish(joined.size(), d.batch.size());
+  d.batch.clear();
+}
+
+static void publish_frames(Device &d, FrameSource &frames, uint64_t now) {
+  if (d.conn.pending() > MAX_BACKLOG) {
+    total.skipped += options.channels;
+    interval.skipped += options.channels;
+    return;
+  }
+  for (uint8_t c = 0; c < options.channels; c++) {
+    std::string payload = frames.frame(d.id, c, d.sequence++, wall_us());
+    if (options.subscribe) {
+      d.unseen.push_back({ now, find_timestamp(payload) });
+    }
+    if (options.batch <= 1) {
+      publish(d, d.data_topic, payload, options.qos, false, now);
+      count_publish(payload.size(), 1);
+      continue;
+    }
+    d.batch.push_back(payload);
+    if ((int)d.batch.size() >= options.batch) {
+      flush_batch(d, now);
+    }
+  }
+}
+
+static void on_device_packet(Device &d, const MqttPacket &packet, uint64_t now) {
+  if (packet.type == MQTT_CONNACK) {
+    if (packet.return_code != 0) {
+      fprintf(stderr, "%s: connection refused, code %u\n", d.id.c_str(), packet.return_code);
+      drop_connection(d, now);
+      return;
+    }
+    connect_latency.add((now - d.state_since_us) / 1000.0);
+    total.connects++;
+    interval.connects++;
+    set_state(d, Device::online, now);
+    publish(d, d.status_topic, "{\"connected\":true}", 0, true, now);
+    // devices come up at random points of their period
+    d.next_frame_us = now + (uint64_t)(uniform() * options.period_ms * 1000);
+    d.next_metrics_us = now + METRICS_PERIOD_MS * 1000ull;
+  } else if (packet.type == MQTT_PUBACK) {
+    auto sent = d.inflight.find(packet.id);
+    if (sent != d.inflight.end()) {
+      puback_latency.add((now - sent->second) / 1000.0);
+      d.inflight.erase(sent);
+    }
+  }
+}
+
+// the subscriber sees every frame; each is matched to its device's oldest unseen frame with the same timestamp
+static void on_subscriber_packet(MqttConnection &subscriber, const MqttPacket &packet, uint64_t now) {
+  if (packet.type != MQTT_PUBLISH) {
+    return;
+  }
+  if (packet.id) {
+    subscriber.puback(packet.id);
+  }
+  total.received++;
+  interval.received++;
+  auto device = by_topic.find(packet.topic);
+  if (device == by_topic.end()) {
+    return;
+  }
+  // a batch carries several frames
+  std::deque<Sent> &unseen = device->second->unseen;
+  size_t next = 0;
+  for (;;) {
+    std::string timestamp = find_timestamp(packet.payload, next, &next);
+    if (next == std::string::npos) {
+      break;
+    }
+    for (size_t i = 0; i < unseen.size(); i++) {
+      if (unseen[i].timestamp == timestamp) {
+        delivery_latency.add((now - unseen[i].queued_us) / 1000.0);
+        unseen.erase(unseen.begin(), unseen.begin() + i + 1);
+        break;
+      }
+    }
+  }
+}
+
+/****** Reporting ******/
+
+static void report(uint64_t elapsed_us, double seconds, bool whole_run) {
+  Counters &c = whole_run ? total : interval;
+  size_t online = 0;
+  size_t inflight = 0;
+  size_t backlog = 0;
+  for (auto &d : devices) {
+    online += d->state == Device::online;
+    inflight += d->inflight.size();
+    backlog += d->conn.pending();
+  }
+  printf("%s%7.1fs  online %zu/%zu  sent %.1f msg/s %.1f frames/s %.3f MB/s  recv %.1f msg/s  "
+         "inflight %zu  backlog %zu B  late %llu  skipped %llu  drops %llu\n",
+         whole_run ? "total    " : "", elapsed_us / 1e6, online, devices.size(), c.messages / seconds,
+         c.frames / seconds, c.payload_bytes / seconds / 1e6, c.received / seconds, inflight, backlog,
+         (unsigned long long)c.late, (unsigned long long)c.skipped, (unsigned long long)c.disconnects);
+  if (options.qos > 0) {
+    printf("  puback   %s\n", puback_latency.summary(whole_run).c_str());
+  }
+  if (options.subscribe) {
+    printf("  delivery %s\n", delivery_latency.summary(whole_run).c_str());
+  }
+  if (whole_run) {
+    printf("  connect  %s\n", connect_latency.summary(true).c_str());
+    printf("  %llu frames in %llu messages, %llu payload bytes, mean %.0f B/message\n",
+           (unsigned long long)c.frames, (unsigned long long)c.messages, (unsigned long long)c.payload_bytes,
+           c.messages ? (double)c.payload_bytes / c.messages : 0.0);
+  }
+  fflush(stdout);
+  puback_latency.next_interval();
+  delivery_latency.next_interval();
+  interval = Counters();
+}
+
+/****** Command line ******/
+
+static void usage() {
+  fprintf(stderr,
+          "usage: fleet_loadgen [options]\n"
+          "  --host HOST          broker (default 127.0.0.1)\n"
+          "  --port PORT          broker port (default 1883)\n"
+          "  --devices N          virtual devices (default 100)\n"
+          "  --period-ms MS       time between frames per device (default %d, 1024 samples at 300Hz)\n"
+          "  --jitter-ms MS       uniform +-jitter on each period (default 50)\n"
+          "  --duration S         seconds of publishing (default 60)\n"
+          "  --ramp N             new connections per second (default 50)\n"
+          "  --qos 0|1            QoS of the frames (default 0, as PubSubClient)\n"
+          "  --batch K            publish K frames as one JSON array message\n"
+          "  --channels N         frames per period per device, tagged as in the sketch\n"
+          "  --zoom               include a zoom spectrum in channel 0's frames\n"
+          "  --capture FILE       publish the payloads of a replay_sim capture\n"
+          "  --no-metrics         no status/<id>/metrics messages\n"
+          "  --no-subscribe       no delivery latency subscriber\n"
+          "  --abrupt             close connections at the end without DISCONNECT, so the wills fire\n"
+          "  --topic TOPIC        mqtt_topic (default vibration_monitoring)\n"
+          "  --id-prefix PREFIX   identifiers are PREFIX1..PREFIXN (default machine_)\n"
+          "  --report S           seconds between progress lines (default 5, 0 for none)\n"
+          "  --seed N             random seed (default 1)\n",
+          FRAME_PERIOD_MS);
+  exit(2);
+}
+
+static void parse_args(int argc, char **argv) {
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    auto value = [&]() -> std::string {
+      if (i + 1 >= argc) {
+        usage();
+      }
+      return argv[++i];
+    };
+    if (arg == "--host") {
+      options.host = value();
+    } else if (arg == "--port") {
+      options.port = value();
+    } else if (arg == "--devices") {
+      options.devices = atoi(value().c_str());
+    } else if (arg == "--period-ms") {
+      options.period_ms = atof(value().c_str());
+    } else if (arg == "--jitter-ms") {
+      options.jitter_ms = atof(value().c_str());
+    } else if (arg == "--duration") {
+      options.duration_s = atof(value().c_str());
+    } else if (arg == "--ramp") {
+      options.ramp = atof(value().c_str());
+    } else if (arg == "--qos") {
+      options.qos = atoi(value().c_str()) ? 1 : 0;
+    } else if (arg == "--batch") {
+      options.batch = std::max(1, atoi(value().c_str()));
+    } else if (arg == "--channels") {
+      options.channels = std::min(std::max(1, atoi(value().c_str())), 4);
+    } else if (arg == "--zoom") {
+      options.zoom = true;
+    } else if (arg == "--capture") {
+      options.capture = value();
+    } else if (arg == "--no-metrics") {
+      options.metrics = false;
+    } else if (arg == "--no-subscribe") {
+      options.subscribe = false;
+    } else if (arg == "--abrupt") {
+      options.abrupt = true;
+    } else if (arg == "--topic") {
+      options.topic = value();
+    } else if (arg == "--id-prefix") {
+      options.id_prefix = value();
+    } else if (arg == "--report") {
+      options.report_s = atof(value().c_str());
+    } else if (arg == "--seed") {
+      options.seed = strtoul(value().c_str(), nullptr, 0);
+    } else {
+      usage();
+    }
+  }
+  if (options.devices < 1 || options.period_ms <= 0 || options.ramp <= 0) {
+    usage();
+  }
+}
+
+/****** Main loop ******/
+
+// poll() slots for each connection, rebuilt every pass
+struct Slot {
+  Device *device;  // nullptr for the subscriber
+  MqttConnection *conn;
+};
+
+static bool connect_done(MqttConnection &conn) {
+  int error = 0;
+  socklen_t length = sizeof(error);
+  return getsockopt(conn.get_fd(), SOL_SOCKET, SO_ERROR, &error, &length) == 0 && error == 0;
+}
+
+int main(int argc, char **argv) {
+  parse_args(argc, argv);
+  signal(SIGINT, [](int) { interrupted = interrupted + 1; });  // a second ^C skips the drain
+  signal(SIGPIPE, SIG_IGN);
+  rng_state = options.seed * 0x9E3779B97F4A7C15ull + 1;
+
+  // one descriptor per device
+  struct rlimit limit;
+  if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+  }
+
+  struct addrinfo hints = {};
+  hints.ai_socktype = SOCK_STREAM;
+  struct addrinfo *address = nullptr;
+  int err = getaddrinfo(options.host.c_str(), options.port.c_str(), &hints, &address);
+  if (err != 0) {
+    fprintf(stderr, "%s: %s\n", options.host.c_str(), gai_strerror(err));
+    return 2;
+  }
+
+  FrameSource frames(options.seed);
+  frames.set_channels(options.channels);
+  frames.set_zoom(options.zoom);
+  if (!options.capture.empty()) {
+    std::string error;
+    if (!frames.load_capture(options.capture, error)) {
+      fprintf(stderr, "%s\n", error.c_str());
+      return 2;
+    }
+  }
+
+  for (int i = 0; i < options.devices; i++) {
+    std::unique_ptr<Device> d(new Device());
+    d->id = options.id_prefix + std::to_string(i + 1);
+    d->data_topic = options.topic + "/" + d->id;
+    d->status_topic = "status/" + d->id + "/alive";
+    d->metrics_topic = "status/" + d->id + "/metrics";
+    by_topic[d->data_topic] = d.get();
+    devices.push_back(std::move(d));
+  }
+
+  MqttConnection subscriber;
+  bool subscribed = !options.subscribe;
+  uint64_t start = now_us();
+  if (options.subscribe) {
+    if (!subscriber.open(address->ai_addr, address->ai_addrlen)) {
+      fprintf(stderr, "cannot connect to %s:%s\n", options.host.c_str(), options.port.c_str());
+      return 2;
+    }
+    subscriber.connect("fleet_loadgen_" + std::to_string(getpid()), "", "", 0, false, KEEPALIVE_S * 4);
+    subscriber.subscribe(options.topic + "/#", 0);
+  }
+
+  printf("%d devices, %.0f ms +-%.0f ms, %d channel%s, QoS %d, batch %d, %s payloads -> %s:%s\n",
+         options.devices, options.period_ms, options.jitter_ms, options.channels, options.channels > 1 ? "s" : "",
+         options.qos, options.batch, frames.has_capture() ? "captured" : "synthetic", options.host.c_str(),
+         options.port.c_str());
+
+  uint64_t publish_start = 0;
+  uint64_t publish_end = 0;
+  uint64_t drain_end = 0;
+  uint64_t next_connect = 0;
+  uint64_t next_report = 0;
+  size_t started = 0;
+  std::vector<struct pollfd> fds;
+  std::vector<Slot> slots;
+
+  for (;;) {
+    uint64_t now = now_us();
+
+    // the run starts once the subscriber is in place
+    if (subscribed && publish_start == 0) {
+      publish_start = now;
+      publish_end = now + (uint64_t)(options.duration_s * 1e6);
+      next_connect = now;
+      next_report = now + (uint64_t)(options.report_s * 1e6);
+    }
+    bool publishing = publish_start && now < publish_end && !interrupted;
+    if (publish_start && !publishing && drain_end == 0) {
+      // stop publishing, give acks and deliveries a moment to arrive
+      drain_end = now + DRAIN_MS * 1000ull;
+      for (auto &d : devices) {
+        if (d->state == Device::online) {
+          flush_batch(*d, now);
+        }
+      }
+    }
+    if (drain_end) {
+      bool idle = true;
+      for (auto &d : devices) {
+        idle = idle && d->inflight.empty() && d->unseen.empty() && d->conn.pending() == 0;
+      }
+      if (idle || now >= drain_end || interrupted > 1) {
+        break;
+      }
+    }
+    if (!publish_start && now - start > 5000000) {
+      fprintf(stderr, "no SUBACK from the broker\n");
+      return 2;
+    }
+
+    uint64_t wake = now + 50000;
+    if (publishing) {
+      while (started < devices.size() && now >= next_connect) {
+        start_connection(*devices[started++], address, now);
+        next_connect += (uint64_t)(1e6 / options.ramp);
+      }
+      if (started < devices.size()) {
+        wake = std::min(wake, next_connect);
+      }
+      for (auto &dp : devices) {
+        Device &d = *dp;
+        if (d.state == Device::retry && now - d.state_since_us >= RETRY_MS * 1000ull) {
+          start_connection(d, address, now);
+        }
+        if (d.state != Device::online) {
+          continue;
+        }
+        if (now >= d.next_frame_us) {
+          // a whole period behind means the generator cannot keep up
+          if (now - d.next_frame_us > options.period_ms * 1000) {
+            total.late++;
+            interval.late++;
+          }
+          publish_frames(d, frames, now);
+          double jitter = (2 * uniform() - 1) * options.jitter_ms;
+          d.next_frame_us += (uint64_t)std::max(0.0, (options.period_ms + jitter) * 1000);
+          if (d.next_frame_us < now) {
+            d.next_frame_us = now;
+          }
+        }
+        if (options.metrics && now >= d.next_metrics_us) {
+          std::string payload = frames.metrics(d.id, (now - d.state_since_us) / 1000);
+          publish(d, d.metrics_topic, payload, 0, false, now);
+          count_publish(payload.size(), 0);
+          d.next_metrics_us += METRICS_PERIOD_MS * 1000ull;
+        }
+        if (now - d.last_packet_us >= KEEPALIVE_S * 1000000ull) {
+          d.conn.ping();
+          d.last_packet_us = now;
+        }
+        wake = std::min(wake, d.next_frame_us);
+      }
+      if (options.report_s > 0 && now >= next_report) {
+        report(now - publish_start, options.report_s, false);
+        next_report += (uint64_t)(options.report_s * 1e6);
+      }
+    }
+
+    fds.clear();
+    slots.clear();
+    if (options.subscribe) {
+      fds.push_back({ subscriber.get_fd(), (short)(POLLIN | (subscriber.pending() ? POLLOUT : 0)), 0 });
+      slots.push_back({ nullptr, &subscriber });
+    }
+    for (auto &d : devices) {
+      if (!d->conn.is_open()) {
+        continue;
+      }
+      bool want_write = d->state == Device::connecting || d->conn.pending();
+      fds.push_back({ d->conn.get_fd(), (short)(POLLIN | (want_write ? POLLOUT : 0)), 0 });
+      slots.push_back({ d.get(), &d->conn });
+    }
+    int timeout_ms = wake > now ? (int)((wake - now + 999) / 1000) : 0;
+    if (poll(fds.data(), fds.size(), timeout_ms) < 0 && errno != EINTR) {
+      perror("poll");
+      return 2;
+    }
+
+    now = now_us();
+    for (size_t i = 0; i < fds.size(); i++) {
+      short events = fds[i].revents;
+      if (!events) {
+        continue;
+      }
+      Device *d = slots[i].device;
+      MqttConnection &conn = *slots[i].conn;
+      if (d && d->state == Device::connecting && (events & (POLLOUT | POLLERR | POLLHUP))) {
+        if (!connect_done(conn)) {
+          drop_connection(*d, now);
+          continue;
+        }
+        conn.connect(d->id, d->status_topic, "{\"connected\":false}", 1, true, KEEPALIVE_S);
+        d->last_packet_us = now;
+        set_state(*d, Device::handshake, now);
+      }
+      bool ok = true;
+      if (events & (POLLIN | POLLHUP | POLLERR)) {
+        ok = conn.receive([&](const MqttPacket &packet) {
+          if (d) {
+            on_device_packet(*d, packet, now);
+          } else if (packet.type == MQTT_SUBACK) {
+            subscribed = true;
+          } else {
+            on_subscriber_packet(subscriber, packet, now);
+          }
+        });
+      }
+      ok = ok && conn.flush();
+      if (!ok) {
+        if (d) {
+          drop_connection(*d, now);
+        } else {
+          fprintf(stderr, "subscriber connection lost\n");
+          return 2;
+        }
+      }
+    }
+  }
+
+  uint64_t end = now_us();
+  for (auto &d : devices) {
+    if (d->conn.is_open() && !options.abrupt) {
+      d->conn.disconnect();
+      d->conn.flush();
+    }
+    d->conn.close();
+  }
+  freeaddrinfo(address);
+
+  double seconds = publish_start ? std::min(end, publish_end) - publish_start : 0;
+  report(end - publish_start, std::max(seconds / 1e6, 1e-3), true);
+  size_t unacked = 0;
+  size_t undelivered = 0;
+  for (auto &d : devices) {
+    unacked += d->inflight.size();
+    undelivered += d->unseen.size();
+  }
+  if (unacked || undelivered) {
+    printf("  %zu publishes never acknowledged, %zu frames never delivered\n", unacked, undelivered);
+  }
+  return 0;
+}
@@ -0,0 +1,164 @@
+// ----------------------------------------------------------------------
+//
+//   Fleet load generator - device payloads
+//
+//   Copyright (C) 2022  Shoestring and University of Cambridge
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, version 3 of the License.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see https://www.gnu.org/licenses/.
+//
+// ----------------------------------------------------------------------
+
+
+#include "frame_source.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <ctime>
+#include <fstream>
+
+// replay_sim capture lines are <millis>\t<topic>\t<payload>
+bool FrameSource::load_capture(const std::string &path, std::string &error) {
+  std::ifstream file(path);
+  if (!file) {
+    error = "cannot open " + path;
+    return false;
+  }
+  std::string line;
+  while (std::getline(file, line)) {
+    size_t first = line.find('\t');
+    size_t second = first == std::string::npos ? first : line.find('\t', first + 1);
+    if (second == std::string::npos) {
+      continue;
+    }
+    std::string topic = line.substr(first + 1, second - first - 1);
+    std::string payload = line.substr(second + 1);
+    if (topic.rfind("status/", 0) != 0) {
+      frames.push_back(payload);
+    } else if (topic.size() > 8 && topic.compare(topic.size() - 8, 8, "/metrics") == 0) {
+      metrics_template = payload;
+    }
+  }
+  if (frames.empty()) {
+    error = path + ": no data frames";
+    return false;
+  }
+  return true;
+}
+
+double FrameSource::uniform() {
+  rng ^= rng << 13;
+  rng ^= rng >> 7;
+  rng ^= rng << 17;
+  return (rng >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// ArduinoJson prints floats with up to 9 significant digits
+std::string FrameSource::number(double value) {
+  char text[32];
+  snprintf(text, sizeof(text), "%.9g", (double)(float)value);
+  return text;
+}
+
+// as ShoestringLib::get_timestamp, milliseconds not zero padded
+std::string FrameSource::timestamp(uint64_t wall_us) {
+  time_t seconds = wall_us / 1000000;
+  struct tm t;
+  gmtime_r(&seconds, &t);
+  char text[48];
+  size_t n = strftime(text, sizeof(text), "%Y-%m-%dT%H:%M:%S", &t);
+  snprintf(text + n, sizeof(text) - n, ".%d+00:00", (int)(wall_us / 1000 % 1000));
+  return text;
+}
+
+void FrameSource::replace_value(std::string &payload, const char *key, const std::string &value) {
+  std::string pattern = std::string("\"") + key + "\":\"";
+  size_t start = payload.find(pattern);
+  if (start == std::string::npos) {
+    return;
+  }
+  start += pattern.size();
+  size_t end = payload.find('"', start);
+  if (end != std::string::npos) {
+    payload.replace(start, end - start, value);
+  }
+}
+
+std::string FrameSource::frame(const std::string &id, uint8_t channel, uint64_t sequence, uint64_t wall_us) {
+  if (!frames.empty()) {
+    std::string payload = frames[sequence % frames.size()];
+    replace_value(payload, "timestamp", timestamp(wall_us));
+    replace_value(payload, "id", id);
+    return payload;
+  }
+
+  std::string out = "{";
+  if (channels > 1) {
+    out += "\"channel\":" + std::to_string(channel);
+    out += ",\"sensor\":\"adxl345@i2c0:0x" + std::string(channel ? "1d" : "53") + "\"";
+    out += ",\"frame_start_us\":" + std::to_string((uint32_t)(wall_us - channel * 1000));
+    out += ",";
+  }
+  double peak_hz = 50 + 5 * uniform();
+  out += "\"acceleration\":" + number(0.5 + 0.5 * uniform());
+  out += ",\"peakFrequency\":" + number(peak_hz);
+  out += ",\"fft\":[";
+  for (int i = 0; i < FRAME_BANDS; i++) {
+    char tag[16];
+    snprintf(tag, sizeof(tag), "%c-%d", 'A' + i, i * 10);
+    out += std::string(i ? "," : "") + "{\"frequency\":\"" + tag + "\",\"magnitude\":" + number(1 + 40 * uniform()) + "}";
+  }
+  out += "],\"velocity_bands\":[";
+  double velocity = 0;
+  for (int i = 0; i < FRAME_BANDS; i++) {
+    double band = i ? round(300 * uniform()) / 100 : 0;
+    velocity += band * band;
+    out += std::string(i ? "," : "") + number(band);
+  }
+  velocity = sqrt(velocity);
+  out += "],\"velocity\":" + number(velocity);
+  out += ",\"velocity_zone\":\"" + std::string(velocity < 0.71 ? "A" : velocity < 1.8 ? "B" : velocity < 4.5 ? "C" : "D") + "\"";
+  if (zoom && channel == 0) {
+    out += ",\"zoom\":{\"magnitude\":[";
+    for (int i = 0; i < FRAME_ZOOM_BINS; i++) {
+      out += std::string(i ? "," : "") + number(round(100 * uniform()) / 100);
+    }
+    int peak = 102 + (int)(820 * uniform());  // the inner 80% of the span
+    int first = std::min(std::max(peak - FRAME_ZOOM_BINS / 2, 0), 1024 - FRAME_ZOOM_BINS);
+    out += "],\"centre\":50,\"span\":18.75,\"resolution\":0.0183105469";
+    out += ",\"start\":" + number(40.625 + 0.0183105469 * first) + ",\"bins\":" + std::to_string(FRAME_ZOOM_BINS);
+    out += ",\"peak\":" + number(40.625 + 0.0183105469 * peak) + "}";
+  }
+  out += ",\"temperature\":" + number(20 + 0.25 * (int)(20 * uniform()));
+  out += ",\"aux_age_ms\":{\"temperature\":" + std::to_string((int)(5000 * uniform())) + "}";
+  out += ",\"timestamp\":\"" + timestamp(wall_us) + "\"";
+  out += ",\"id\":\"" + id + "\"}";
+  return out;
+}
+
+std::string FrameSource::metrics(const std::string &id, uint64_t uptime_ms) {
+  if (!metrics_template.empty()) {
+    return metrics_template;
+  }
+  return "{\"uptime_ms\":" + std::to_string(uptime_ms) +
+         ",\"wifi\":{\"connects\":1,\"disconnects\":0,\"fast_connects\":0,\"fast_misses\":0,\"last_connect_ms\":2841,"
+         "\"max_connect_ms\":2841,\"mean_connect_ms\":2841,\"rssi\":-61},"
+         "\"boot\":{\"phase_ms\":{\"runtime\":312,\"serial\":1,\"display\":121,\"config\":18,\"wifi_start\":3,"
+         "\"mqtt_setup\":1,\"sensors\":24,\"tasks\":1},\"at_ms\":{\"wifi_connected\":3322,\"time_synced\":3410,"
+         "\"mqtt_connected\":3391,\"first_buffer\":3893,\"first_frame\":3911}},"
+         "\"config\":{\"version\":3,\"crc_ok\":true,\"commits\":0,\"last_changed\":0},"
+         "\"i2c0\":{\"sample\":{\"n\":18007,\"wait_max_us\":212,\"wait_mean_us\":1,\"hold_max_us\":486,\"hold_mean_us\":371},"
+         "\"slow\":{\"n\":13,\"wait_max_us\":1180,\"wait_mean_us\":95,\"hold_max_us\":301,\"hold_mean_us\":262},"
+         "\"deferred\":4},\"aux\":{\"temperature\":{\"period_ms\":5000,\"reads\":13,\"failures\":0,\"read_max_us\":1467}},"
+         "\"sampler\":{\"channels\":" + std::to_string(channels) +
+         ",\"read_errors\":0,\"tick_max_us\":742,\"period_us\":3333,\"decimation\":1}}";
+}
@@ -0,0 +1,75 @@
+// ----------------------------------------------------------------------
+//
+//   Fleet load generator - device payloads
+//
+//   Copyright (C) 2022  Shoestring and University of Cambridge
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, version 3 of the License.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see https://www.gnu.org/licenses/.
+//
+// ----------------------------------------------------------------------
+
+
+#ifndef FRAME_SOURCE_H
+#define FRAME_SOURCE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**********************************************************
+ * Payloads in the format ShoestringLib::loop publishes.
+ *
+ * Synthetic frames follow loop_callback field for field and
+ * in the same order (channel tags when there are several
+ * channels, acceleration, peakFrequency, fft bands,
+ * velocity, optional zoom, temperature, timestamp, id) with
+ * plausible random values, formatted as ArduinoJson prints
+ * them, so sizes match the device's to within a few bytes.
+ *
+ * With a replay_sim capture loaded the devices publish the
+ * captured payloads instead, byte for byte apart from the
+ * "timestamp" and "id" values - the way to measure a
+ * payload change before it is rolled out.
+ **/
+
+#define FRAME_BANDS 16         // n_bands+1 in the sketch
+#define FRAME_ZOOM_BINS 64     // ZOOM_MAX_BINS, zoom_factor 16
+#define FRAME_PERIOD_MS 3413   // 1024 samples at 300Hz
+
+class FrameSource {
+public:
+  FrameSource(uint32_t seed)
+    : rng(seed ? seed : 1) {}
+  bool load_capture(const std::string &path, std::string &error);
+  bool has_capture() { return !frames.empty(); }
+  void set_channels(uint8_t channels) { this->channels = channels; }
+  void set_zoom(bool zoom) { this->zoom = zoom; }
+
+  // one frame of channel of device id, timestamped with wall_us
+  std::string frame(const std::string &id, uint8_t channel, uint64_t sequence, uint64_t wall_us);
+  std::string metrics(const std::string &id, uint64_t uptime_ms);
+
+private:
+  uint64_t rng;
+  uint8_t channels = 1;
+  bool zoom = false;
+  std::vector<std::string> frames;
+  std::string metrics_template;
+
+  double uniform();
+  static std::string number(double value);
+  static std::string timestamp(uint64_t wall_us);
+  static void replace_value(std::string &payload, const char *key, const std::string &value);
+};
+
+#endif
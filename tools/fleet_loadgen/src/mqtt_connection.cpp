@@ -0,0 +1,214 @@
+// ----------------------------------------------------------------------
+//
+//   Fleet load generator - MQTT 3.1.1 client connection
+//
+//   Copyright (C) 2022  Shoestring and University of Cambridge
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, version 3 of the License.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see https://www.gnu.org/licenses/.
+//
+// ----------------------------------------------------------------------
+
+
+#include "mqtt_connection.h"
+#include <cerrno>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <unistd.h>
+
+bool MqttConnection::open(const struct sockaddr *address, socklen_t length) {
+  close();
+  fd = socket(address->sa_family, SOCK_STREAM, 0);
+  if (fd < 0) {
+    return false;
+  }
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));  // as the firmware's WiFiClient
+  if (::connect(fd, address, length) < 0 && errno != EINPROGRESS) {
+    close();
+    return false;
+  }
+  return true;
+}
+
+void MqttConnection::close() {
+  if (fd >= 0) {
+    ::close(fd);
+  }
+  fd = -1;
+  output.clear();
+  output_start = 0;
+  input.clear();
+}
+
+void MqttConnection::put_u16(std::string &out, uint16_t value) {
+  out.push_back(value >> 8);
+  out.push_back(value & 0xFF);
+}
+
+void MqttConnection::put_string(std::string &out, const std::string &value) {
+  put_u16(out, value.size());
+  out += value;
+}
+
+void MqttConnection::queue(uint8_t header, const std::string &body) {
+  output.push_back(header);
+  size_t length = body.size();
+  do {
+    uint8_t digit = length % 128;
+    length /= 128;
+    output.push_back(digit | (length ? 0x80 : 0));
+  } while (length);
+  output += body;
+}
+
+void MqttConnection::connect(const std::string &client_id, const std::string &will_topic,
+                             const std::string &will_payload, uint8_t will_qos, bool will_retain,
+                             uint16_t keepalive_s) {
+  std::string body;
+  put_string(body, "MQTT");
+  body.push_back(4);  // protocol level 3.1.1
+  uint8_t flags = 0x02;  // clean session
+  if (!will_topic.empty()) {
+    flags |= 0x04 | (will_qos << 3) | (will_retain ? 0x20 : 0);
+  }
+  body.push_back(flags);
+  put_u16(body, keepalive_s);
+  put_string(body, client_id);
+  if (!will_topic.empty()) {
+    put_string(body, will_topic);
+    put_string(body, will_payload);
+  }
+  queue(MQTT_CONNECT << 4, body);
+}
+
+uint16_t MqttConnection::publish(const std::string &topic, const std::string &payload, uint8_t qos, bool retain) {
+  std::string body;
+  put_string(body, topic);
+  uint16_t id = 0;
+  if (qos > 0) {
+    id = next_id++;
+    if (next_id == 0) {
+      next_id = 1;
+    }
+    put_u16(body, id);
+  }
+  body += payload;
+  queue((MQTT_PUBLISH << 4) | (qos << 1) | (retain ? 1 : 0), body);
+  return id;
+}
+
+void MqttConnection::subscribe(const std::string &filter, uint8_t qos) {
+  std::string body;
+  put_u16(body, next_id++);
+  put_string(body, filter);
+  body.push_back(qos);
+  queue((MQTT_SUBSCRIBE << 4) | 0x02, body);
+}
+
+void MqttConnection::puback(uint16_t id) {
+  std::string body;
+  put_u16(body, id);
+  queue(MQTT_PUBACK << 4, body);
+}
+
+void MqttConnection::ping() {
+  queue(MQTT_PINGREQ << 4, "");
+}
+
+void MqttConnection::disconnect() {
+  queue(MQTT_DISCONNECT << 4, "");
+}
+
+bool MqttConnection::flush() {
+  while (fd >= 0 && pending()) {
+    ssize_t n = ::send(fd, output.data() + output_start, pending(), MSG_NOSIGNAL);
+    if (n < 0) {
+      return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINPROGRESS;
+    }
+    output_start += n;
+    sent += n;
+  }
+  if (output_start > 65536 || output_start == output.size()) {  // compact now and then
+    output.erase(0, output_start);
+    output_start = 0;
+  }
+  return fd >= 0;
+}
+
+bool MqttConnection::receive(const std::function<void(const MqttPacket &)> &handler) {
+  char buffer[16384];
+  for (;;) {
+    ssize_t n = ::recv(fd, buffer, sizeof(buffer), 0);
+    if (n == 0) {
+      return false;  // closed by the broker
+    }
+    if (n < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        break;
+      }
+      return false;
+    }
+    input.append(buffer, n);
+  }
+
+  size_t at = 0;
+  for (;;) {
+    // fixed header: type/flags then 1-4 bytes of remaining length
+    if (input.size() - at < 2) {
+      break;
+    }
+    size_t length = 0;
+    size_t header = 1;
+    int shift = 0;
+    bool complete = false;
+    while (at + header < input.size() && header <= 4) {
+      uint8_t digit = input[at + header++];
+      length |= (size_t)(digit & 0x7F) << shift;
+      shift += 7;
+      if (!(digit & 0x80)) {
+        complete = true;
+        break;
+      }
+    }
+    if (!complete || input.size() - at - header < length) {
+      break;
+    }
+
+    const uint8_t *p = (const uint8_t *)input.data() + at + header;
+    MqttPacket packet = {};
+    packet.type = (uint8_t)input[at] >> 4;
+    packet.flags = input[at] & 0x0F;
+    if (packet.type == MQTT_CONNACK && length >= 2) {
+      packet.return_code = p[1];
+    } else if ((packet.type == MQTT_PUBACK || packet.type == MQTT_SUBACK) && length >= 2) {
+      packet.id = (p[0] << 8) | p[1];
+    } else if (packet.type == MQTT_PUBLISH && length >= 2) {
+      size_t topic_length = (p[0] << 8) | p[1];
+      size_t offset = 2 + topic_length;
+      packet.topic.assign((const char *)p + 2, std::min(topic_length, length - 2));
+      if (((packet.flags >> 1) & 0x03) && offset + 2 <= length) {
+        packet.id = (p[offset] << 8) | p[offset + 1];
+        offset += 2;
+      }
+      if (offset <= length) {
+        packet.payload.assign((const char *)p + offset, length - offset);
+      }
+    }
+    at += header + length;
+    handler(packet);
+  }
+  input.erase(0, at);
+  return true;
+}
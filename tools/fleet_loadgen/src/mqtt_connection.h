@@ -0,0 +1,97 @@
+// ----------------------------------------------------------------------
+//
+//   Fleet load generator - MQTT 3.1.1 client connection
+//
+//   Copyright (C) 2022  Shoestring and University of Cambridge
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, version 3 of the License.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see https://www.gnu.org/licenses/.
+//
+// ----------------------------------------------------------------------
+
+
+#ifndef MQTT_CONNECTION_H
+#define MQTT_CONNECTION_H
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <sys/socket.h>
+
+/**********************************************************
+ * Minimal non-blocking MQTT 3.1.1 client connection.
+ *
+ * Only what a device (or the latency subscriber) needs:
+ * CONNECT with a will, PUBLISH at QoS 0/1, SUBSCRIBE,
+ * PINGREQ and DISCONNECT. Packets are queued into an output
+ * buffer and written by flush() when the socket is
+ * writable, so one thread can drive hundreds of
+ * connections from a poll() loop.
+ **/
+
+#define MQTT_CONNECT 1
+#define MQTT_CONNACK 2
+#define MQTT_PUBLISH 3
+#define MQTT_PUBACK 4
+#define MQTT_SUBSCRIBE 8
+#define MQTT_SUBACK 9
+#define MQTT_PINGREQ 12
+#define MQTT_PINGRESP 13
+#define MQTT_DISCONNECT 14
+
+struct MqttPacket {
+  uint8_t type;
+  uint8_t flags;
+  uint16_t id;          // PUBACK/SUBACK, or PUBLISH at QoS 1
+  uint8_t return_code;  // CONNACK
+  std::string topic;    // PUBLISH
+  std::string payload;  // PUBLISH
+};
+
+class MqttConnection {
+public:
+  ~MqttConnection() { close(); }
+  // starts a non-blocking connect, writable once it completes
+  bool open(const struct sockaddr *address, socklen_t length);
+  void close();
+  int get_fd() { return fd; }
+  bool is_open() { return fd >= 0; }
+
+  void connect(const std::string &client_id, const std::string &will_topic, const std::string &will_payload,
+               uint8_t will_qos, bool will_retain, uint16_t keepalive_s);
+  // returns the packet id for QoS 1, 0 for QoS 0
+  uint16_t publish(const std::string &topic, const std::string &payload, uint8_t qos, bool retain);
+  void subscribe(const std::string &filter, uint8_t qos);
+  void puback(uint16_t id);
+  void ping();
+  void disconnect();
+
+  // false once the connection has failed
+  bool flush();
+  bool receive(const std::function<void(const MqttPacket &)> &handler);
+  size_t pending() { return output.size() - output_start; }
+  uint64_t bytes_sent() { return sent; }
+
+private:
+  int fd = -1;
+  std::string output;
+  size_t output_start = 0;
+  std::string input;
+  uint16_t next_id = 1;
+  uint64_t sent = 0;
+
+  void queue(uint8_t header, const std::string &body);
+  static void put_u16(std::string &out, uint16_t value);
+  static void put_string(std::string &out, const std::string &value);
+};
+
+#endif
@@ -0,0 +1,86 @@
+// ----------------------------------------------------------------------
+//
+//   Replay simulator - ADXL345 stand-in fed from the replay source
+//
+//   Copyright (C) 2022  Shoestring and University of Cambridge
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, version 3 of the License.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see https://www.gnu.org/licenses/.
+//
+// ----------------------------------------------------------------------
+
+
+#ifndef SIM_ADAFRUIT_ADXL345_U_H
+#define SIM_ADAFRUIT_ADXL345_U_H
+
+#include "Adafruit_Sensor.h"
+#include "Wire.h"
+
+/**********************************************************
+ * Each sensor that begin()s successfully becomes the next
+ * replay channel: the first one reads channel 0 of the
+ * recording (or synthetic source), the second channel 1...
+ *
+ * It then answers on Wire at its address, so its data
+ * registers can be read directly. A read that --drop fails
+ * is not acknowledged. getEvent() reads the same registers
+ * and, like the real driver, always returns true.
+ **/
+
+#define ADXL345_DEFAULT_ADDRESS (0x53)
+#define ADXL345_MG2G_MULTIPLIER (0.004)
+
+typedef enum {
+  ADXL345_RANGE_16_G = 0b11,
+  ADXL345_RANGE_8_G = 0b10,
+  ADXL345_RANGE_4_G = 0b01,
+  ADXL345_RANGE_2_G = 0b00
+} range_t;
+
+typedef enum {
+  ADXL345_DATARATE_3200_HZ = 0b1111,
+  ADXL345_DATARATE_1600_HZ = 0b1110,
+  ADXL345_DATARATE_800_HZ = 0b1101,
+  ADXL345_DATARATE_400_HZ = 0b1100,
+  ADXL345_DATARATE_200_HZ = 0b1011,
+  ADXL345_DATARATE_100_HZ = 0b1010,
+  ADXL345_DATARATE_50_HZ = 0b1001,
+  ADXL345_DATARATE_25_HZ = 0b1000,
+  ADXL345_DATARATE_12_5_HZ = 0b0111,
+  ADXL345_DATARATE_6_25HZ = 0b0110
+} dataRate_t;
+
+class Adafruit_ADXL345_Unified : public Adafruit_Sensor {
+public:
+  Adafruit_ADXL345_Unified(int32_t sensor_id = -1) {}
+  bool begin(uint8_t address = ADXL345_DEFAULT_ADDRESS);
+  void setRange(range_t range) { this->range = range; }
+  range_t getRange() { return range; }
+  void setDataRate(dataRate_t rate) { data_rate = rate; }
+  dataRate_t getDataRate() { return data_rate; }
+  bool getEvent(sensors_event_t *event) override;
+
+  // the simulated part, for TwoWire
+  uint8_t sim_address() { return address; }
+  bool sim_write(const uint8_t *data, uint8_t length);  // register pointer, false when not acknowledged
+  bool sim_read(uint8_t *data, uint8_t length);         // from the register pointer on
+
+private:
+  int channel = -1;
+  uint8_t address = ADXL345_DEFAULT_ADDRESS;
+  uint8_t reg = 0;
+  int16_t counts[3] = { 0, 0, 0 };  // the conversion being read
+  range_t range = ADXL345_RANGE_2_G;
+  dataRate_t data_rate = ADXL345_DATARATE_100_HZ;
+};
+
+#endif
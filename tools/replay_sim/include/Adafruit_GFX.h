@@ -0,0 +1,68 @@
+// ----------------------------------------------------------------------
+//
+//   Replay simulator - Adafruit GFX stand-in
+//
+//   Copyright (C) 2022  Shoestring and University of Cambridge
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, version 3 of the License.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see https://www.gnu.org/licenses/.
+//
+// ----------------------------------------------------------------------
+
+
+#ifndef SIM_ADAFRUIT_GFX_H
+#define SIM_ADAFRUIT_GFX_H
+
+#include "Arduino.h"
+
+class Adafruit_GFX : public Print {
+public:
+  Adafruit_GFX(int16_t w, int16_t h)
+    : _width(w), _height(h) {}
+  virtual void drawPixel(int16_t x, int16_t y, uint16_t color) {}
+  void fillScreen(uint16_t) {}
+  void fillRect(int16_t, int16_t, int16_t, int16_t, uint16_t) {}
+  void writeFillRect(int16_t, int16_t, int16_t, int16_t, uint16_t) {}
+  void startWrite() {}
+  void endWrite() {}
+  void drawFastHLine(int16_t, int16_t, int16_t, uint16_t) {}
+  void drawFastVLine(int16_t, int16_t, int16_t, uint16_t) {}
+  void drawRect(int16_t, int16_t, int16_t, int16_t, uint16_t) {}
+  void setCursor(int16_t, int16_t) {}
+  void setTextColor(uint16_t) {}
+  void setTextColor(uint16_t, uint16_t) {}
+  void setTextSize(uint8_t) {}
+  void setTextWrap(bool) {}
+  void setRotation(uint8_t) {}
+  void drawRGBBitmap(int16_t, int16_t, uint16_t *, int16_t, int16_t) {}
+  void drawRGBBitmap(int16_t, int16_t, const uint16_t *, int16_t, int16_t) {}
+  int16_t width() const { return _width; }
+  int16_t height() const { return _height; }
+  size_t write(uint8_t) override { return 1; }
+  using Print::write;
+
+protected:
+  int16_t _width;
+  int16_t _height;
+};
+
+class GFXcanvas16 : public Adafruit_GFX {
+public:
+  GFXcanvas16(uint16_t w, uint16_t h)
+    : Adafruit_GFX(w, h), buffer(w * h) {}
+  uint16_t *getBuffer() { return buffer.data(); }
+
+private:
+  std::vector<uint16_t> buffer;
+};
+
+#endif
@@ -0,0 +1,40 @@
+// ----------------------------------------------------------------------
+//
+//   Replay simulator - MCP9808 stand-in
+//
+//   Copyright (C) 2022  Shoestring and University of Cambridge
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, version 3 of the License.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see https://www.gnu.org/licenses/.
+//
+// ----------------------------------------------------------------------
+
+
+#ifndef SIM_ADAFRUIT_MCP9808_H
+#define SIM_ADAFRUIT_MCP9808_H
+
+#include "Wire.h"
+
+// reads the simulator's --temp value
+class Adafruit_MCP9808 {
+public:
+  Adafruit_MCP9808() {}
+  bool begin(uint8_t address = 0x18, TwoWire *wire = &Wire) { return true; }
+  bool begin(TwoWire *wire) { return begin(0x18, wire); }
+  float readTempC();
+  void setResolution(uint8_t) {}
+  void shutdown_wake(bool) {}
+  void wake() {}
+  void shutdown() {}
+};
+
+#endif
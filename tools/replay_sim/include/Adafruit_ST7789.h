@@ -0,0 +1,46 @@
+// ----------------------------------------------------------------------
+//
+//   Replay simulator - ST7789 stand-in
+//
+//   Copyright (C) 2022  Shoestring and University of Cambridge
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, version 3 of the License.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see https://www.gnu.org/licenses/.
+//
+// ----------------------------------------------------------------------
+
+
+#ifndef SIM_ADAFRUIT_ST7789_H
+#define SIM_ADAFRUIT_ST7789_H
+
+#include "Adafruit_GFX.h"
+
+#define ST77XX_BLACK 0x0000
+#define ST77XX_WHITE 0xFFFF
+#define ST77XX_RED 0xF800
+#define ST77XX_GREEN 0x07E0
+#define ST77XX_BLUE 0x001F
+#define ST77XX_CYAN 0x07FF
+#define ST77XX_MAGENTA 0xF81F
+#define ST77XX_YELLOW 0xFFE0
+#define ST77XX_ORANGE 0xFC00
+
+class Adafruit_ST7789 : public Adafruit_GFX {
+public:
+  Adafruit_ST7789(int8_t cs, int8_t dc, int8_t rst)
+    : Adafruit_GFX(240, 135) {}
+  void init(uint16_t width, uint16_t height, uint8_t spi_mode = 0) {}
+  void setAddrWindow(uint16_t, uint16_t, uint16_t, uint16_t) {}
+  void writePixels(uint16_t *, uint32_t, bool block = true, bool big_endian = false) {}
+};
+
+#endif
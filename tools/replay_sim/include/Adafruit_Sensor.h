@@ -0,0 +1,64 @@
+// ----------------------------------------------------------------------
+//
+//   Replay simulator - Adafruit unified sensor stand-in
+//
+//   Copyright (C) 2022  Shoestring and University of Cambridge
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, version 3 of the License.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see https://www.gnu.org/licenses/.
+//
+// ----------------------------------------------------------------------
+
+
+#ifndef SIM_ADAFRUIT_SENSOR_H
+#define SIM_ADAFRUIT_SENSOR_H
+
+#include "Arduino.h"
+
+#define SENSORS_GRAVITY_STANDARD (9.80665F)
+
+struct sensors_vec_t {
+  float x;
+  float y;
+  float z;
+};
+
+struct sensors_event_t {
+  int32_t version;
+  int32_t sensor_id;
+  int32_t type;
+  int32_t reserved0;
+  int32_t timestamp;
+  union {
+    sensors_vec_t acceleration;
+    float temperature;
+  };
+};
+
+struct sensor_t {
+  char name[12];
+  int32_t version;
+  int32_t sensor_id;
+  int32_t type;
+  float max_value;
+  float min_value;
+  float resolution;
+  int32_t min_delay;
+};
+
+class Adafruit_Sensor {
+public:
+  virtual ~Adafruit_Sensor() {}
+  virtual bool getEvent(sensors_event_t *) = 0;
+};
+
+#endif
@@ -0,0 +1,325 @@
+// ----------------------------------------------------------------------
+//
+//   Replay simulator - Arduino core stand-in for Linux builds
+//
+//   Copyright (C) 2022  Shoestring and University of Cambridge
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, version 3 of the License.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see https://www.gnu.org/licenses/.
+//
+// ----------------------------------------------------------------------
+
+#ifndef SIM_ARDUINO_H
+#define SIM_ARDUINO_H
+
+/**********************************************************
+ * Just enough of the ESP32 Arduino core for the sketch to
+ * build on Linux. Time comes from the simulator's virtual
+ * clock (src/sim.h), so millis()/micros()/delay() and the
+ * wall clock are deterministic and run as fast as the host
+ * can go.
+ **/
+
+#include <math.h>
+#include <string>
+#include <cstring>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <cstdarg>
+#include <functional>
+#include <vector>
+#include <algorithm>
+#include <sys/time.h>
+#include <time.h>
+
+using std::max;
+using std::min;
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define sq(x) ((x) * (x))
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+#define HIGH 1
+#define LOW 0
+#define OUTPUT 1
+#define INPUT 0
+#define INPUT_PULLUP 2
+#define RISING 1
+#define FALLING 2
+#define CHANGE 3
+#define IRAM_ATTR
+#define PI 3.14159265358979323846
+#define TWO_PI 6.28318530717958647693
+#define DEC 10
+#define HEX 16
+
+class String : public std::string {
+public:
+  String() {}
+  String(const char *s)
+    : std::string(s ? s : "") {}
+  String(const std::string &s)
+    : std::string(s) {}
+  String(char c)
+    : std::string(1, c) {}
+  String(int v, int base = DEC)
+    : std::string(format(base == HEX ? "%x" : "%d", v)) {}
+  String(unsigned v, int base = DEC)
+    : std::string(format(base == HEX ? "%x" : "%u", v)) {}
+  String(long v, int base = DEC)
+    : std::string(format(base == HEX ? "%lx" : "%ld", v)) {}
+  String(unsigned long v, int base = DEC)
+    : std::string(format(base == HEX ? "%lx" : "%lu", v)) {}
+  String(long long v)
+    : std::string(std::to_string(v)) {}
+  String(unsigned long long v)
+    : std::string(std::to_string(v)) {}
+  String(double v, int decimals = 2)
+    : std::string(format("%.*f", decimals, v)) {}
+  String(float v, int decimals = 2)
+    : std::string(format("%.*f", decimals, (double)v)) {}
+
+  static std::string format(const char *fmt, ...) {
+    char buffer[64];
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(buffer, sizeof(buffer), fmt, args);
+    va_end(args);
+    return buffer;
+  }
+
+  long toInt() const { return atol(c_str()); }
+  float toFloat() const { return atof(c_str()); }
+  double toDouble() const { return atof(c_str()); }
+  bool equals(const String &other) const { return *this == other; }
+  bool equalsIgnoreCase(const String &other) const { return strcasecmp(c_str(), other.c_str()) == 0; }
+  char charAt(unsigned int i) const { return i < size() ? (*this)[i] : 0; }
+  int indexOf(char c, unsigned int from = 0) const {
+    size_t p = find(c, from);
+    return p == npos ? -1 : (int)p;
+  }
+  int indexOf(const String &s, unsigned int from = 0) const {
+    size_t p = find(s, from);
+    return p == npos ? -1 : (int)p;
+  }
+  int lastIndexOf(char c) const {
+    size_t p = rfind(c);
+    return p == npos ? -1 : (int)p;
+  }
+  String substring(unsigned int from) const { return from >= size() ? String() : String(substr(from)); }
+  String substring(unsigned int from, unsigned int to) const {
+    if (from > to) {
+      std::swap(from, to);
+    }
+    return from >= size() ? String() : String(substr(from, to - from));
+  }
+  void trim() {
+    size_t first = find_first_not_of(" \t\r\n");
+    if (first == npos) {
+      clear();
+      return;
+    }
+    size_t last = find_last_not_of(" \t\r\n");
+    assign(substr(first, last - first + 1));
+  }
+  void toLowerCase() {
+    for (char &c : *this) c = tolower(c);
+  }
+  void toUpperCase() {
+    for (char &c : *this) c = toupper(c);
+  }
+  bool startsWith(const String &prefix) const { return rfind(prefix, 0) == 0; }
+  bool endsWith(const String &suffix) const {
+    return size() >= suffix.size() && compare(size() - suffix.size(), suffix.size(), suffix) == 0;
+  }
+  bool isEmpty() const { return empty(); }
+  void replace(const String &from, const String &to) {
+    if (from.empty()) {
+      return;
+    }
+    for (size_t p = find(from); p != npos; p = find(from, p + to.size())) {
+      std::string::replace(p, from.size(), to);
+    }
+  }
+  void remove(unsigned int index, unsigned int count = (unsigned int)-1) {
+    if (index < size()) {
+      erase(index, count);
+    }
+  }
+  bool concat(const char *s) {
+    append(s);
+    return true;
+  }
+  bool concat(const String &s) {
+    append(s);
+    return true;
+  }
+  bool concat(char c) {
+    push_back(c);
+    return true;
+  }
+  bool reserve(size_t n) {
+    std::string::reserve(n);
+    return true;
+  }
+
+  String &operator+=(const String &s) {
+    append(s);
+    return *this;
+  }
+  String &operator+=(const char *s) {
+    append(s);
+    return *this;
+  }
+  String &operator+=(char c) {
+    push_back(c);
+    return *this;
+  }
+  template<typename T, typename = typename std::enable_if<std::is_arithmetic<T>::value>::type>
+  String &operator+=(T v) {
+    append(String(v));
+    return *this;
+  }
+};
+
+inline String operator+(const String &a, const String &b) {
+  String r(a);
+  r.append(b);
+  return r;
+}
+inline String operator+(const String &a, const char *b) {
+  String r(a);
+  r.append(b);
+  return r;
+}
+inline String operator+(const char *a, const String &b) {
+  String r(a);
+  r.append(b);
+  return r;
+}
+inline String operator+(const String &a, char b) {
+  String r(a);
+  r.push_back(b);
+  return r;
+}
+template<typename T, typename = typename std::enable_if<std::is_arithmetic<T>::value>::type>
+inline String operator+(const String &a, T b) {
+  return a + String(b);
+}
+
+class __FlashStringHelper;
+#define F(x) (x)
+
+class Print {
+public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t c) = 0;
+  virtual size_t write(const uint8_t *buffer, size_t size) {
+    size_t n = 0;
+    while (size--) n += write(*buffer++);
+    return n;
+  }
+  size_t write(const char *s) { return write((const uint8_t *)s, strlen(s)); }
+  size_t write(const char *s, size_t size) { return write((const uint8_t *)s, size); }
+  size_t print(const String &s) { return write(s.c_str()); }
+  size_t print(const char *s) { return write(s); }
+  size_t print(char c) { return write((uint8_t)c); }
+  size_t print(int v, int base = DEC) { return print(String(v, base)); }
+  size_t print(unsigned v, int base = DEC) { return print(String(v, base)); }
+  size_t print(long v, int base = DEC) { return print(String(v, base)); }
+  size_t print(unsigned long v, int base = DEC) { return print(String(v, base)); }
+  size_t print(double v, int decimals = 2) { return print(String(v, decimals)); }
+  template<typename T>
+  size_t println(const T &v) { return print(v) + println(); }
+  template<typename T>
+  size_t println(const T &v, int format) { return print(v, format) + println(); }
+  size_t println() { return print("\n"); }
+  size_t printf(const char *format, ...) __attribute__((format(printf, 2, 3))) {
+    char buffer[512];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+    return print(buffer);
+  }
+};
+
+class Stream : public Print {
+public:
+  virtual int available() { return 0; }
+  virtual int read() { return -1; }
+  virtual int peek() { return -1; }
+  size_t readBytes(char *buffer, size_t length) {
+    size_t n = 0;
+    while (n < length) {
+      int c = read();
+      if (c < 0) {
+        break;
+      }
+      buffer[n++] = c;
+    }
+    return n;
+  }
+  void setTimeout(unsigned long) {}
+};
+
+// Serial goes to stderr so payload captures on stdout stay clean
+class HardwareSerial : public Stream {
+public:
+  void begin(unsigned long) {}
+  void end() {}
+  operator bool() const { return true; }
+  size_t write(uint8_t c) override {
+    fputc(c, stderr);
+    return 1;
+  }
+  size_t write(const uint8_t *buffer, size_t size) override { return fwrite(buffer, 1, size, stderr); }
+  using Print::write;
+  int availableForWrite() { return 128; }
+  void flush() {}
+  void setTxBufferSize(size_t) {}
+};
+
+extern HardwareSerial Serial;
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+void yield();
+
+inline void pinMode(uint8_t, uint8_t) {}
+inline void digitalWrite(uint8_t, uint8_t) {}
+inline int digitalRead(uint8_t) { return LOW; }
+inline int digitalPinToInterrupt(uint8_t pin) { return pin; }
+void attachInterrupt(uint8_t pin, void (*handler)(void), int mode);
+void attachInterruptArg(uint8_t pin, void (*handler)(void *), void *arg, int mode);
+void detachInterrupt(uint8_t pin);
+inline long random(long howbig) { return howbig ? rand() % howbig : 0; }
+inline long random(long howsmall, long howbig) { return howsmall + random(howbig - howsmall); }
+
+// wall clock, synced at boot to the simulator's start time
+bool getLocalTime(struct tm *info, uint32_t ms = 5000);
+void configTime(long gmt_offset_sec, int daylight_offset_sec, const char *server1,
+                const char *server2 = nullptr, const char *server3 = nullptr);
+int sim_gettimeofday(struct timeval *tv, void *tz);
+#define gettimeofday sim_gettimeofday
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "Esp.h"
+
+#endif
@@ -0,0 +1,34 @@
+// ----------------------------------------------------------------------
+//
+//   Replay simulator - DNSServer stand-in
+//
+//   Copyright (C) 2022  Shoestring and University of Cambridge
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, version 3 of the License.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see https://www.gnu.org/licenses/.
+//
+// ----------------------------------------------------------------------
+
+
+#ifndef SIM_DNSSERVER_H
+#define SIM_DNSSERVER_H
+
+#include "WiFi.h"
+
+class DNSServer {
+public:
+  bool start(uint16_t port, const String &domain, IPAddress address) { return true; }
+  void stop() {}
+  void processNextRequest() {}
+};
+
+#endif
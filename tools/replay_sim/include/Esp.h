@@ -0,0 +1,40 @@
+// ----------------------------------------------------------------------
+//
+//   Replay simulator - ESP class stand-in
+//
+//   Copyright (C) 2022  Shoestring and University of Cambridge
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, version 3 of the License.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see https://www.gnu.org/licenses/.
+//
+// ----------------------------------------------------------------------
+
+
+#ifndef SIM_ESP_H
+#define SIM_ESP_H
+
+#include <cstdint>
+
+class EspClass {
+public:
+  uint32_t getCycleCount();  // virtual clock at 240MHz
+  uint32_t getCpuFreqMHz() { return 240; }
+  uint32_t getHeapSize() { return 320 * 1024; }
+  uint32_t getFreeHeap() { return 200 * 1024; }
+  uint32_t getMinFreeHeap() { return 180 * 1024; }
+  uint32_t getMaxAllocHeap() { return 110 * 1024; }
+  void restart();
+};
+
+extern EspClass ESP;
+
+#endif
@@ -0,0 +1,59 @@
+// ----------------------------------------------------------------------
+//
+//   Replay simulator - IPAddress stand-in
+//
+//   Copyright (C) 2022  Shoestring and University of Cambridge
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, version 3 of the License.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see https://www.gnu.org/licenses/.
+//
+// ----------------------------------------------------------------------
+
+
+#ifndef SIM_IPADDRESS_H
+#define SIM_IPADDRESS_H
+
+#include "Arduino.h"
+
+class IPAddress {
+public:
+  IPAddress()
+    : bytes{ 0, 0, 0, 0 } {}
+  IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d)
+    : bytes{ a, b, c, d } {}
+  IPAddress(uint32_t address) { memcpy(bytes, &address, 4); }
+  bool fromString(const char *s) {
+    unsigned part[4];
+    if (sscanf(s, "%u.%u.%u.%u", &part[0], &part[1], &part[2], &part[3]) != 4) {
+      return false;
+    }
+    for (int i = 0; i < 4; i++) bytes[i] = part[i];
+    return true;
+  }
+  bool fromString(const String &s) { return fromString(s.c_str()); }
+  String toString() const {
+    char text[16];
+    snprintf(text, sizeof(text), "%u.%u.%u.%u", bytes[0], bytes[1], bytes[2], bytes[3]);
+    return text;
+  }
+  operator uint32_t() const {
+    uint32_t address;
+    memcpy(&address, bytes, 4);
+    return address;
+  }
+  uint8_t operator[](int i) const { return bytes[i]; }
+
+private:
+  uint8_t bytes[4];
+};
+
+#endif
@@ -0,0 +1,54 @@
+// ----------------------------------------------------------------------
+//
+//   Replay simulator - Preferences stand-in
+//
+//   Copyright (C) 2022  Shoestring and University of Cambridge
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, version 3 of the License.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see https://www.gnu.org/licenses/.
+//
+// ----------------------------------------------------------------------
+
+
+#ifndef SIM_PREFERENCES_H
+#define SIM_PREFERENCES_H
+
+#include "Arduino.h"
+#include <map>
+
+// in memory, starts empty on every run
+class Preferences {
+public:
+  bool begin(const char *name, bool read_only = false);
+  void end() {}
+  bool clear();
+  bool remove(const char *key);
+  bool isKey(const char *key);
+  size_t putInt(const char *key, int32_t value) { return put(key, String((long)value)); }
+  size_t putUInt(const char *key, uint32_t value) { return put(key, String((unsigned long)value)); }
+  size_t putUChar(const char *key, uint8_t value) { return putUInt(key, value); }
+  size_t putString(const char *key, const String &value) { return put(key, value); }
+  size_t putString(const char *key, const char *value) { return put(key, String(value)); }
+  size_t putBytes(const char *key, const void *value, size_t length);
+  int32_t getInt(const char *key, int32_t default_value = 0);
+  uint32_t getUInt(const char *key, uint32_t default_value = 0);
+  uint8_t getUChar(const char *key, uint8_t default_value = 0) { return getUInt(key, default_value); }
+  String getString(const char *key, const String default_value = String());
+  size_t getBytesLength(const char *key);
+  size_t getBytes(const char *key, void *buffer, size_t max_length);
+
+private:
+  std::string name;
+  size_t put(const char *key, const String &value);
+};
+
+#endif
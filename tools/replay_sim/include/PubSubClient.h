@@ -0,0 +1,75 @@
+// ----------------------------------------------------------------------
+//
+//   Replay simulator - MQTT client stand-in that captures payloads
+//
+//   Copyright (C) 2022  Shoestring and University of Cambridge
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, version 3 of the License.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see https://www.gnu.org/licenses/.
+//
+// ----------------------------------------------------------------------
+
+
+#ifndef SIM_PUBSUBCLIENT_H
+#define SIM_PUBSUBCLIENT_H
+
+#include "Arduino.h"
+#include "WiFi.h"
+
+/**********************************************************
+ * Always connected. Every publish goes to the simulator's
+ * capture (src/sim_main.cpp) with the virtual time, topic
+ * and payload instead of a broker.
+ **/
+
+#define MQTT_CALLBACK_SIGNATURE std::function<void(char *, uint8_t *, unsigned int)> callback
+
+class PubSubClient {
+public:
+  PubSubClient(Client &client) {}
+  PubSubClient &setServer(const char *domain, uint16_t port) { return *this; }
+  PubSubClient &setServer(IPAddress ip, uint16_t port) { return *this; }
+  PubSubClient &setCallback(MQTT_CALLBACK_SIGNATURE) {
+    this->callback = callback;
+    return *this;
+  }
+  bool setBufferSize(uint16_t size) {
+    buffer_size = size;
+    return true;
+  }
+  uint16_t getBufferSize() { return buffer_size; }
+  PubSubClient &setKeepAlive(uint16_t) { return *this; }
+  PubSubClient &setSocketTimeout(uint16_t) { return *this; }
+  bool connect(const char *id) { return connect(id, nullptr, 0, false, nullptr); }
+  bool connect(const char *id, const char *will_topic, uint8_t will_qos, bool will_retain, const char *will_message);
+  bool connected() { return is_connected; }
+  void disconnect() { is_connected = false; }
+  bool loop() { return is_connected; }
+  int state() { return is_connected ? 0 : -1; }
+  bool publish(const char *topic, const char *payload) { return publish(topic, payload, false); }
+  bool publish(const char *topic, const char *payload, bool retained) {
+    return publish(topic, (const uint8_t *)payload, strlen(payload), retained);
+  }
+  bool publish(const char *topic, const uint8_t *payload, unsigned int length, bool retained = false);
+  bool subscribe(const char *topic, uint8_t qos = 0) { return is_connected; }
+  bool unsubscribe(const char *topic) { return is_connected; }
+
+  // simulator only: deliver a message as if the broker had sent it
+  void sim_deliver(const char *topic, const uint8_t *payload, unsigned int length);
+
+private:
+  bool is_connected = false;
+  uint16_t buffer_size = 256;
+  std::function<void(char *, uint8_t *, unsigned int)> callback;
+};
+
+#endif
@@ -0,0 +1,60 @@
+// ----------------------------------------------------------------------
+//
+//   Replay simulator - SPIClass stand-in
+//
+//   Copyright (C) 2022  Shoestring and University of Cambridge
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, version 3 of the License.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see https://www.gnu.org/licenses/.
+//
+// ----------------------------------------------------------------------
+
+
+#ifndef SIM_SPI_H
+#define SIM_SPI_H
+
+#include "Arduino.h"
+
+/**********************************************************
+ * No SPI devices are emulated: every transfer reads back
+ * zeros, so "spi@<cs>" accelerometers fail their device id
+ * check and are skipped. Use "i2c[@addr]" channels for
+ * multi-channel replays.
+ **/
+
+#define SPI_MODE0 0
+#define SPI_MODE3 3
+#define MSBFIRST 1
+#define FSPI 0
+#define HSPI 1
+
+class SPISettings {
+public:
+  SPISettings() {}
+  SPISettings(uint32_t clock, uint8_t bit_order, uint8_t data_mode) {}
+};
+
+class SPIClass {
+public:
+  SPIClass(uint8_t spi_bus = FSPI) {}
+  bool begin(int8_t sck = -1, int8_t miso = -1, int8_t mosi = -1, int8_t ss = -1) { return true; }
+  void end() {}
+  void beginTransaction(SPISettings) {}
+  void endTransaction() {}
+  uint8_t transfer(uint8_t) { return 0; }
+  void transfer(void *data, uint32_t size) { memset(data, 0, size); }
+  void transferBytes(const uint8_t *data, uint8_t *out, uint32_t size) { memset(out, 0, size); }
+};
+
+extern SPIClass SPI;
+
+#endif
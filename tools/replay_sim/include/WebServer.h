@@ -0,0 +1,55 @@
+// ----------------------------------------------------------------------
+//
+//   Replay simulator - WebServer stand-in
+//
+//   Copyright (C) 2022  Shoestring and University of Cambridge
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, version 3 of the License.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see https://www.gnu.org/licenses/.
+//
+// ----------------------------------------------------------------------
+
+
+#ifndef SIM_WEBSERVER_H
+#define SIM_WEBSERVER_H
+
+#include "WiFi.h"
+
+// no HTTP clients in the simulator: handlers are registered and never called
+enum HTTPMethod { HTTP_ANY,
+                  HTTP_GET,
+                  HTTP_POST };
+#define CONTENT_LENGTH_UNKNOWN ((size_t)-1)
+
+class WebServer {
+public:
+  typedef std::function<void(void)> THandlerFunction;
+  WebServer(int port = 80) {}
+  void on(const String &uri, THandlerFunction handler) {}
+  void on(const String &uri, HTTPMethod method, THandlerFunction handler) {}
+  void onNotFound(THandlerFunction handler) {}
+  void begin() {}
+  void handleClient() {}
+  void send(int code, const char *content_type = nullptr, const String &content = String()) {}
+  void send(int code, const String &content_type, const String &content) {}
+  void send_P(int code, const char *content_type, const char *content, size_t length) {}
+  void sendHeader(const String &name, const String &value, bool first = false) {}
+  void setContentLength(size_t length) {}
+  void sendContent(const String &content) {}
+  void sendContent(const char *content, size_t length) {}
+  String arg(const String &name) { return String(); }
+  bool hasArg(const String &name) { return false; }
+  String uri() { return "/"; }
+  WiFiClient client() { return WiFiClient(); }
+};
+
+#endif
@@ -0,0 +1,114 @@
+// ----------------------------------------------------------------------
+//
+//   Replay simulator - WiFi stand-in
+//
+//   Copyright (C) 2022  Shoestring and University of Cambridge
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, version 3 of the License.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see https://www.gnu.org/licenses/.
+//
+// ----------------------------------------------------------------------
+
+
+#ifndef SIM_WIFI_H
+#define SIM_WIFI_H
+
+#include "Arduino.h"
+#include "IPAddress.h"
+#include "esp_wifi.h"
+
+/**********************************************************
+ * The network is always up in the simulator: the
+ * WifiManager stand-in (src/sim_firmware.cpp) reports
+ * connected and MQTT goes to the payload capture, so no
+ * sockets are ever opened.
+ **/
+
+typedef enum { WL_IDLE_STATUS = 0,
+               WL_NO_SSID_AVAIL,
+               WL_SCAN_COMPLETED,
+               WL_CONNECTED,
+               WL_CONNECT_FAILED,
+               WL_CONNECTION_LOST,
+               WL_DISCONNECTED } wl_status_t;
+
+typedef enum { WIFI_OFF = 0,
+               WIFI_STA,
+               WIFI_AP,
+               WIFI_AP_STA } wifi_mode_t;
+
+typedef enum { ARDUINO_EVENT_WIFI_STA_START,
+               ARDUINO_EVENT_WIFI_STA_CONNECTED,
+               ARDUINO_EVENT_WIFI_STA_DISCONNECTED,
+               ARDUINO_EVENT_WIFI_STA_GOT_IP,
+               ARDUINO_EVENT_WIFI_STA_LOST_IP } arduino_event_id_t;
+typedef arduino_event_id_t WiFiEvent_t;
+
+struct wifi_event_sta_disconnected_t {
+  uint8_t reason;
+};
+union arduino_event_info_t {
+  wifi_event_sta_disconnected_t wifi_sta_disconnected;
+};
+typedef arduino_event_info_t WiFiEventInfo_t;
+typedef size_t wifi_event_id_t;
+
+class Client : public Stream {
+public:
+  virtual int connect(const char *host, uint16_t port) { return 0; }
+  virtual uint8_t connected() { return 0; }
+  virtual void stop() {}
+  size_t write(uint8_t) override { return 1; }
+  size_t write(const uint8_t *, size_t size) override { return size; }
+  using Print::write;
+};
+
+class WiFiClient : public Client {
+public:
+  void setNoDelay(bool) {}
+};
+
+class WiFiClass {
+public:
+  bool mode(wifi_mode_t) { return true; }
+  wifi_mode_t getMode() { return WIFI_STA; }
+  wl_status_t begin(const char *ssid, const char *passphrase = nullptr, int32_t channel = 0,
+                    const uint8_t *bssid = nullptr, bool connect = true) { return WL_CONNECTED; }
+  bool config(IPAddress local, IPAddress gateway, IPAddress subnet, IPAddress dns1 = IPAddress(),
+              IPAddress dns2 = IPAddress()) { return true; }
+  bool disconnect(bool wifi_off = false, bool erase_ap = false) { return true; }
+  bool reconnect() { return true; }
+  bool softAPdisconnect(bool wifi_off = false) { return true; }
+  bool softAPConfig(IPAddress, IPAddress, IPAddress) { return true; }
+  bool softAP(const String &, const String &) { return true; }
+  IPAddress softAPIP() { return IPAddress(192, 168, 4, 1); }
+  wl_status_t status() { return WL_CONNECTED; }
+  IPAddress localIP() { return IPAddress(10, 0, 0, 2); }
+  String macAddress() { return "02:00:00:00:00:01"; }
+  uint8_t *BSSID() {
+    static uint8_t bssid[6] = { 2, 0, 0, 0, 0, 2 };
+    return bssid;
+  }
+  int32_t channel() { return 6; }
+  int8_t RSSI() { return -55; }
+  String SSID() { return "replay"; }
+  bool setSleep(bool) { return true; }
+  bool setSleep(wifi_ps_type_t) { return true; }
+  bool setAutoReconnect(bool) { return true; }
+  void persistent(bool) {}
+  wifi_event_id_t onEvent(std::function<void(WiFiEvent_t, WiFiEventInfo_t)>,
+                          WiFiEvent_t event = ARDUINO_EVENT_WIFI_STA_START) { return 0; }
+};
+
+extern WiFiClass WiFi;
+
+#endif
@@ -0,0 +1,54 @@
+// ----------------------------------------------------------------------
+//
+//   Replay simulator - TwoWire stand-in
+//
+//   Copyright (C) 2022  Shoestring and University of Cambridge
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, version 3 of the License.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see https://www.gnu.org/licenses/.
+//
+// ----------------------------------------------------------------------
+
+
+#ifndef SIM_WIRE_H
+#define SIM_WIRE_H
+
+#include "Arduino.h"
+
+// Register transfers go to the simulated parts on the bus (sim_sensors.cpp). An address nothing
+// answers on is not acknowledged: endTransmission() returns 2 and requestFrom() 0, as on the ESP32
+class TwoWire : public Stream {
+public:
+  TwoWire(uint8_t bus_num = 0) {}
+  bool begin(int sda = -1, int scl = -1, uint32_t frequency = 0) { return true; }
+  bool setClock(uint32_t) { return true; }
+  void beginTransmission(uint8_t address);
+  uint8_t endTransmission(bool stop = true);
+  uint8_t requestFrom(uint8_t address, uint8_t quantity, bool stop = true);
+  size_t write(uint8_t data) override;
+  using Print::write;
+  int read() override;
+  int available() override;
+
+private:
+  uint8_t address = 0;
+  uint8_t tx[8];
+  uint8_t tx_length = 0;
+  uint8_t rx[32];
+  uint8_t rx_length = 0;
+  uint8_t rx_next = 0;
+};
+
+extern TwoWire Wire;
+extern TwoWire Wire1;
+
+#endif
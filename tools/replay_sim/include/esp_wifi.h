@@ -0,0 +1,31 @@
+// ----------------------------------------------------------------------
+//
+//   Replay simulator - esp_wifi stand-in
+//
+//   Copyright (C) 2022  Shoestring and University of Cambridge
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, version 3 of the License.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see https://www.gnu.org/licenses/.
+//
+// ----------------------------------------------------------------------
+
+
+#ifndef SIM_ESP_WIFI_H
+#define SIM_ESP_WIFI_H
+
+typedef enum { WIFI_PS_NONE,
+               WIFI_PS_MIN_MODEM,
+               WIFI_PS_MAX_MODEM } wifi_ps_type_t;
+
+inline int esp_wifi_set_ps(wifi_ps_type_t) { return 0; }
+
+#endif
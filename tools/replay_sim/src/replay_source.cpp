@@ -0,0 +1,279 @@
+// ----------------------------------------------------------------------
+//
+//   Replay simulator - accelerometer sample source
+//
+//   Copyright (C) 2022  Shoestring and University of Cambridge
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, version 3 of the License.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see https://www.gnu.org/licenses/.
+//
+// ----------------------------------------------------------------------
+
+
+#include "replay_source.h"
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+/****** CSV ******/
+
+static bool parse_row(const std::string &line, std::vector<double> &values) {
+  values.clear();
+  const char *p = line.c_str();
+  while (*p) {
+    while (*p == ' ' || *p == '\t' || *p == ',' || *p == ';' || *p == '\r') p++;
+    if (!*p) {
+      break;
+    }
+    char *end;
+    double value = strtod(p, &end);
+    if (end == p) {
+      return false;  // header or comment
+    }
+    values.push_back(value);
+    p = end;
+  }
+  return !values.empty();
+}
+
+bool ReplaySource::load_csv(const std::string &path, int skip_columns, bool single_axis, std::string &error) {
+  std::ifstream file(path);
+  if (!file) {
+    error = "cannot open " + path;
+    return false;
+  }
+  std::string line;
+  std::vector<double> values;
+  size_t columns = 0;
+  size_t line_number = 0;
+  while (std::getline(file, line)) {
+    line_number++;
+    if (!parse_row(line, values)) {
+      continue;
+    }
+    if ((int)values.size() <= skip_columns) {
+      error = path + ":" + std::to_string(line_number) + ": no data after the skipped columns";
+      return false;
+    }
+    values.erase(values.begin(), values.begin() + skip_columns);
+    if (columns == 0) {
+      columns = values.size();
+      bool xyz = !single_axis && columns % 3 == 0;
+      data.resize(xyz ? columns / 3 : columns);
+    } else if (values.size() != columns) {
+      error = path + ":" + std::to_string(line_number) + ": expected " + std::to_string(columns) + " columns";
+      return false;
+    }
+    bool xyz = data.size() * 3 == columns;
+    for (size_t c = 0; c < data.size(); c++) {
+      for (int a = 0; a < 3; a++) {
+        double value = xyz ? values[c * 3 + a] : (a == 2 ? values[c] : 0);
+        data[c].axis[a].push_back(value * scale);
+      }
+    }
+  }
+  if (data.empty() || length() == 0) {
+    error = path + ": no samples";
+    data.clear();
+    return false;
+  }
+  return true;
+}
+
+/****** WAV ******/
+
+static uint32_t le32(const uint8_t *p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint16_t le16(const uint8_t *p) {
+  return p[0] | (p[1] << 8);
+}
+
+// PCM 16/24/32 bit or 32 bit float, normalised to +-1 before --scale
+bool ReplaySource::load_wav(const std::string &path, std::string &error) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file) {
+    error = "cannot open " + path;
+    return false;
+  }
+  std::vector<uint8_t> bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+  if (bytes.size() < 12 || memcmp(&bytes[0], "RIFF", 4) != 0 || memcmp(&bytes[8], "WAVE", 4) != 0) {
+    error = path + ": not a WAV file";
+    return false;
+  }
+
+  uint16_t format = 0, n_channels = 0, bits = 0;
+  const uint8_t *samples = nullptr;
+  size_t samples_length = 0;
+  for (size_t at = 12; at + 8 <= bytes.size();) {
+    uint32_t chunk_length = le32(&bytes[at + 4]);
+    const uint8_t *chunk = &bytes[at + 8];
+    size_t available = std::min((size_t)chunk_length, bytes.size() - at - 8);
+    if (memcmp(&bytes[at], "fmt ", 4) == 0 && available >= 16) {
+      format = le16(chunk);
+      n_channels = le16(chunk + 2);
+      bits = le16(chunk + 14);
+      if (format == 0xFFFE && available >= 26) {  // WAVE_FORMAT_EXTENSIBLE, subformat follows
+        format = le16(chunk + 24);
+      }
+    } else if (memcmp(&bytes[at], "data", 4) == 0) {
+      samples = chunk;
+      samples_length = available;
+    }
+    at += 8 + chunk_length + (chunk_length & 1);
+  }
+
+  bool pcm = format == 1 && (bits == 16 || bits == 24 || bits == 32);
+  bool ieee = format == 3 && bits == 32;
+  if (!samples || n_channels == 0 || (!pcm && !ieee)) {
+    error = path + ": only PCM 16/24/32 bit and 32 bit float WAV files are supported";
+    return false;
+  }
+
+  size_t frame_bytes = n_channels * bits / 8;
+  size_t frames = samples_length / frame_bytes;
+  data.resize(n_channels);
+  for (size_t f = 0; f < frames; f++) {
+    for (uint16_t c = 0; c < n_channels; c++) {
+      const uint8_t *p = samples + f * frame_bytes + c * bits / 8;
+      double value;
+      if (ieee) {
+        float v;
+        memcpy(&v, p, 4);
+        value = v;
+      } else if (bits == 16) {
+        value = (int16_t)le16(p) / 32768.0;
+      } else if (bits == 24) {
+        value = (int32_t)((p[0] << 8) | (p[1] << 16) | ((uint32_t)p[2] << 24)) / 2147483648.0;
+      } else {
+        value = (int32_t)le32(p) / 2147483648.0;
+      }
+      data[c].axis[0].push_back(0);
+      data[c].axis[1].push_back(0);
+      data[c].axis[2].push_back(value * scale);
+    }
+  }
+  if (frames == 0) {
+    error = path + ": no samples";
+    data.clear();
+    return false;
+  }
+  return true;
+}
+
+/****** Reading ******/
+
+void ReplaySource::set_rates(double file_hz, double read_hz) {
+  this->file_hz = file_hz;
+  this->read_hz = read_hz;
+}
+
+ReplaySource::State &ReplaySource::state(int channel) {
+  while ((int)states.size() <= channel) {
+    State s;
+    s.rng = (uint64_t)seed * 0x9E3779B97F4A7C15ull + states.size() + 1;
+    states.push_back(s);
+  }
+  return states[channel];
+}
+
+// recording position of the n-th read, in rows
+double ReplaySource::position(uint64_t reads) {
+  return file_hz > 0 ? reads * file_hz / read_hz : (double)reads;
+}
+
+bool ReplaySource::finished() {
+  return is_recording() && position(state(0).reads) > length() - 1;
+}
+
+double ReplaySource::duration_s() {
+  if (!is_recording()) {
+    return 0;
+  }
+  return file_hz > 0 ? length() / file_hz : length() / read_hz;
+}
+
+// xorshift64* and Box-Muller, so the noise does not depend on the C++ library
+double ReplaySource::gaussian(State &s) {
+  if (s.spare_valid) {
+    s.spare_valid = false;
+    return s.spare;
+  }
+  double u[2];
+  for (int i = 0; i < 2; i++) {
+    s.rng ^= s.rng >> 12;
+    s.rng ^= s.rng << 25;
+    s.rng ^= s.rng >> 27;
+    u[i] = ((s.rng * 0x2545F4914F6CDD1Dull) >> 11) * (1.0 / 9007199254740992.0);
+  }
+  double r = sqrt(-2 * log(u[0] + 1e-300));
+  s.spare = r * sin(2 * M_PI * u[1]);
+  s.spare_valid = true;
+  return r * cos(2 * M_PI * u[1]);
+}
+
+double ReplaySource::shaft_time(double turns) {
+  if (shaft_hz_per_s == 0) {
+    return turns / shaft_hz;
+  }
+  double discriminant = shaft_hz * shaft_hz + 2 * shaft_hz_per_s * turns;
+  if (discriminant < 0) {
+    return INFINITY;
+  }
+  return (sqrt(discriminant) - shaft_hz) / shaft_hz_per_s;
+}
+
+bool ReplaySource::read(int channel, float &x, float &y, float &z) {
+  State &s = state(channel);
+  if (is_recording() && position(s.reads) > length() - 1) {
+    return false;
+  }
+  uint64_t n = s.reads++;
+  double value[3] = { 0, 0, SOURCE_GRAVITY };
+
+  if (is_recording()) {
+    const Channel &recorded = data[channel % data.size()];
+    double p = position(n);
+    size_t i = (size_t)p;
+    double frac = p - i;
+    size_t next = std::min(i + 1, length() - 1);
+    for (int a = 0; a < 3; a++) {
+      value[a] = recorded.axis[a][i] * (1 - frac) + recorded.axis[a][next] * frac;
+    }
+  }
+
+  double t = n / read_hz;
+  for (const Tone &tone : tones) {
+    if (tone.channel < 0 || tone.channel == channel) {
+      value[0] += tone.amplitude * sin(2 * M_PI * tone.hz * t);
+    }
+  }
+  for (const Order &order : orders) {
+    if (order.channel < 0 || order.channel == channel) {
+      value[0] += order.amplitude * sin(2 * M_PI * order.order * shaft_turns(t));
+    }
+  }
+  if (noise_sd > 0) {
+    for (int a = 0; a < 3; a++) {
+      value[a] += noise_sd * gaussian(s);
+    }
+  }
+
+  x = value[0];
+  y = value[1];
+  z = value[2];
+  return true;
+}
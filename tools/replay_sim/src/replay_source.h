@@ -0,0 +1,121 @@
+// ----------------------------------------------------------------------
+//
+//   Replay simulator - accelerometer sample source
+//
+//   Copyright (C) 2022  Shoestring and University of Cambridge
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, version 3 of the License.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see https://www.gnu.org/licenses/.
+//
+// ----------------------------------------------------------------------
+
+
+#ifndef REPLAY_SOURCE_H
+#define REPLAY_SOURCE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**********************************************************
+ * Where the simulated accelerometers get their samples.
+ *
+ * A recording (CSV or WAV) is replayed one row per sensor
+ * read, or resampled by linear interpolation when its rate
+ * is given with --file-rate. CSV files with 3k columns are
+ * k channels of x,y,z; any other count (or --single-axis)
+ * is one channel per column, on z. WAV channels are one
+ * accelerometer channel each. Values are m/s^2 after
+ * --scale.
+ *
+ * Tones and noise are added on top of the recording, or
+ * on top of gravity when there is no recording. Orders are
+ * tones locked to a simulated shaft, whose speed can ramp
+ * at a steady rate; the simulator fires the tach interrupt
+ * from the same shaft. Noise
+ * comes from a fixed PRNG per channel, so the same seed
+ * gives the same samples on every host.
+ **/
+
+#define SOURCE_GRAVITY 9.80665
+
+struct Tone {
+  double hz;
+  double amplitude;  // m/s^2 peak, on x
+  int channel;       // -1 for every channel
+};
+
+struct Order {
+  double order;      // multiple of the shaft speed
+  double amplitude;  // m/s^2 peak, on x
+  int channel;       // -1 for every channel
+};
+
+class ReplaySource {
+public:
+  bool load_csv(const std::string &path, int skip_columns, bool single_axis, std::string &error);
+  bool load_wav(const std::string &path, std::string &error);
+  void add_tone(const Tone &tone) { tones.push_back(tone); }
+  // shaft at hz at the start, changing by hz_per_s every second
+  void set_shaft(double hz, double hz_per_s) {
+    shaft_hz = hz;
+    shaft_hz_per_s = hz_per_s;
+  }
+  void add_order(const Order &order) { orders.push_back(order); }
+  bool has_shaft() { return shaft_hz > 0; }
+  // turns of the shaft t seconds into the source, and when it has made turns (INFINITY if it stops first)
+  double shaft_turns(double t) { return shaft_hz * t + 0.5 * shaft_hz_per_s * t * t; }
+  double shaft_time(double turns);
+  void set_noise(double sd) { noise_sd = sd; }
+  void set_seed(uint32_t seed) { this->seed = seed; }
+  // before load_xxx()
+  void set_scale(double scale) { this->scale = scale; }
+  // file_hz 0: one recorded row per read
+  void set_rates(double file_hz, double read_hz);
+
+  bool read(int channel, float &x, float &y, float &z);
+  // channel 0 has run out of recording
+  bool finished();
+  bool is_recording() { return !data.empty(); }
+  int recorded_channels() { return data.size(); }
+  double duration_s();
+
+private:
+  struct Channel {
+    std::vector<float> axis[3];
+  };
+  struct State {
+    uint64_t reads = 0;
+    uint64_t rng = 0;
+    bool spare_valid = false;
+    double spare = 0;
+  };
+
+  std::vector<Channel> data;
+  std::vector<Tone> tones;
+  std::vector<Order> orders;
+  double shaft_hz = 0;
+  double shaft_hz_per_s = 0;
+  std::vector<State> states;
+  double noise_sd = 0;
+  uint32_t seed = 1;
+  double scale = 1;
+  double file_hz = 0;
+  double read_hz = 1;
+
+  State &state(int channel);
+  double position(uint64_t reads);
+  size_t length() { return data.empty() ? 0 : data[0].axis[2].size(); }
+  double gaussian(State &s);
+};
+
+#endif
@@ -0,0 +1,64 @@
+// ----------------------------------------------------------------------
+//
+//   Replay simulator - shared simulator state
+//
+//   Copyright (C) 2022  Shoestring and University of Cambridge
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, version 3 of the License.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see https://www.gnu.org/licenses/.
+//
+// ----------------------------------------------------------------------
+
+
+#ifndef SIM_H
+#define SIM_H
+
+#include <cstdint>
+#include <cstddef>
+#include <functional>
+
+/**********************************************************
+ * Glue between the stand-in libraries and the simulator.
+ *
+ * Everything the firmware sees as time (micros(), millis(),
+ * delay(), the wall clock) is sim_now_us, which only moves
+ * when the simulator steps it or firmware code waits.
+ **/
+
+#define SIM_EPOCH 1704067200  // wall clock at boot, 2024-01-01T00:00:00Z
+
+extern uint64_t sim_now_us;
+extern int sim_log_level;
+
+inline void sim_advance_us(uint64_t us) {
+  sim_now_us += us;
+}
+
+// next accelerometer sample for a replay channel, false once the recording has run out
+bool sim_read_accel(int channel, float &x, float &y, float &z);
+// channel index for each ADXL345 that starts, in begin() order
+int sim_claim_accel();
+float sim_temperature();
+// runs the handler attached to pin, as an edge would, false if there is none
+bool sim_interrupt(uint8_t pin);
+
+// With --stacks, work runs on a stack of its own for task (a TaskHandle_t) and
+// uxTaskGetStackHighWaterMark() reports what it really used, otherwise it just runs
+extern bool sim_measure_stacks;
+void sim_run_on_task(void *task, const std::function<void()> &work);
+// deepest stack use seen, 0 if nothing ran on the task's stack
+uint32_t sim_stack_used(void *task);
+
+// every MQTT publish ends up here
+void sim_publish(const char *topic, const uint8_t *payload, size_t length, bool retained);
+
+#endif
@@ -0,0 +1,490 @@
+// ----------------------------------------------------------------------
+//
+//   Replay simulator - Arduino core, FreeRTOS and ESP-IDF stand-ins
+//
+//   Copyright (C) 2022  Shoestring and University of Cambridge
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, version 3 of the License.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see https://www.gnu.org/licenses/.
+//
+// ----------------------------------------------------------------------
+
+
+#include <Arduino.h>
+#include <SPI.h>
+#include <Wire.h>
+#include <WiFi.h>
+#include <Preferences.h>
+#include <PubSubClient.h>
+#include <esp_sntp.h>
+#include <nvs.h>
+#include <map>
+#include <ucontext.h>
+#include "sim.h"
+
+/**********************************************************
+ * Arduino core, FreeRTOS and ESP-IDF stand-ins.
+ **/
+
+uint64_t sim_now_us = 0;
+
+HardwareSerial Serial;
+TwoWire Wire(0);
+TwoWire Wire1(1);
+SPIClass SPI;
+WiFiClass WiFi;
+EspClass ESP;
+
+/****** Time ******/
+
+unsigned long millis() {
+  return (unsigned long)(uint32_t)(sim_now_us / 1000);
+}
+
+unsigned long micros() {
+  return (unsigned long)(uint32_t)sim_now_us;
+}
+
+void delay(unsigned long ms) {
+  sim_advance_us((uint64_t)ms * 1000);
+}
+
+void delayMicroseconds(unsigned int us) {
+  sim_advance_us(us);
+}
+
+void yield() {
+}
+
+uint32_t EspClass::getCycleCount() {
+  return (uint32_t)(sim_now_us * getCpuFreqMHz());
+}
+
+void EspClass::restart() {
+  fprintf(stderr, "ESP.restart() called - stopping\n");
+  exit(2);
+}
+
+static sntp_sync_time_cb_t sntp_callback = nullptr;
+
+void sntp_set_time_sync_notification_cb(sntp_sync_time_cb_t callback) {
+  sntp_callback = callback;
+}
+
+void configTime(long gmt_offset_sec, int daylight_offset_sec, const char *server1, const char *server2,
+                const char *server3) {
+  if (sntp_callback) {
+    struct timeval tv;
+    sim_gettimeofday(&tv, nullptr);
+    sntp_callback(&tv);
+  }
+}
+
+int sim_gettimeofday(struct timeval *tv, void *tz) {
+  tv->tv_sec = SIM_EPOCH + sim_now_us / 1000000;
+  tv->tv_usec = sim_now_us % 1000000;
+  return 0;
+}
+
+bool getLocalTime(struct tm *info, uint32_t ms) {
+  time_t now = SIM_EPOCH + sim_now_us / 1000000;
+  gmtime_r(&now, info);
+  return true;
+}
+
+/****** Interrupts ******/
+
+static std::map<uint8_t, std::function<void()>> interrupts;
+
+void attachInterrupt(uint8_t pin, void (*handler)(void), int mode) {
+  interrupts[pin] = handler;
+}
+
+void attachInterruptArg(uint8_t pin, void (*handler)(void *), void *arg, int mode) {
+  interrupts[pin] = [handler, arg]() { handler(arg); };
+}
+
+void detachInterrupt(uint8_t pin) {
+  interrupts.erase(pin);
+}
+
+bool sim_interrupt(uint8_t pin) {
+  auto handler = interrupts.find(pin);
+  if (handler == interrupts.end()) {
+    return false;
+  }
+  handler->second();
+  return true;
+}
+
+/****** FreeRTOS ******/
+
+#define SIM_STACK_SLACK (256 * 1024)  // room past the task's own size, so an overrun is measured, not a crash
+#define SIM_STACK_PAINT 0xA5
+
+struct SimTask {
+  std::string name;
+  uint32_t stack_depth;
+  uint8_t *stack = nullptr;  // painted, allocated on the first sim_run_on_task()
+  size_t stack_size = 0;
+};
+
+bool sim_measure_stacks = false;
+static ucontext_t sim_caller;
+static const std::function<void()> *sim_work;
+
+static void sim_task_entry() {
+  (*sim_work)();
+}
+
+// work on the task's stack, which grows down from the end of the buffer
+void sim_run_on_task(void *handle, const std::function<void()> &work) {
+  SimTask *task = (SimTask *)handle;
+  if (!sim_measure_stacks || task == nullptr) {
+    work();
+    return;
+  }
+  if (task->stack == nullptr) {
+    task->stack_size = task->stack_depth + SIM_STACK_SLACK;
+    task->stack = new uint8_t[task->stack_size];
+    memset(task->stack, SIM_STACK_PAINT, task->stack_size);
+  }
+  ucontext_t context;
+  getcontext(&context);
+  context.uc_stack.ss_sp = task->stack;
+  context.uc_stack.ss_size = task->stack_size;
+  context.uc_link = &sim_caller;
+  makecontext(&context, sim_task_entry, 0);
+  sim_work = &work;
+  swapcontext(&sim_caller, &context);
+}
+
+uint32_t sim_stack_used(void *handle) {
+  SimTask *task = (SimTask *)handle;
+  if (task == nullptr || task->stack == nullptr) {
+    return 0;
+  }
+  size_t untouched = 0;
+  while (untouched < task->stack_size && task->stack[untouched] == SIM_STACK_PAINT) {
+    untouched++;
+  }
+  return task->stack_size - untouched;
+}
+
+struct SimSemaphore {
+  bool available;
+};
+
+BaseType_t xPortGetCoreID() {
+  return 1;
+}
+
+// tasks are only recorded - the simulator runs the sketch's work itself
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t code, const char *name, uint32_t stack_depth, void *parameters,
+                                   UBaseType_t priority, TaskHandle_t *created_task, BaseType_t core_id) {
+  SimTask *task = new SimTask{ name, stack_depth };
+  if (created_task) {
+    *created_task = task;
+  }
+  return pdPASS;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t code, const char *name, uint32_t stack_depth, void *parameters,
+                       UBaseType_t priority, TaskHandle_t *created_task) {
+  return xTaskCreatePinnedToCore(code, name, stack_depth, parameters, priority, created_task, tskNO_AFFINITY);
+}
+
+void vTaskDelete(TaskHandle_t task) {
+  delete (SimTask *)task;
+}
+
+void vTaskSuspend(TaskHandle_t task) {
+}
+
+void vTaskResume(TaskHandle_t task) {
+}
+
+void vTaskDelay(TickType_t ticks) {
+  sim_advance_us((uint64_t)ticks * portTICK_PERIOD_MS * 1000);
+}
+
+void vTaskDelayUntil(TickType_t *previous_wake, TickType_t period) {
+  *previous_wake += period;
+  uint64_t wake_us = (uint64_t)*previous_wake * portTICK_PERIOD_MS * 1000;
+  if (wake_us > sim_now_us) {
+    sim_now_us = wake_us;
+  }
+}
+
+TickType_t xTaskGetTickCount() {
+  return (TickType_t)(sim_now_us / 1000 / portTICK_PERIOD_MS);
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle() {
+  return nullptr;
+}
+
+// without --stacks nothing runs on the task stacks, so they are reported as unused
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task) {
+  if (task == nullptr) {
+    return 0;
+  }
+  uint32_t depth = ((SimTask *)task)->stack_depth;
+  return depth - std::min(sim_stack_used(task), depth);
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks_to_wait) {
+  return 0;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task) {
+  return pdPASS;
+}
+
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *higher_priority_task_woken) {
+}
+
+BaseType_t xTaskNotify(TaskHandle_t task, uint32_t value, eNotifyAction action) {
+  return pdPASS;
+}
+
+BaseType_t xTaskNotifyFromISR(TaskHandle_t task, uint32_t value, eNotifyAction action, BaseType_t *higher_priority_task_woken) {
+  return pdPASS;
+}
+
+BaseType_t xTaskNotifyWait(uint32_t clear_on_entry, uint32_t clear_on_exit, uint32_t *value, TickType_t ticks_to_wait) {
+  if (value) {
+    *value = 0;
+  }
+  return pdFALSE;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex() {
+  return new SimSemaphore{ true };
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary() {
+  return new SimSemaphore{ false };
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks_to_wait) {
+  SimSemaphore *s = (SimSemaphore *)semaphore;
+  if (!s->available) {
+    return pdFALSE;
+  }
+  s->available = false;
+  return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore) {
+  ((SimSemaphore *)semaphore)->available = true;
+  return pdTRUE;
+}
+
+BaseType_t xSemaphoreGiveFromISR(SemaphoreHandle_t semaphore, BaseType_t *higher_priority_task_woken) {
+  return xSemaphoreGive(semaphore);
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t semaphore) {
+  delete (SimSemaphore *)semaphore;
+}
+
+/****** NVS ******/
+
+typedef std::map<std::string, std::vector<uint8_t>> NvsNamespace;
+
+static std::map<std::string, NvsNamespace> nvs_store;
+static std::vector<std::string> nvs_handles;
+
+void sim_nvs_preload(const char *name, const char *key, const char *value) {
+  nvs_store[name][key] = std::vector<uint8_t>(value, value + strlen(value) + 1);
+}
+
+static NvsNamespace *nvs_namespace(nvs_handle_t handle) {
+  if (handle == 0 || handle > nvs_handles.size()) {
+    return nullptr;
+  }
+  return &nvs_store[nvs_handles[handle - 1]];
+}
+
+static esp_err_t nvs_get(nvs_handle_t handle, const char *key, void *value, size_t *length) {
+  NvsNamespace *ns = nvs_namespace(handle);
+  if (!ns || !ns->count(key)) {
+    return ESP_ERR_NVS_NOT_FOUND;
+  }
+  const std::vector<uint8_t> &stored = ns->at(key);
+  if (value == nullptr) {
+    *length = stored.size();
+    return ESP_OK;
+  }
+  if (*length < stored.size()) {
+    return ESP_ERR_NVS_INVALID_LENGTH;
+  }
+  memcpy(value, stored.data(), stored.size());
+  *length = stored.size();
+  return ESP_OK;
+}
+
+static esp_err_t nvs_set(nvs_handle_t handle, const char *key, const void *value, size_t length) {
+  NvsNamespace *ns = nvs_namespace(handle);
+  if (!ns) {
+    return ESP_FAIL;
+  }
+  (*ns)[key] = std::vector<uint8_t>((const uint8_t *)value, (const uint8_t *)value + length);
+  return ESP_OK;
+}
+
+// read-only opens of an empty namespace fail, as on the device
+esp_err_t nvs_open(const char *name, nvs_open_mode_t mode, nvs_handle_t *handle) {
+  if (mode == NVS_READONLY && !nvs_store.count(name)) {
+    return ESP_ERR_NVS_NOT_FOUND;
+  }
+  nvs_store[name];
+  nvs_handles.push_back(name);
+  *handle = nvs_handles.size();
+  return ESP_OK;
+}
+
+void nvs_close(nvs_handle_t handle) {
+}
+
+esp_err_t nvs_commit(nvs_handle_t handle) {
+  return nvs_namespace(handle) ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t nvs_erase_key(nvs_handle_t handle, const char *key) {
+  NvsNamespace *ns = nvs_namespace(handle);
+  if (!ns || !ns->erase(key)) {
+    return ESP_ERR_NVS_NOT_FOUND;
+  }
+  return ESP_OK;
+}
+
+esp_err_t nvs_set_i32(nvs_handle_t handle, const char *key, int32_t value) {
+  String text((long)value);
+  return nvs_set_str(handle, key, text.c_str());
+}
+
+esp_err_t nvs_get_i32(nvs_handle_t handle, const char *key, int32_t *value) {
+  char text[24];
+  size_t length = sizeof(text);
+  esp_err_t err = nvs_get(handle, key, text, &length);
+  if (err != ESP_OK) {
+    return err;
+  }
+  text[sizeof(text) - 1] = '\0';
+  *value = strtol(text, nullptr, 0);
+  return ESP_OK;
+}
+
+esp_err_t nvs_set_str(nvs_handle_t handle, const char *key, const char *value) {
+  return nvs_set(handle, key, value, strlen(value) + 1);
+}
+
+esp_err_t nvs_get_str(nvs_handle_t handle, const char *key, char *value, size_t *length) {
+  return nvs_get(handle, key, value, length);
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char *key, const void *value, size_t length) {
+  return nvs_set(handle, key, value, length);
+}
+
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char *key, void *value, size_t *length) {
+  return nvs_get(handle, key, value, length);
+}
+
+/****** Preferences ******/
+
+static std::map<std::string, std::map<std::string, std::vector<uint8_t>>> preferences_store;
+
+bool Preferences::begin(const char *name, bool read_only) {
+  this->name = name;
+  return true;
+}
+
+bool Preferences::clear() {
+  preferences_store[name].clear();
+  return true;
+}
+
+bool Preferences::remove(const char *key) {
+  return preferences_store[name].erase(key) > 0;
+}
+
+bool Preferences::isKey(const char *key) {
+  return preferences_store[name].count(key) > 0;
+}
+
+size_t Preferences::put(const char *key, const String &value) {
+  return putBytes(key, value.c_str(), value.length() + 1);
+}
+
+size_t Preferences::putBytes(const char *key, const void *value, size_t length) {
+  preferences_store[name][key] = std::vector<uint8_t>((const uint8_t *)value, (const uint8_t *)value + length);
+  return length;
+}
+
+int32_t Preferences::getInt(const char *key, int32_t default_value) {
+  return isKey(key) ? strtol((const char *)preferences_store[name][key].data(), nullptr, 0) : default_value;
+}
+
+uint32_t Preferences::getUInt(const char *key, uint32_t default_value) {
+  return isKey(key) ? strtoul((const char *)preferences_store[name][key].data(), nullptr, 0) : default_value;
+}
+
+String Preferences::getString(const char *key, const String default_value) {
+  return isKey(key) ? String((const char *)preferences_store[name][key].data()) : default_value;
+}
+
+size_t Preferences::getBytesLength(const char *key) {
+  return isKey(key) ? preferences_store[name][key].size() : 0;
+}
+
+size_t Preferences::getBytes(const char *key, void *buffer, size_t max_length) {
+  if (!isKey(key)) {
+    return 0;
+  }
+  const std::vector<uint8_t> &stored = preferences_store[name][key];
+  size_t length = std::min(max_length, stored.size());
+  memcpy(buffer, stored.data(), length);
+  return length;
+}
+
+/****** MQTT ******/
+
+bool PubSubClient::connect(const char *id, const char *will_topic, uint8_t will_qos, bool will_retain,
+                           const char *will_message) {
+  is_connected = true;
+  return true;
+}
+
+bool PubSubClient::publish(const char *topic, const uint8_t *payload, unsigned int length, bool retained) {
+  if (!is_connected) {
+    return false;
+  }
+  // the real client drops anything that does not fit its buffer
+  if (length + strlen(topic) + 7 > buffer_size) {
+    fprintf(stderr, "MQTT publish to %s dropped: %u bytes does not fit the %u byte buffer\n", topic, length,
+            buffer_size);
+    return false;
+  }
+  sim_publish(topic, payload, length, retained);
+  return true;
+}
+
+void PubSubClient::sim_deliver(const char *topic, const uint8_t *payload, unsigned int length) {
+  if (callback) {
+    std::vector<uint8_t> copy(payload, payload + length);
+    std::string topic_copy(topic);
+    callback(&topic_copy[0], copy.data(), length);
+  }
+}
@@ -0,0 +1,107 @@
+// ----------------------------------------------------------------------
+//
+//   Replay simulator - stand-ins for the network, display and logger modules
+//
+//   Copyright (C) 2022  Shoestring and University of Cambridge
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, version 3 of the License.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see https://www.gnu.org/licenses/.
+//
+// ----------------------------------------------------------------------
+
+
+#include "logger.h"
+#include "boot_profiler.h"
+#include "wifi_manager.h"
+#include "temp_ap.h"
+#include "config_display.h"
+#include "sim.h"
+
+/**********************************************************
+ * Replacements for the firmware modules that only talk to
+ * the outside world (logger.cpp, wifi_manager.cpp,
+ * temp_ap.cpp, config_display.cpp). Everything else is
+ * built from the sketch sources unchanged.
+ **/
+
+int sim_log_level = LOG_LEVEL_WARN;
+
+/****** Logger - straight to stderr with the virtual time ******/
+
+Logger logger;
+
+static const char level_tags[] = { '-', 'E', 'W', 'I', 'D' };
+
+bool LogRateLimit::allow(uint32_t interval_ms) {
+  uint32_t now = millis();
+  if (first || now - last >= interval_ms) {
+    first = false;
+    last = now;
+    return true;
+  }
+  return false;
+}
+
+Logger::Logger()
+  : head(0), n_dropped(0), n_rate_limited(0) {
+}
+
+void Logger::begin(unsigned long baud) {
+  started = true;
+}
+
+void Logger::write(uint8_t level, const char *format, ...) {
+  if (level > sim_log_level) {
+    return;
+  }
+  char text[LOG_LINE_LENGTH];
+  va_list args;
+  va_start(args, format);
+  vsnprintf(text, sizeof(text), format, args);
+  va_end(args);
+  fprintf(stderr, "[%9.3f] %c %s\n", sim_now_us / 1e6, level_tags[level], text);
+}
+
+/****** WiFi - connected from the start ******/
+
+WifiManager::WifiManager(ConfigManager *cm_ptr)
+  : config_manager_ptr(cm_ptr), state(STA_STATE::start), last_state(STA_STATE::none) {
+}
+
+WifiManager::~WifiManager() {
+}
+
+void WifiManager::begin() {
+  state = STA_STATE::connected;
+  connected = true;
+  metrics.connects = 1;
+  boot_profiler.milestone("wifi_connected");
+}
+
+TempAP::TempAP()
+  : ap_ssid("shoestring-esp32-setup"), ap_password(""), local_ip(192, 168, 0, 1), gateway(192, 168, 0, 1),
+    subnet(255, 255, 255, 0) {
+}
+
+TempAP::~TempAP() {
+}
+
+/****** Display - nothing to draw on ******/
+
+void ConfigDisplay::initialise() {
+}
+
+void ConfigDisplay::set_field(Field field, const String &value) {
+}
+
+void ConfigDisplay::setSpectrum(const float *band_magnitudes, uint8_t n_bands, float rms) {
+}
@@ -0,0 +1,462 @@
+// ----------------------------------------------------------------------
+//
+//   Replay simulator - main loop and capture
+//
+//   Copyright (C) 2022  Shoestring and University of Cambridge
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, version 3 of the License.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see https://www.gnu.org/licenses/.
+//
+// ----------------------------------------------------------------------
+
+
+#include <Arduino.h>
+#include <nvs.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fstream>
+#include <iostream>
+#include "shoestring_lib.h"
+#include "aux_sensors.h"
+#include "burst.h"
+#include "logger.h"
+#include "replay_source.h"
+#include "sim.h"
+
+/**********************************************************
+ * Runs the sketch against a recording on a virtual clock.
+ *
+ * Each sampling period the simulator runs, in order, what
+ * the device runs concurrently: one sampler tick (Task1,
+ * skipped between bursts), any auxiliary sensor reads that
+ * are due (AuxSensors task), any --trigger message that is
+ * due and, when Task2 is free, one shoestring loop. Time
+ * only moves when the simulator steps it or the firmware
+ * waits, so the same inputs always give the same output.
+ *
+ * Every MQTT message is captured as one line:
+ *   <millis>\t<topic>\t<payload>
+ **/
+
+// from the sketch
+extern unsigned int sampling_period_us;
+extern TaskHandle_t Task1;
+extern TaskHandle_t Task2;
+extern ShoestringLib shlib;
+extern PubSubClient client;
+void setup();
+void sampler_begin();
+void sampler_step(uint32_t period_start);
+
+struct Options {
+  std::string csv;
+  std::string wav;
+  double file_rate = 0;
+  double scale = 1;
+  int skip_columns = 0;
+  bool single_axis = false;
+  double seconds = 0;
+  long frames = 0;
+  float temperature = 21.5;
+  std::string out;
+  std::string golden;
+  double tolerance = 1e-3;
+  double abs_tolerance = 0.01;
+  std::vector<double> triggers;  // seconds after start, ascending
+  double tach_bounce_us = 0;
+  double drop_at_s = 0;
+  long drop_reads = 0;
+  int drop_channel = -1;  // every channel
+  size_t max_payload = 0;
+};
+
+static ReplaySource source;
+static Options options;
+static int claimed_accels = 0;
+static std::ostream *capture = &std::cout;
+static std::vector<std::string> captured;
+static long frames_published = 0;
+static size_t largest_message = 0;  // as PubSubClient's buffer holds it
+static std::string largest_topic;
+static std::vector<long> dropped;  // reads failed so far by --drop, per channel
+
+bool sim_read_accel(int channel, float &x, float &y, float &z) {
+  if (!source.read(channel, x, y, z)) {
+    return false;
+  }
+  // --drop: the sample is lost, the signal carries on
+  if (options.drop_reads > 0 && millis() >= options.drop_at_s * 1000
+      && (options.drop_channel < 0 || options.drop_channel == channel)) {
+    dropped.resize(std::max(dropped.size(), (size_t)channel + 1));
+    if (dropped[channel] < options.drop_reads) {
+      dropped[channel]++;
+      return false;
+    }
+  }
+  return true;
+}
+
+int sim_claim_accel() {
+  return claimed_accels++;
+}
+
+float sim_temperature() {
+  return options.temperature;
+}
+
+void sim_publish(const char *topic, const uint8_t *payload, size_t length, bool retained) {
+  std::string line = std::to_string(millis()) + "\t" + topic + "\t" + std::string((const char *)payload, length);
+  *capture << line << "\n";
+  captured.push_back(line);
+  // fixed header (up to 5 bytes), topic length, topic, payload
+  size_t message = 5 + 2 + strlen(topic) + length;
+  if (message > largest_message) {
+    largest_message = message;
+    largest_topic = topic;
+  }
+  // frames only, not status/ messages or the frame topic's sub-topics
+  if (topic == shlib.getString("mqtt_topic") + "/" + shlib.getString("identifier")) {
+    frames_published++;
+  }
+}
+
+/****** Golden comparison ******/
+
+static std::vector<std::string> split(const std::string &text, const char *delimiters) {
+  std::vector<std::string> tokens;
+  size_t start = 0;
+  for (;;) {
+    size_t end = text.find_first_of(delimiters, start);
+    if (end != start) {
+      tokens.push_back(text.substr(start, end == std::string::npos ? std::string::npos : end - start));
+    }
+    if (end == std::string::npos) {
+      return tokens;
+    }
+    tokens.push_back(text.substr(end, 1));
+    start = end + 1;
+  }
+}
+
+static bool is_number(const std::string &token, double &value) {
+  char *end;
+  value = strtod(token.c_str(), &end);
+  return !token.empty() && *end == '\0';
+}
+
+// numbers match within either tolerance, everything else exactly
+static bool same_token(const std::string &expected, const std::string &actual) {
+  double a, b;
+  if (is_number(expected, a) && is_number(actual, b)) {
+    double difference = fabs(a - b);
+    return difference <= options.abs_tolerance || difference <= options.tolerance * std::max(fabs(a), fabs(b));
+  }
+  return expected == actual;
+}
+
+static bool compare_golden() {
+  std::ifstream file(options.golden);
+  if (!file) {
+    fprintf(stderr, "golden: cannot open %s\n", options.golden.c_str());
+    return false;
+  }
+  std::vector<std::string> expected;
+  std::string line;
+  while (std::getline(file, line)) {
+    expected.push_back(line);
+  }
+
+  const int max_reports = 10;
+  int mismatches = 0;
+  size_t n = std::max(expected.size(), captured.size());
+  for (size_t i = 0; i < n; i++) {
+    if (i >= expected.size() || i >= captured.size()) {
+      if (mismatches++ < max_reports) {
+        fprintf(stderr, "golden: line %zu only in the %s\n", i + 1, i >= expected.size() ? "replay" : "golden file");
+      }
+      continue;
+    }
+    std::vector<std::string> want = split(expected[i], "\t{}[],:\"");
+    std::vector<std::string> got = split(captured[i], "\t{}[],:\"");
+    size_t j = 0;
+    while (j < want.size() && j < got.size() && same_token(want[j], got[j])) j++;
+    if (j < want.size() || j < got.size()) {
+      if (mismatches++ < max_reports) {
+        fprintf(stderr, "golden: line %zu token %zu: expected \"%s\", got \"%s\"\n", i + 1, j + 1,
+                j < want.size() ? want[j].c_str() : "", j < got.size() ? got[j].c_str() : "");
+      }
+    }
+  }
+  if (mismatches) {
+    fprintf(stderr, "golden: %d of %zu lines differ from %s\n", mismatches, n, options.golden.c_str());
+    return false;
+  }
+  fprintf(stderr, "golden: %zu lines match %s\n", n, options.golden.c_str());
+  return true;
+}
+
+/****** Command line ******/
+
+static void usage() {
+  fprintf(stderr,
+          "usage: replay_sim [options]\n"
+          "  --csv FILE           replay a CSV recording (m/s^2)\n"
+          "  --wav FILE           replay a WAV recording\n"
+          "  --file-rate HZ       sample rate of the recording, default one row per sensor read\n"
+          "  --scale K            multiply recorded values by K, e.g. 9.80665 for g\n"
+          "  --skip-columns N     ignore the first N CSV columns, e.g. a time column\n"
+          "  --single-axis        one channel per CSV column, even with 3k columns\n"
+          "  --tone F:AMP[:CH]    add a sine of F Hz and AMP m/s^2 peak (repeatable)\n"
+          "  --shaft HZ[:HZ/S]    simulated shaft speed, optionally ramping, for --order and the tach\n"
+          "  --order N:AMP[:CH]   add a sine at N times the shaft speed, AMP m/s^2 peak (repeatable)\n"
+          "  --tach-bounce US     a second tach edge US after every pulse\n"
+          "  --drop S:N[:CH]      every sensor (or channel CH) fails N reads in a row from S seconds in\n"
+          "  --noise SD           add gaussian noise of SD m/s^2\n"
+          "  --seed N             noise seed (default 1)\n"
+          "  --temp C             temperature sensor reading (default 21.5)\n"
+          "  --config KEY=VALUE   preset a config item (repeatable)\n"
+          "  --seconds S          stop after S seconds (default 30 without a recording)\n"
+          "  --frames N           stop after N published frames\n"
+          "  --trigger S          send cmd/<identifier>/measure S seconds in (repeatable)\n"
+          "  --out FILE           write the capture to FILE instead of stdout\n"
+          "  --golden FILE        compare the capture with FILE, exit 1 if it differs\n"
+          "  --tolerance REL      relative tolerance for numbers (default 1e-3)\n"
+          "  --abs-tolerance ABS  absolute tolerance for numbers (default 0.01)\n"
+          "  --max-payload N      exit 1 if any message would take more than N bytes of the MQTT buffer\n"
+          "                       or the firmware refused a frame as too big\n"
+          "  --stacks             run the sampler and Task2 on stacks of their own and report their use\n"
+          "  --verbose            firmware log down to INFO (default WARN)\n"
+          "  --quiet              firmware errors only\n");
+  exit(2);
+}
+
+static void parse_args(int argc, char **argv) {
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    auto value = [&]() -> std::string {
+      if (i + 1 >= argc) {
+        fprintf(stderr, "%s needs a value\n", arg.c_str());
+        usage();
+      }
+      return argv[++i];
+    };
+    if (arg == "--csv") {
+      options.csv = value();
+    } else if (arg == "--wav") {
+      options.wav = value();
+    } else if (arg == "--file-rate") {
+      options.file_rate = atof(value().c_str());
+    } else if (arg == "--scale") {
+      options.scale = atof(value().c_str());
+    } else if (arg == "--skip-columns") {
+      options.skip_columns = atoi(value().c_str());
+    } else if (arg == "--single-axis") {
+      options.single_axis = true;
+    } else if (arg == "--tone") {
+      Tone tone = { 0, 0, -1 };
+      if (sscanf(value().c_str(), "%lf:%lf:%d", &tone.hz, &tone.amplitude, &tone.channel) < 2) {
+        fprintf(stderr, "--tone wants F:AMP[:CH]\n");
+        usage();
+      }
+      source.add_tone(tone);
+    } else if (arg == "--shaft") {
+      double hz = 0, hz_per_s = 0;
+      if (sscanf(value().c_str(), "%lf:%lf", &hz, &hz_per_s) < 1 || hz <= 0) {
+        fprintf(stderr, "--shaft wants HZ[:HZ/S]\n");
+        usage();
+      }
+      source.set_shaft(hz, hz_per_s);
+    } else if (arg == "--order") {
+      Order order = { 0, 0, -1 };
+      if (sscanf(value().c_str(), "%lf:%lf:%d", &order.order, &order.amplitude, &order.channel) < 2) {
+        fprintf(stderr, "--order wants N:AMP[:CH]\n");
+        usage();
+      }
+      source.add_order(order);
+    } else if (arg == "--tach-bounce") {
+      options.tach_bounce_us = atof(value().c_str());
+    } else if (arg == "--drop") {
+      if (sscanf(value().c_str(), "%lf:%ld:%d", &options.drop_at_s, &options.drop_reads, &options.drop_channel) < 2) {
+        fprintf(stderr, "--drop wants S:N[:CH]\n");
+        usage();
+      }
+    } else if (arg == "--noise") {
+      source.set_noise(atof(value().c_str()));
+    } else if (arg == "--seed") {
+      source.set_seed(strtoul(value().c_str(), nullptr, 0));
+    } else if (arg == "--temp") {
+      options.temperature = atof(value().c_str());
+    } else if (arg == "--config") {
+      std::string item = value();
+      size_t equals = item.find('=');
+      if (equals == std::string::npos) {
+        fprintf(stderr, "--config wants KEY=VALUE\n");
+        usage();
+      }
+      sim_nvs_preload(CONFIG_NAMESPACE, item.substr(0, equals).c_str(), item.substr(equals + 1).c_str());
+    } else if (arg == "--seconds") {
+      options.seconds = atof(value().c_str());
+    } else if (arg == "--frames") {
+      options.frames = atol(value().c_str());
+    } else if (arg == "--trigger") {
+      options.triggers.push_back(atof(value().c_str()));
+    } else if (arg == "--out") {
+      options.out = value();
+    } else if (arg == "--golden") {
+      options.golden = value();
+    } else if (arg == "--tolerance") {
+      options.tolerance = atof(value().c_str());
+    } else if (arg == "--abs-tolerance") {
+      options.abs_tolerance = atof(value().c_str());
+    } else if (arg == "--max-payload") {
+      options.max_payload = atol(value().c_str());
+    } else if (arg == "--stacks") {
+      sim_measure_stacks = true;
+    } else if (arg == "--verbose") {
+      sim_log_level = LOG_LEVEL_INFO;
+    } else if (arg == "--quiet") {
+      sim_log_level = LOG_LEVEL_ERROR;
+    } else {
+      usage();
+    }
+  }
+}
+
+// setup() spins forever when a sensor is missing
+static void setup_stuck(int) {
+  static const char message[] = "setup() did not return - check the accels config\n";
+  ssize_t ignored = write(2, message, sizeof(message) - 1);
+  (void)ignored;
+  _exit(2);
+}
+
+int main(int argc, char **argv) {
+  parse_args(argc, argv);
+
+  std::string error;
+  source.set_scale(options.scale);
+  if (!options.csv.empty() && !source.load_csv(options.csv, options.skip_columns, options.single_axis, error)) {
+    fprintf(stderr, "%s\n", error.c_str());
+    return 2;
+  }
+  if (!options.wav.empty() && !source.load_wav(options.wav, error)) {
+    fprintf(stderr, "%s\n", error.c_str());
+    return 2;
+  }
+  if (!source.is_recording() && options.seconds <= 0 && options.frames <= 0) {
+    options.seconds = 30;
+  }
+
+  std::ofstream out_file;
+  if (!options.out.empty()) {
+    out_file.open(options.out);
+    if (!out_file) {
+      fprintf(stderr, "cannot write %s\n", options.out.c_str());
+      return 2;
+    }
+    capture = &out_file;
+  }
+
+  signal(SIGALRM, setup_stuck);
+  alarm(10);
+  setup();
+  alarm(0);
+
+  sampler_begin();
+  double read_hz = 1e6 / sampling_period_us;
+  source.set_rates(options.file_rate, read_hz);
+  if (source.is_recording() && claimed_accels > source.recorded_channels()) {
+    fprintf(stderr, "%d sensors but only %d recorded channels - channels repeat\n", claimed_accels,
+            source.recorded_channels());
+  }
+
+  uint64_t start = sim_now_us;
+  uint64_t end = options.seconds > 0 ? start + (uint64_t)(options.seconds * 1e6) : UINT64_MAX;
+  uint64_t aux_due = start;
+  uint64_t task2_due = start;
+  std::sort(options.triggers.begin(), options.triggers.end());
+  size_t next_trigger = 0;
+  std::string trigger_topic = std::string("cmd/") + shlib.getString("identifier").c_str() + "/measure";
+  int tach_pin = source.has_shaft() ? shlib.getInt("tach_pin") : -1;
+  int tach_ppr = std::max(shlib.getInt("tach_ppr"), 1);
+  uint64_t next_pulse = 0;
+  uint64_t ticks_sampled = 0;  // the source's clock, which stops between bursts
+  for (uint64_t t = start; t < end; t += sampling_period_us) {
+    if (source.finished()) {
+      break;
+    }
+    sim_now_us = t;
+    if (burst.is_sampling()) {
+      // tach edges since the last tick, at their own time
+      double source_s = ticks_sampled / read_hz;
+      while (tach_pin >= 0 && source.shaft_time((double)next_pulse / tach_ppr) <= source_s) {
+        uint64_t edge_us = t - (uint64_t)((source_s - source.shaft_time((double)next_pulse / tach_ppr)) * 1e6);
+        sim_now_us = edge_us;
+        sim_interrupt(tach_pin);
+        if (options.tach_bounce_us > 0) {
+          sim_now_us = std::min(edge_us + (uint64_t)options.tach_bounce_us, t);
+          sim_interrupt(tach_pin);
+        }
+        next_pulse++;
+      }
+      sim_now_us = t;
+      sim_run_on_task(Task1, [t]() { sampler_step((uint32_t)t); });
+      ticks_sampled++;
+    }
+
+    if (t >= aux_due) {
+      sim_now_us = t;
+      uint32_t sleep_ms = aux_sensors.poll_due();
+      aux_due = sim_now_us + (uint64_t)std::max(sleep_ms, (uint32_t)1) * 1000;
+    }
+
+    while (next_trigger < options.triggers.size() && t >= start + (uint64_t)(options.triggers[next_trigger] * 1e6)) {
+      sim_now_us = t;
+      client.sim_deliver(trigger_topic.c_str(), (const uint8_t *)"", 0);
+      next_trigger++;
+    }
+
+    if (t >= task2_due) {
+      sim_now_us = t;
+      sim_run_on_task(Task2, []() { shlib.loop(); });
+      task2_due = std::max(sim_now_us, t + 1);
+      if (options.frames > 0 && frames_published >= options.frames) {
+        break;
+      }
+    }
+  }
+
+  capture->flush();
+  fprintf(stderr, "replayed %.3f s at %.2f Hz: %ld frames, %zu messages\n", (sim_now_us - start) / 1e6, read_hz,
+          frames_published, captured.size());
+  if (sim_measure_stacks) {
+    for (auto task : { std::make_pair("Task1", Task1), std::make_pair("Task2", Task2) }) {
+      fprintf(stderr, "stack %s: %u bytes used, host build\n", task.first, sim_stack_used(task.second));
+    }
+  }
+
+  if (options.max_payload > 0) {
+    fprintf(stderr, "largest message %zu bytes on %s, limit %zu\n", largest_message, largest_topic.c_str(),
+            options.max_payload);
+  }
+
+  bool ok = options.golden.empty() || compare_golden();
+  if (largest_message > options.max_payload && options.max_payload > 0) {
+    fprintf(stderr, "payload: %zu bytes is over --max-payload %zu\n", largest_message, options.max_payload);
+    ok = false;
+  }
+  if (shlib.get_frames_refused() > 0 && options.max_payload > 0) {
+    fprintf(stderr, "payload: %u frames too big to publish\n", (unsigned)shlib.get_frames_refused());
+    ok = false;
+  }
+  return ok ? 0 : 1;
+}
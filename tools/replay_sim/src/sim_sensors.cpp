@@ -0,0 +1,150 @@
+// ----------------------------------------------------------------------
+//
+//   Replay simulator - sensor stand-ins
+//
+//   Copyright (C) 2022  Shoestring and University of Cambridge
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, version 3 of the License.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see https://www.gnu.org/licenses/.
+//
+// ----------------------------------------------------------------------
+
+
+#include <Adafruit_ADXL345_U.h>
+#include <Adafruit_MCP9808.h>
+#include <algorithm>
+#include <vector>
+#include "sim.h"
+
+/****** ADXL345 ******/
+
+#define ADXL345_REG_DATAX0 0x32
+
+// the parts that have begun, all on Wire as with the Adafruit driver
+static std::vector<Adafruit_ADXL345_Unified *> adxl345s;
+
+// every sensor that answers becomes the next replay channel
+bool Adafruit_ADXL345_Unified::begin(uint8_t address) {
+  if (channel < 0) {
+    channel = sim_claim_accel();
+    this->address = address;
+    adxl345s.push_back(this);
+  }
+  return true;
+}
+
+// pointing at the data registers takes the next sample: quantised to the 4mg steps of full resolution
+// mode and clipped at the range, as the part would be. A dropped read does not acknowledge
+bool Adafruit_ADXL345_Unified::sim_write(const uint8_t *data, uint8_t length) {
+  if (length == 0) {
+    return true;
+  }
+  reg = data[0];
+  if (reg != ADXL345_REG_DATAX0 || length > 1) {
+    return true;
+  }
+  float value[3];
+  if (!sim_read_accel(channel, value[0], value[1], value[2])) {
+    return false;
+  }
+  const float lsb = ADXL345_MG2G_MULTIPLIER * SENSORS_GRAVITY_STANDARD;
+  const int limit = (2 << range) * SENSORS_GRAVITY_STANDARD / lsb + 0.5f;
+  for (int a = 0; a < 3; a++) {
+    counts[a] = constrain((int)round(value[a] / lsb), -limit, limit - 1);
+  }
+  return true;
+}
+
+bool Adafruit_ADXL345_Unified::sim_read(uint8_t *data, uint8_t length) {
+  for (uint8_t i = 0; i < length; i++) {
+    uint8_t r = reg + i;
+    bool in_data = r >= ADXL345_REG_DATAX0 && r < ADXL345_REG_DATAX0 + 6;
+    data[i] = in_data ? counts[(r - ADXL345_REG_DATAX0) / 2] >> (8 * ((r - ADXL345_REG_DATAX0) % 2)) : 0;
+  }
+  return true;
+}
+
+// a failed read gives 0g and still returns true, as the Adafruit driver does
+bool Adafruit_ADXL345_Unified::getEvent(sensors_event_t *event) {
+  const uint8_t start = ADXL345_REG_DATAX0;
+  uint8_t data[6] = { 0 };
+  if (sim_write(&start, 1)) {
+    sim_read(data, sizeof(data));
+  }
+  const float lsb = ADXL345_MG2G_MULTIPLIER * SENSORS_GRAVITY_STANDARD;
+  memset(event, 0, sizeof(*event));
+  event->sensor_id = channel;
+  event->timestamp = millis();
+  event->acceleration.x = (int16_t)(data[0] | (data[1] << 8)) * lsb;
+  event->acceleration.y = (int16_t)(data[2] | (data[3] << 8)) * lsb;
+  event->acceleration.z = (int16_t)(data[4] | (data[5] << 8)) * lsb;
+  return true;
+}
+
+/****** I2C ******/
+
+static Adafruit_ADXL345_Unified *part_at(TwoWire *wire, uint8_t address) {
+  if (wire != &Wire) {
+    return nullptr;
+  }
+  for (Adafruit_ADXL345_Unified *part : adxl345s) {
+    if (part->sim_address() == address) {
+      return part;
+    }
+  }
+  return nullptr;
+}
+
+void TwoWire::beginTransmission(uint8_t address) {
+  this->address = address;
+  tx_length = 0;
+}
+
+size_t TwoWire::write(uint8_t data) {
+  if (tx_length >= sizeof(tx)) {
+    return 0;
+  }
+  tx[tx_length++] = data;
+  return 1;
+}
+
+uint8_t TwoWire::endTransmission(bool stop) {
+  Adafruit_ADXL345_Unified *part = part_at(this, address);
+  return part != nullptr && part->sim_write(tx, tx_length) ? 0 : 2;
+}
+
+uint8_t TwoWire::requestFrom(uint8_t address, uint8_t quantity, bool stop) {
+  rx_length = 0;
+  rx_next = 0;
+  Adafruit_ADXL345_Unified *part = part_at(this, address);
+  quantity = std::min(quantity, (uint8_t)sizeof(rx));
+  if (part == nullptr || !part->sim_read(rx, quantity)) {
+    return 0;
+  }
+  rx_length = quantity;
+  return quantity;
+}
+
+int TwoWire::read() {
+  return rx_next < rx_length ? rx[rx_next++] : -1;
+}
+
+int TwoWire::available() {
+  return rx_length - rx_next;
+}
+
+/****** MCP9808 ******/
+
+float Adafruit_MCP9808::readTempC() {
+  delayMicroseconds(250);  // one 16 bit register read at 400kHz
+  return sim_temperature();
+}
@@ -0,0 +1,52 @@
+// ----------------------------------------------------------------------
+//
+//   Replay simulator - the sketch as a translation unit
+//
+//   Copyright (C) 2022  Shoestring and University of Cambridge
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, version 3 of the License.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see https://www.gnu.org/licenses/.
+//
+// ----------------------------------------------------------------------
+
+
+/**********************************************************
+ * Builds the sketch as a normal C++ file, the way the
+ * Arduino builder does: the sketch's own includes first,
+ * then prototypes for its functions, then the sketch.
+ *
+ * Add a prototype here when the sketch gains a function
+ * that is used before it is defined.
+ **/
+
+#include <Arduino.h>
+#include "shoestring_lib.h"
+#include <ArduinoJson.h>
+
+void sampler_begin();
+void sampler_step(uint32_t period_start);
+void Task1code(void *pvParameters);
+void Task2code(void *pvParameters);
+bool loop_callback(FrameDocument &JSONdoc);
+float calculateRMS(float *vData);
+void removeOffset(float *vData);
+void downSample(float *vData, uint16_t bufferSize, FrameDocument &JSONdoc);
+void attachSpectrum(float *scratch, FrameDocument &JSONdoc);
+void publishTracking();
+void analyseOrders(const float *buffer, uint32_t start_us, JsonObject out);
+void releaseBuffers();
+void analyseCepstrum(JsonArray out);
+float peakSNR(const float *vData, float *scratch);
+void PrintVector(float *vData, uint16_t bufferSize, uint8_t scaleType);
+char get_timestamp();
+
+#include "esp32_VibrationMonitoring.ino"
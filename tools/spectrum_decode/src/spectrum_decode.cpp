@@ -0,0 +1,369 @@
+// ----------------------------------------------------------------------
+//
+//   Spectrum decoder - command line tool
+//
+//   Copyright (C) 2022  Shoestring and University of Cambridge
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, version 3 of the License.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see https://www.gnu.org/licenses/.
+//
+// ----------------------------------------------------------------------
+
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "spectrum_codec.h"
+
+/**********************************************************
+ * Decodes the "spectrum" of frames captured from the
+ * firmware (tools/replay_sim output, or <millis>\t<topic>\t
+ * <payload> lines from a broker) and checks the codec's
+ * error bounds:
+ *
+ *   spectrum_decode CAPTURE            every bin as CSV
+ *   spectrum_decode --check CAPTURE    band maxima against the bins
+ *   spectrum_decode --selftest         synthetic round trips
+ *
+ * --check compares each "fft" band maximum in a frame with
+ * the largest decoded bin of the same band. Quantisation
+ * is monotonic, so they must agree within step_db / 2, or
+ * the band must be below the threshold if the bins decode
+ * to 0. --selftest does the same bin by bin for synthetic
+ * spectra at every code size, with and without the floor.
+ *
+ * Both exit 1 when a bound is broken.
+ **/
+
+// numbers in the frame are rounded when serialised
+#define ROUNDING_DB 1e-3
+
+struct Frame {
+  std::string millis;
+  int channel = 0;
+  SpectrumHeader header;
+  float bin_hz = 0;
+  std::string data;
+  std::vector<double> bands;
+};
+
+/****** Capture parsing ******/
+
+// the value after "key": inside object, or false
+static bool find_number(const std::string &object, const char *key, double &value) {
+  std::string pattern = std::string("\"") + key + "\":";
+  size_t at = object.find(pattern);
+  if (at == std::string::npos) {
+    return false;
+  }
+  value = strtod(object.c_str() + at + pattern.size(), nullptr);
+  return true;
+}
+
+static bool find_string(const std::string &object, const char *key, std::string &value) {
+  std::string pattern = std::string("\"") + key + "\":\"";
+  size_t at = object.find(pattern);
+  if (at == std::string::npos) {
+    return false;
+  }
+  size_t start = at + pattern.size();
+  size_t end = object.find('"', start);
+  if (end == std::string::npos) {
+    return false;
+  }
+  value = object.substr(start, end - start);
+  return true;
+}
+
+// the {...} that follows "key": - the spectrum holds no nested objects
+static bool find_object(const std::string &payload, const char *key, std::string &object) {
+  std::string pattern = std::string("\"") + key + "\":{";
+  size_t at = payload.find(pattern);
+  if (at == std::string::npos) {
+    return false;
+  }
+  size_t start = at + pattern.size() - 1;
+  size_t end = payload.find('}', start);
+  if (end == std::string::npos) {
+    return false;
+  }
+  object = payload.substr(start, end - start + 1);
+  return true;
+}
+
+static bool parse_frame(const std::string &line, Frame &frame) {
+  size_t first = line.find('\t');
+  size_t second = first == std::string::npos ? first : line.find('\t', first + 1);
+  if (second == std::string::npos || line.compare(first + 1, 7, "status/") == 0) {
+    return false;
+  }
+  std::string payload = line.substr(second + 1);
+  std::string spectrum;
+  if (!find_object(payload, "spectrum", spectrum)) {
+    return false;
+  }
+  frame.millis = line.substr(0, first);
+
+  double value;
+  frame.channel = find_number(payload, "channel", value) ? (int)value : 0;
+  SpectrumHeader &header = frame.header;
+  header.bins = find_number(spectrum, "bins", value) ? (uint16_t)value : 0;
+  header.bits = find_number(spectrum, "bits", value) ? (uint8_t)value : 0;
+  header.top_db = find_number(spectrum, "top_db", value) ? value : 0;
+  header.step_db = find_number(spectrum, "step_db", value) ? value : 0;
+  header.floor_db = find_number(spectrum, "floor_db", value) ? value : NAN;
+  frame.bin_hz = find_number(spectrum, "bin_hz", value) ? value : 0;
+  if (!find_string(spectrum, "data", frame.data) || header.bins == 0 || header.bits < SPECTRUM_MIN_BITS ||
+      header.bits > SPECTRUM_MAX_BITS) {
+    return false;
+  }
+
+  // "fft":[{"frequency":"A-0","magnitude":1.23},...]
+  size_t fft = payload.find("\"fft\":[");
+  size_t fft_end = fft == std::string::npos ? fft : payload.find(']', fft);
+  for (size_t at = fft; at != std::string::npos && at < fft_end;) {
+    at = payload.find("\"magnitude\":", at);
+    if (at == std::string::npos || at > fft_end) {
+      break;
+    }
+    at += strlen("\"magnitude\":");
+    frame.bands.push_back(strtod(payload.c_str() + at, nullptr));
+  }
+  return true;
+}
+
+static bool decode(const SpectrumHeader &header, const std::string &data, std::vector<uint16_t> &codes) {
+  std::vector<uint8_t> packed(spectrum_packed_bytes(header.bins, header.bits));
+  size_t length = base64_decode(data.c_str(), packed.data(), packed.size());
+  codes.resize(header.bins);
+  return length > 0 && spectrum_unpack(packed.data(), length, header, codes.data());
+}
+
+// lowest dB a bin can have and still get a non-zero code
+static float threshold_db(const SpectrumHeader &header) {
+  float bottom = header.top_db - SPECTRUM_RANGE_DB - header.step_db / 2;
+  return isnan(header.floor_db) ? bottom : fmaxf(bottom, header.floor_db);
+}
+
+// error of a decoded value against the original, 0 if within the bound
+static double bound_error(double original, uint16_t code, const SpectrumHeader &header, double &error_db) {
+  if (code == 0) {
+    error_db = 0;
+    double excess = original > 0 ? 20 * log10(original) - threshold_db(header) : -1;
+    return excess >= ROUNDING_DB ? excess : 0;
+  }
+  error_db = fabs(20 * log10(spectrum_level(code, header)) - 20 * log10(original));
+  double excess = error_db - header.step_db / 2;
+  return excess > ROUNDING_DB ? excess : 0;
+}
+
+/****** Modes ******/
+
+static int print_capture(const char *path) {
+  std::ifstream in(path);
+  if (!in) {
+    fprintf(stderr, "cannot read %s\n", path);
+    return 2;
+  }
+  printf("millis,channel,bin,hz,magnitude\n");
+  std::string line;
+  Frame frame;
+  std::vector<uint16_t> codes;
+  while (std::getline(in, line)) {
+    if (!parse_frame(line, frame)) {
+      continue;
+    }
+    if (!decode(frame.header, frame.data, codes)) {
+      fprintf(stderr, "frame at %s ms: corrupt spectrum\n", frame.millis.c_str());
+      continue;
+    }
+    for (uint16_t i = 0; i < frame.header.bins; i++) {
+      printf("%s,%d,%u,%.4f,%.6g\n", frame.millis.c_str(), frame.channel, i, i * frame.bin_hz,
+             spectrum_level(codes[i], frame.header));
+    }
+  }
+  return 0;
+}
+
+static int check_capture(const char *path) {
+  std::ifstream in(path);
+  if (!in) {
+    fprintf(stderr, "cannot read %s\n", path);
+    return 2;
+  }
+  std::string line;
+  Frame frame;
+  std::vector<uint16_t> codes;
+  int frames = 0, bands = 0, failures = 0;
+  double worst_db = 0, max_step_db = 0;
+  size_t bytes = 0;
+  while (std::getline(in, line)) {
+    frame = Frame();
+    if (!parse_frame(line, frame)) {
+      continue;
+    }
+    frames++;
+    if (!decode(frame.header, frame.data, codes)) {
+      fprintf(stderr, "frame at %s ms: corrupt spectrum\n", frame.millis.c_str());
+      failures++;
+      continue;
+    }
+    bytes += frame.data.size();
+    max_step_db = std::max(max_step_db, (double)frame.header.step_db);
+
+    // the sketch's downSample(): n_bands + 1 bands of 0.5 * (samples / n_bands) bins
+    if (frame.bands.size() < 2) {
+      continue;
+    }
+    uint16_t n_bands = frame.bands.size() - 1;
+    uint16_t per_band = 0.5 * ((2 * frame.header.bins) / n_bands);
+    for (uint16_t b = 0; b < frame.bands.size() && (b + 1) * per_band <= frame.header.bins; b++) {
+      uint16_t code = 0;
+      for (uint16_t i = b * per_band; i < (b + 1) * per_band; i++) {
+        code = std::max(code, codes[i]);
+      }
+      double error_db;
+      double excess = bound_error(frame.bands[b], code, frame.header, error_db);
+      worst_db = std::max(worst_db, error_db);
+      bands++;
+      if (excess > 0) {
+        failures++;
+        fprintf(stderr, "frame at %s ms, band %u: %.6g decodes to %.6g, %.4f dB past the bound\n",
+                frame.millis.c_str(), b, frame.bands[b], spectrum_level(code, frame.header), excess);
+      }
+    }
+  }
+  if (frames == 0) {
+    fprintf(stderr, "no frames with a spectrum in %s\n", path);
+    return 1;
+  }
+  printf("%d frames, %.0f bytes of spectrum each, %d bands checked, worst %.4f dB (bound %.4f dB), %d failures\n",
+         frames, (double)bytes / frames, bands, worst_db, max_step_db / 2, failures);
+  return failures ? 1 : 0;
+}
+
+static uint32_t seed = 1;
+
+static float uniform() {
+  seed ^= seed << 13;
+  seed ^= seed >> 17;
+  seed ^= seed << 5;
+  return (seed >> 8) * (1.0f / 16777216.0f);
+}
+
+// 0: noise floor with harmonics, 1: very wide dynamic range, 2: alternating extremes (worst case size)
+static void synthetic(int kind, std::vector<float> &magnitude) {
+  uint16_t bins = magnitude.size();
+  for (uint16_t i = 0; i < bins; i++) {
+    switch (kind) {
+      case 0:
+        magnitude[i] = 1 + 2 * uniform();
+        break;
+      case 1:
+        magnitude[i] = powf(10, -6 + 8 * uniform());
+        break;
+      default:
+        magnitude[i] = i & 1 ? 1e-9f : 1000;
+        break;
+    }
+  }
+  if (kind == 0) {
+    for (uint16_t h = 1; h * 60 + 1 < bins; h++) {
+      magnitude[h * 60] = 400.0f / h;
+      magnitude[h * 60 - 1] = magnitude[h * 60 + 1] = 120.0f / h;
+    }
+  }
+  magnitude[0] = 0;
+}
+
+static int selftest(uint16_t bins) {
+  static const char *kinds[] = { "harmonics", "wide range", "alternating" };
+  std::vector<float> magnitude(bins), scratch(bins);
+  std::vector<uint16_t> codes(bins), decoded;
+  int failures = 0;
+  printf("%-12s %4s %6s %6s %9s %10s\n", "spectrum", "bits", "floor", "bytes", "bits/bin", "worst dB");
+  for (int kind = 0; kind < 3; kind++) {
+    synthetic(kind, magnitude);
+    for (uint8_t bits = SPECTRUM_MIN_BITS; bits <= SPECTRUM_MAX_BITS; bits += 4) {
+      for (float floor_db : { (float)NAN, 6.0f }) {
+        SpectrumHeader header;
+        std::vector<uint8_t> packed(spectrum_packed_bytes(bins, bits));
+        std::vector<char> text(spectrum_text_bytes(bins, bits));
+        spectrum_quantise(magnitude.data(), bins, bits, floor_db, scratch.data(), codes.data(), header);
+        size_t length = spectrum_pack(codes.data(), header, packed.data());
+        size_t text_length = base64_encode(packed.data(), length, text.data());
+        if (length > packed.size() || text_length + 1 > text.size()) {
+          fprintf(stderr, "%s, %u bits: %zu bytes is past the worst case\n", kinds[kind], bits, length);
+          failures++;
+        }
+
+        // as the header goes through JSON
+        char rounded[32];
+        snprintf(rounded, sizeof(rounded), "%.9g", header.top_db);
+        header.top_db = atof(rounded);
+        if (!decode(header, text.data(), decoded)) {
+          fprintf(stderr, "%s, %u bits: does not decode\n", kinds[kind], bits);
+          failures++;
+          continue;
+        }
+        double worst_db = 0;
+        for (uint16_t i = 0; i < bins; i++) {
+          double error_db;
+          if (decoded[i] != codes[i]) {
+            fprintf(stderr, "%s, %u bits: bin %u decodes to code %u, not %u\n", kinds[kind], bits, i, decoded[i],
+                    codes[i]);
+            failures++;
+            break;
+          }
+          if (bound_error(magnitude[i], decoded[i], header, error_db) > 0) {
+            fprintf(stderr, "%s, %u bits: bin %u is %.4f dB off\n", kinds[kind], bits, i, error_db);
+            failures++;
+          }
+          worst_db = std::max(worst_db, error_db);
+        }
+        printf("%-12s %4u %6s %6zu %9.2f %10.4f\n", kinds[kind], bits, isnan(floor_db) ? "-" : "6 dB",
+               text_length, length * 8.0 / bins, worst_db);
+      }
+    }
+  }
+  printf(failures ? "%d failures\n" : "all within bounds\n", failures);
+  return failures ? 1 : 0;
+}
+
+static void usage() {
+  fprintf(stderr,
+          "usage: spectrum_decode CAPTURE            print every bin as CSV\n"
+          "       spectrum_decode --check CAPTURE    check band maxima against the decoded bins\n"
+          "       spectrum_decode --selftest [BINS]  round trip synthetic spectra (default 512 bins)\n");
+  exit(2);
+}
+
+int main(int argc, char **argv) {
+  if (argc == 2 && strcmp(argv[1], "--selftest") != 0 && argv[1][0] != '-') {
+    return print_capture(argv[1]);
+  }
+  if (argc == 3 && strcmp(argv[1], "--check") == 0) {
+    return check_capture(argv[2]);
+  }
+  if ((argc == 2 || argc == 3) && strcmp(argv[1], "--selftest") == 0) {
+    int bins = argc == 3 ? atoi(argv[2]) : 512;
+    if (bins < 4 || bins > 4096) {
+      usage();
+    }
+    return selftest(bins);
+  }
+  usage();
+}